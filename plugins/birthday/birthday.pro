@@ -22,6 +22,7 @@
 
 TEMPLATE = lib
 QT -= gui
+QT += dbus
 
 CONFIG += plugin
 
@@ -42,11 +43,13 @@ DEFINES += ENABLE_DEBUG
 
 HEADERS  = cdbirthdaycalendar.h \
     cdbirthdaycontroller.h \
-    cdbirthdayplugin.h
+    cdbirthdayplugin.h \
+    cdbirthdayupcoming.h
 
 SOURCES  = cdbirthdaycalendar.cpp \
     cdbirthdaycontroller.cpp \
-    cdbirthdayplugin.cpp
+    cdbirthdayplugin.cpp \
+    cdbirthdayupcoming.cpp
 
 TARGET = birthdayplugin
 target.path = $$LIBDIR/contactsd-1.0/plugins
@@ -31,6 +31,7 @@
 #include <recurrencerule.h>
 
 #include "cdbirthdaycalendar.h"
+#include "cdbirthdayupcoming.h"
 #include "debug.h"
 
 using namespace Contactsd;
@@ -41,11 +42,20 @@ const QLatin1String calNotebookId("b1376da7-5555-1111-2222-227549c4e570");
 const QLatin1String calNotebookColor("#e00080"); // Pink
 const QString calIdExtension = QLatin1String("com.nokia.birthday/");
 
+#ifdef USING_QTPIM
+quint32 numericContactId(const QContactId &id);
+#else
+const QContactLocalId &numericContactId(const QContactLocalId &id);
+#endif
+
 
 CDBirthdayCalendar::CDBirthdayCalendar(SyncMode syncMode, QObject *parent) :
     QObject(parent),
     mCalendar(0),
-    mStorage(0)
+    mStorage(0),
+    mUpcoming(0),
+    mIndexLoaded(false),
+    mBatchDepth(0)
 {
     mCalendar = mKCal::ExtendedCalendar::Ptr(new mKCal::ExtendedCalendar(KDateTime::Spec::LocalZone()));
     mStorage = mKCal::ExtendedCalendar::defaultStorage(mCalendar);
@@ -115,15 +125,56 @@ mKCal::Notebook::Ptr CDBirthdayCalendar::createNotebook()
                                                     0));
 }
 
+void CDBirthdayCalendar::setUpcoming(CDBirthdayUpcoming *upcoming)
+{
+    mUpcoming = upcoming;
+
+    if (not mIndexLoaded) {
+        // The upcoming birthdays are filled as the index is loaded
+        loadIndex();
+        return;
+    }
+
+    mUpcoming->clear();
+    QHash<ContactIdType, IndexEntry>::const_iterator it = mIndex.constBegin(), end = mIndex.constEnd();
+    for ( ; it != end; ++it) {
+        mUpcoming->updateBirthday(numericContactId(it.key()), it->birthday.date(), it->birthday.summary());
+    }
+}
+
 QHash<CDBirthdayCalendar::ContactIdType, CalendarBirthday>
 CDBirthdayCalendar::birthdays()
 {
+    QHash<ContactIdType, CalendarBirthday> result;
+
+    if (not loadIndex()) {
+        return result;
+    }
+
+    QHash<ContactIdType, IndexEntry>::const_iterator it = mIndex.constBegin(), end = mIndex.constEnd();
+    for ( ; it != end; ++it) {
+        result.insert(it.key(), it->birthday);
+    }
+
+    return result;
+}
+
+bool CDBirthdayCalendar::loadIndex()
+{
+    if (mIndexLoaded) {
+        return true;
+    }
+
+    // Load the whole notebook once; afterwards the index is maintained by our own writes
     if (not mStorage->loadNotebookIncidences(calNotebookId)) {
         warning() << Q_FUNC_INFO << "Failed to load all incidences";
-        return QHash<ContactIdType, CalendarBirthday>();
+        return false;
     }
 
-    QHash<ContactIdType, CalendarBirthday> result;
+    mIndex.clear();
+    if (mUpcoming) {
+        mUpcoming->clear();
+    }
 
     foreach(const KCalCore::Event::Ptr event, mCalendar->events()) {
         const QString eventUid = event->uid();
@@ -134,13 +185,20 @@ CDBirthdayCalendar::birthdays()
 #else
         if (0 != contactId) {
 #endif
-            result.insert(contactId, CalendarBirthday(event->dtStart().date(), event->summary()));
+            IndexEntry entry;
+            entry.birthday = CalendarBirthday(event->dtStart().date(), event->summary());
+            entry.event = event;
+            mIndex.insert(contactId, entry);
+            if (mUpcoming) {
+                mUpcoming->updateBirthday(numericContactId(contactId), entry.birthday.date(), entry.birthday.summary());
+            }
         } else {
             warning() << Q_FUNC_INFO << "Birthday event with a bad uid: " << eventUid;
         }
     }
 
-    return result;
+    mIndexLoaded = true;
+    return true;
 }
 
 #ifdef USING_QTPIM
@@ -165,7 +223,13 @@ void CDBirthdayCalendar::updateBirthday(const QContact &contact)
         return;
     }
 
-    setReadOnly(false);
+    // Outside a batch, the change is saved on its own
+    if (mBatchDepth == 0) {
+        beginBatch();
+        updateBirthday(contact);
+        commitBatch();
+        return;
+    }
 
     if (not mStorage->isValidNotebook(calNotebookId)) {
         warning() << Q_FUNC_INFO << "Invalid notebook ID: " << calNotebookId;
@@ -265,12 +329,26 @@ void CDBirthdayCalendar::updateBirthday(const QContact &contact)
 
     event->setReadOnly(true);
     event->endUpdates();
-    setReadOnly(true);
+
+    IndexEntry &entry(mIndex[contactId(contact)]);
+    entry.birthday = CalendarBirthday(contactBirthday, displayLabel);
+    entry.event = event;
+    if (mUpcoming) {
+        mUpcoming->updateBirthday(numericContactId(contactId(contact)), contactBirthday, displayLabel);
+    }
+
     debug() << "Updated birthday event in calendar, local ID: " << contactId(contact);
 }
 
 void CDBirthdayCalendar::deleteBirthday(ContactIdType contactId)
 {
+    if (mBatchDepth == 0) {
+        beginBatch();
+        deleteBirthday(contactId);
+        commitBatch();
+        return;
+    }
+
     KCalCore::Event::Ptr event = calendarEvent(contactId);
 
     if (event.isNull()) {
@@ -279,28 +357,47 @@ void CDBirthdayCalendar::deleteBirthday(ContactIdType contactId)
     }
 
     mCalendar->deleteEvent(event);
+    mIndex.remove(contactId);
+    if (mUpcoming) {
+        mUpcoming->deleteBirthday(numericContactId(contactId));
+    }
 
     debug() << "Deleted birthday event in calendar, local ID: " << event->uid();
 }
 
-void CDBirthdayCalendar::save()
+void CDBirthdayCalendar::beginBatch()
+{
+    if (mBatchDepth++ == 0) {
+        setReadOnly(false);
+    }
+}
+
+void CDBirthdayCalendar::commitBatch()
 {
-    setReadOnly(false);
+    if (mBatchDepth == 0) {
+        warning() << Q_FUNC_INFO << "No batch to commit";
+        return;
+    }
+
+    if (--mBatchDepth > 0) {
+        return;
+    }
+
     if (not mStorage->save()) {
         warning() << Q_FUNC_INFO << "Failed to update birthdays in calendar";
+    } else {
+        emit batchSaved();
     }
     setReadOnly(true);
 }
 
 CalendarBirthday CDBirthdayCalendar::birthday(ContactIdType contactId)
 {
-    KCalCore::Event::Ptr event = calendarEvent(contactId);
-
-    if (event.isNull()) {
+    if (not loadIndex()) {
         return CalendarBirthday();
     }
 
-    return CalendarBirthday(event->dtStart().date(), event->summary());
+    return mIndex.value(contactId).birthday;
 }
 
 #ifdef USING_QTPIM
@@ -351,14 +448,12 @@ QString CDBirthdayCalendar::calendarEventId(ContactIdType contactId)
 
 KCalCore::Event::Ptr CDBirthdayCalendar::calendarEvent(ContactIdType contactId)
 {
-    const QString eventId = calendarEventId(contactId);
-
-    if (not mStorage->load(eventId)) {
-        warning() << Q_FUNC_INFO << "Unable to load event from calendar";
+    if (not loadIndex()) {
+        warning() << Q_FUNC_INFO << "Unable to load events from calendar";
         return KCalCore::Event::Ptr();
     }
 
-    KCalCore::Event::Ptr event = mCalendar->event(eventId);
+    KCalCore::Event::Ptr event = mIndex.value(contactId).event;
 
     if (event.isNull()) {
         debug() << Q_FUNC_INFO << "Not found in calendar:" << contactId;
@@ -31,6 +31,8 @@
 #include <extendedstorage.h>
 #include <extendedcalendar.h>
 
+class CDBirthdayUpcoming;
+
 #ifdef USING_QTPIM
 QTCONTACTS_USE_NAMESPACE
 #else
@@ -74,24 +76,35 @@ public:
     explicit CDBirthdayCalendar(SyncMode syncMode, QObject *parent = 0);
     ~CDBirthdayCalendar();
 
-    //! Updates and saves Birthday of \a contact to calendar.
+    //! Updates Birthday of \a contact in calendar; outside a batch, the change is saved at once.
     void updateBirthday(const QContact &contact);
 
-    //! Deletes \a contact birthday from calendar.
+    //! Deletes \a contact birthday from calendar; outside a batch, the change is saved at once.
     void deleteBirthday(ContactIdType contactId);
 
-    //! Actually save the events in the calendar database
-    void save();
+    //! Starts a batch of updates and deletions, unlocking the notebook once for all of them.
+    void beginBatch();
+
+    //! Actually saves the events of the current batch in the calendar database.
+    void commitBatch();
+
+    //! Keeps \a upcoming up to date with the birthdays in the calendar, filling it now.
+    void setUpcoming(CDBirthdayUpcoming *upcoming);
 
     CalendarBirthday birthday(ContactIdType contactId);
     QHash<ContactIdType, CalendarBirthday> birthdays();
 
+Q_SIGNALS:
+    //! Emitted when the events of a batch have been saved in the calendar database.
+    void batchSaved();
+
 private:
     mKCal::Notebook::Ptr createNotebook();
 
     static ContactIdType localContactId(const QString &calendarEventId);
     static QString calendarEventId(ContactIdType contactId);
 
+    bool loadIndex();
     KCalCore::Event::Ptr calendarEvent(ContactIdType contactId);
     void setReadOnly(bool readOnly, bool save = false);
 
@@ -99,8 +112,17 @@ private Q_SLOTS:
     void onLocaleChanged();
 
 private:
+    struct IndexEntry {
+        CalendarBirthday birthday;
+        KCalCore::Event::Ptr event;
+    };
+
     mKCal::ExtendedCalendar::Ptr mCalendar;
     mKCal::ExtendedStorage::Ptr mStorage;
+    CDBirthdayUpcoming *mUpcoming;
+    QHash<ContactIdType, IndexEntry> mIndex;
+    bool mIndexLoaded;
+    int mBatchDepth;
 };
 
 #endif // CDBIRTHDAYCALENDAR_H
@@ -24,12 +24,14 @@
 #include "cdbirthdaycontroller.h"
 #include "cdbirthdaycalendar.h"
 #include "cdbirthdayplugin.h"
+#include "cdbirthdayupcoming.h"
 #include "debug.h"
 
 #include <QDir>
 #include <QFile>
 
 #include <QContactBirthday>
+#include <QContactChangeLogFilter>
 #include <QContactDetailFilter>
 #include <QContactFetchRequest>
 #include <QContactSyncTarget>
@@ -52,6 +54,9 @@ namespace {
 // version number for current type of birthday events. Increase number when changing event details.
 const int CURRENT_BIRTHDAY_VERSION = 1;
 const int UPDATE_TIMEOUT = 1000; // ms
+// changes committed shortly before a sync started may be notified after it, so the stored sync time is moved back
+const int CHANGELOG_MARGIN = 60; // s
+const int CATCHUP_RETRY_TIMEOUT = 30000; // ms
 
 template<typename DetailType>
 QContactDetailFilter detailFilter(
@@ -76,7 +81,10 @@ QContactDetailFilter detailFilter(
 CDBirthdayController::CDBirthdayController(QObject *parent)
     : QObject(parent)
     , mCalendar(0)
+    , mUpcoming(0)
     , mManager(0)
+    , mActiveFetches(0)
+    , mCatchUpPending(true)
 {
     // We don't need to handle presence changes, so report them separately and ignore them
     QMap<QString, QString> parameters;
@@ -102,11 +110,29 @@ CDBirthdayController::CDBirthdayController(QObject *parent)
 
     connect(mManager, SIGNAL(dataChanged()), SLOT(updateAllBirthdays()));
 
-    const CDBirthdayCalendar::SyncMode syncMode = stampFileUpToDate() ? CDBirthdayCalendar::KeepOldDB :
-                                                                        CDBirthdayCalendar::DropOldDB;
+    const bool stampUpToDate = stampFileUpToDate();
+    const CDBirthdayCalendar::SyncMode syncMode = stampUpToDate ? CDBirthdayCalendar::KeepOldDB :
+                                                                  CDBirthdayCalendar::DropOldDB;
 
     mCalendar = new CDBirthdayCalendar(syncMode, this);
-    updateAllBirthdays();
+
+    // The upcoming birthdays are served from the calendar's index, which is loaded up front
+    mUpcoming = new CDBirthdayUpcoming(this);
+    mCalendar->setUpcoming(mUpcoming);
+    mUpcoming->registerDBusObject();
+
+    mCatchUpRetryTimer.setInterval(CATCHUP_RETRY_TIMEOUT);
+    mCatchUpRetryTimer.setSingleShot(true);
+    connect(&mCatchUpRetryTimer, SIGNAL(timeout()), SLOT(onCatchUpRetryTimeout()));
+
+    // A full sync is only needed when the event version changed, or we have never synced.
+    // Until either sync succeeds, incremental updates do not advance the last sync time.
+    const QDateTime lastSync = stampUpToDate ? lastSyncTimestamp() : QDateTime();
+    if (lastSync.isValid()) {
+        updateChangedBirthdays(lastSync);
+    } else {
+        updateAllBirthdays();
+    }
 
     mUpdateTimer.setInterval(UPDATE_TIMEOUT);
     mUpdateTimer.setSingleShot(true);
@@ -120,8 +146,10 @@ CDBirthdayController::~CDBirthdayController()
 void
 CDBirthdayController::contactsChanged(const QList<ContactIdType>& contacts)
 {
-    foreach (const ContactIdType &id, contacts)
+    foreach (const ContactIdType &id, contacts) {
         mUpdatedContacts.insert(id);
+        mRemovedContacts.remove(id);
+    }
 
     // Just restart the timer - if it doesn't expire, we can afford to wait
     mUpdateTimer.start();
@@ -129,9 +157,13 @@ CDBirthdayController::contactsChanged(const QList<ContactIdType>& contacts)
 
 void CDBirthdayController::contactsRemoved(const QList<ContactIdType>& contacts)
 {
-    foreach (const ContactIdType &id, contacts)
-        mCalendar->deleteBirthday(id);
-    mCalendar->save();
+    // Removals are coalesced with changes, and deleted in one batch
+    foreach (const ContactIdType &id, contacts) {
+        mRemovedContacts.insert(id);
+        mUpdatedContacts.remove(id);
+    }
+
+    mUpdateTimer.start();
 }
 
 
@@ -176,12 +208,47 @@ CDBirthdayController::stampFilePath() const
     return BasePlugin::cacheFileName(QLatin1String("calendar.stamp"));
 }
 
+QDateTime
+CDBirthdayController::lastSyncTimestamp()
+{
+    QFile syncFile(lastSyncFilePath());
+    if (!syncFile.open(QIODevice::ReadOnly)) {
+        return QDateTime();
+    }
+
+    QDateTime timestamp = QDateTime::fromString(QString::fromLatin1(syncFile.read(100).trimmed()), Qt::ISODate);
+    timestamp.setTimeSpec(Qt::UTC);
+    return timestamp;
+}
+
+void
+CDBirthdayController::storeLastSyncTimestamp(const QDateTime &timestamp)
+{
+    QFile syncFile(lastSyncFilePath());
+
+    if (not syncFile.open(QIODevice::WriteOnly)) {
+        warning() << Q_FUNC_INFO << "Unable to create birthday plugin sync file "
+                  << syncFile.fileName() << " with error " << syncFile.errorString();
+        return;
+    }
+
+    syncFile.write(timestamp.addSecs(-CHANGELOG_MARGIN).toUTC().toString(Qt::ISODate).toLatin1());
+}
+
+QString
+CDBirthdayController::lastSyncFilePath() const
+{
+    return BasePlugin::cacheFileName(QLatin1String("calendar.synced"));
+}
+
 void
 CDBirthdayController::updateAllBirthdays()
 {
     // Fetch any contact with a birthday.
     QContactDetailFilter fetchFilter(detailFilter<QContactBirthday>());
-    fetchContacts(fetchFilter, SLOT(onFullSyncRequestStateChanged(QContactAbstractRequest::State)));
+    if (not fetchContacts(fetchFilter, SLOT(onFullSyncRequestStateChanged(QContactAbstractRequest::State)))) {
+        catchUpFailed();
+    }
 }
 
 void
@@ -193,9 +260,87 @@ CDBirthdayController::onFullSyncRequestStateChanged(QContactAbstractRequest::Sta
     }
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Change log sync logic
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void
+CDBirthdayController::updateChangedBirthdays(const QDateTime &since)
+{
+    debug() << "Updating birthdays changed since" << since;
+
+    // Removed contacts are only reported by ID
+    QContactChangeLogFilter removedFilter(QContactChangeLogFilter::EventRemoved);
+    removedFilter.setSince(since);
+
+    const QList<ContactIdType> removedIds = mManager->contactIds(removedFilter);
+    if (mManager->error() != QContactManager::NoError) {
+        warning() << Q_FUNC_INFO << "Unable to query removed contacts, code:" << mManager->error();
+        catchUpFailed();
+        return;
+    }
+
+    if (!removedIds.isEmpty()) {
+        mCalendar->beginBatch();
+        foreach (const ContactIdType &id, removedIds)
+            mCalendar->deleteBirthday(id);
+        mCalendar->commitBatch();
+    }
+
+    QContactChangeLogFilter addedFilter(QContactChangeLogFilter::EventAdded);
+    addedFilter.setSince(since);
+    QContactChangeLogFilter changedFilter(QContactChangeLogFilter::EventChanged);
+    changedFilter.setSince(since);
+
+    if (not fetchContacts(addedFilter | changedFilter,
+                          SLOT(onChangeLogSyncRequestStateChanged(QContactAbstractRequest::State)))) {
+        catchUpFailed();
+    }
+}
+
+void
+CDBirthdayController::onChangeLogSyncRequestStateChanged(QContactAbstractRequest::State newState)
+{
+    processFetchRequest(qobject_cast<QContactFetchRequest*>(sender()), newState, ChangeLogSync);
+}
+
+void
+CDBirthdayController::catchUpFailed()
+{
+    if (not mCatchUpPending || mCatchUpRetryTimer.isActive()) {
+        return;
+    }
+
+    // Nothing reports the changes we missed again, so fall back to a full sync
+    warning() << Q_FUNC_INFO << "Birthday calendar catch-up failed, retrying with a full sync in"
+              << CATCHUP_RETRY_TIMEOUT << "ms";
+    mCatchUpRetryTimer.start();
+}
+
+void
+CDBirthdayController::onCatchUpRetryTimeout()
+{
+    if (mCatchUpPending) {
+        updateAllBirthdays();
+    }
+}
+
 void
 CDBirthdayController::onUpdateQueueTimeout()
 {
+    if (!mRemovedContacts.isEmpty()) {
+        mCalendar->beginBatch();
+        foreach (const ContactIdType &id, mRemovedContacts)
+            mCalendar->deleteBirthday(id);
+        mCalendar->commitBatch();
+
+        mRemovedContacts.clear();
+    }
+
+    if (mUpdatedContacts.isEmpty()) {
+        return;
+    }
+
     QList<ContactIdType> contactIds(mUpdatedContacts.toList());
 
     // If we request too many contact IDs, we will exceed the SQLite bound variable limit
@@ -237,7 +382,7 @@ CDBirthdayController::onFetchRequestStateChanged(QContactAbstractRequest::State
 // Common sync logic
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
-void
+bool
 CDBirthdayController::fetchContacts(const QContactFilter &filter, const char *slot)
 {
     QContactFetchHint fetchHint;
@@ -266,13 +411,19 @@ CDBirthdayController::fetchContacts(const QContactFilter &filter, const char *sl
 
     connect(fetchRequest, SIGNAL(stateChanged(QContactAbstractRequest::State)), slot);
 
+    // Changes made after this time may not be included in the results
+    fetchRequest->setProperty("syncStart", QDateTime::currentDateTimeUtc());
+
     if (not fetchRequest->start()) {
         warning() << Q_FUNC_INFO << "Unable to start birthday contact fetch request";
         delete fetchRequest;
-        return;
+        return false;
     }
 
+    ++mActiveFetches;
+
     debug() << "Birthday contacts fetch request started";
+    return true;
 }
 
 bool
@@ -297,11 +448,14 @@ CDBirthdayController::processFetchRequest(QContactFetchRequest *const fetchReque
         } else {
             const QList<QContact> contacts = fetchRequest->contacts();
 
+            // All changes from this request are saved in one batch
+            mCalendar->beginBatch();
             if (FullSync == syncMode) {
                 syncBirthdays(contacts);
             } else {
                 updateBirthdays(contacts);
             }
+            mCalendar->commitBatch();
             success = true;
         }
 
@@ -314,9 +468,24 @@ CDBirthdayController::processFetchRequest(QContactFetchRequest *const fetchReque
         return false;
     }
 
-    // Save the calendar in any case (success or not), since this "save" call
-    // also applies for the deleteBirthday() calls in processNotificationQueues()
-    mCalendar->save();
+    --mActiveFetches;
+
+    if (syncMode != Incremental) {
+        if (success) {
+            mCatchUpPending = false;
+            mCatchUpRetryTimer.stop();
+        } else {
+            catchUpFailed();
+        }
+    }
+
+    // Incremental updates only cover all changes up to their start when nothing else is outstanding,
+    // and the changes made before this run have been caught up with
+    if (success && (syncMode != Incremental ||
+                    (not mCatchUpPending && mActiveFetches == 0 && mUpdatedContacts.isEmpty() &&
+                     mRemovedContacts.isEmpty() && !mUpdateTimer.isActive()))) {
+        storeLastSyncTimestamp(fetchRequest->property("syncStart").toDateTime());
+    }
 
     // Provide hint we are done with this request.
     fetchRequest->deleteLater();
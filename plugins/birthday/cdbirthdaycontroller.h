@@ -24,6 +24,7 @@
 #ifndef CDBIRTHDAYCONTROLLER_H
 #define CDBIRTHDAYCONTROLLER_H
 
+#include <QDateTime>
 #include <QSet>
 #include <QObject>
 #include <QTimer>
@@ -34,6 +35,7 @@
 #include <QContactManager>
 
 class CDBirthdayCalendar;
+class CDBirthdayUpcoming;
 
 #ifdef USING_QTPIM
 QTCONTACTS_USE_NAMESPACE
@@ -47,6 +49,7 @@ class CDBirthdayController : public QObject
 
     enum SyncMode {
         Incremental,
+        ChangeLogSync,
         FullSync
     };
 
@@ -71,26 +74,38 @@ private Q_SLOTS:
 
     void onFetchRequestStateChanged(QContactAbstractRequest::State newState);
     void onFullSyncRequestStateChanged(QContactAbstractRequest::State newState);
+    void onChangeLogSyncRequestStateChanged(QContactAbstractRequest::State newState);
     void updateAllBirthdays();
     void onUpdateQueueTimeout();
+    void onCatchUpRetryTimeout();
 
 private:
     bool stampFileUpToDate();
     void createStampFile();
     QString stampFilePath() const;
+    QDateTime lastSyncTimestamp();
+    void storeLastSyncTimestamp(const QDateTime &timestamp);
+    QString lastSyncFilePath() const;
+    void updateChangedBirthdays(const QDateTime &since);
     bool processFetchRequest(QContactFetchRequest * const fetchRequest,
                              QContactAbstractRequest::State newState,
                              SyncMode syncMode = Incremental);
+    void catchUpFailed();
     void fetchContacts(const QList<ContactIdType> &contactIds);
-    void fetchContacts(const QContactFilter &filter, const char *slot);
+    bool fetchContacts(const QContactFilter &filter, const char *slot);
     void updateBirthdays(const QList<QContact> &changedBirthdays);
     void syncBirthdays(const QList<QContact> &birthdayContacts);
 
 private:
     CDBirthdayCalendar *mCalendar;
+    CDBirthdayUpcoming *mUpcoming;
     QContactManager *mManager;
     QSet<ContactIdType> mUpdatedContacts;
+    QSet<ContactIdType> mRemovedContacts;
     QTimer mUpdateTimer;
+    QTimer mCatchUpRetryTimer;
+    int mActiveFetches;
+    bool mCatchUpPending;
 };
 
 #endif // CDBIRTHDAYCONTROLLER_H
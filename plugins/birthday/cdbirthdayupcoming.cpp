@@ -0,0 +1,246 @@
+/** This file is part of Contacts daemon
+ **
+ ** Copyright (c) 2010-2011 Nokia Corporation and/or its subsidiary(-ies).
+ **
+ ** Contact:  Nokia Corporation (info@qt.nokia.com)
+ **
+ ** GNU Lesser General Public License Usage
+ ** This file may be used under the terms of the GNU Lesser General Public License
+ ** version 2.1 as published by the Free Software Foundation and appearing in the
+ ** file LICENSE.LGPL included in the packaging of this file.  Please review the
+ ** following information to ensure the GNU Lesser General Public License version
+ ** 2.1 requirements will be met:
+ ** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+ **
+ ** In addition, as a special exception, Nokia gives you certain additional rights.
+ ** These rights are described in the Nokia Qt LGPL Exception version 1.1, included
+ ** in the file LGPL_EXCEPTION.txt in this package.
+ **
+ ** Other Usage
+ ** Alternatively, this file may be used in accordance with the terms and
+ ** conditions contained in a signed written agreement between you and Nokia.
+ **/
+
+#include "cdbirthdayupcoming.h"
+#include "debug.h"
+
+#include <QDBusConnection>
+#include <QDBusMetaType>
+#include <QDateTime>
+
+using namespace Contactsd;
+
+namespace {
+
+const QLatin1String DBusObjectPath("/birthdays");
+const uint MAX_PAGE_SIZE = 500;
+
+QDate occurrenceInYear(const QDate &date, int year)
+{
+    // Birthdays on February 29th occur on February 28th in other years, as in the calendar events
+    if (date.month() == 2 && date.day() == 29 && not QDate::isLeapYear(year)) {
+        return QDate(year, 2, 28);
+    }
+    return QDate(year, date.month(), date.day());
+}
+
+}
+
+CDBirthdayUpcoming::CDBirthdayUpcoming(QObject *parent) :
+    QObject(parent),
+    mToday(QDate::currentDate()),
+    mHaveRegisteredDBus(false)
+{
+    qDBusRegisterMetaType<QList<uint> >();
+
+    mMidnightTimer.setSingleShot(true);
+    connect(&mMidnightTimer, SIGNAL(timeout()), SLOT(onMidnight()));
+    scheduleMidnight();
+}
+
+CDBirthdayUpcoming::~CDBirthdayUpcoming()
+{
+    if (mHaveRegisteredDBus) {
+        QDBusConnection::sessionBus().unregisterObject(DBusObjectPath);
+    }
+}
+
+bool CDBirthdayUpcoming::registerDBusObject()
+{
+    if (mHaveRegisteredDBus) {
+        return true;
+    }
+
+    QDBusConnection connection = QDBusConnection::sessionBus();
+    if (not connection.registerObject(DBusObjectPath, this, QDBusConnection::ExportAllSlots)) {
+        warning() << "Could not register DBus object '/birthdays':" << connection.lastError();
+        return false;
+    }
+
+    mHaveRegisteredDBus = true;
+    return true;
+}
+
+void CDBirthdayUpcoming::updateBirthday(quint32 contactId, const QDate &date, const QString &summary)
+{
+    rollOver();
+
+    QHash<quint32, Entry>::iterator it = mContacts.find(contactId);
+    if (it != mContacts.end()) {
+        if (it->date == date && it->summary == summary) {
+            return;
+        }
+        removeEntry(*it);
+        mContacts.erase(it);
+    }
+
+    Entry entry;
+    entry.next = nextOccurrence(date, mToday);
+    entry.summary = summary;
+    entry.contactId = contactId;
+    entry.date = date;
+
+    insertEntry(entry);
+    mContacts.insert(contactId, entry);
+}
+
+void CDBirthdayUpcoming::deleteBirthday(quint32 contactId)
+{
+    QHash<quint32, Entry>::iterator it = mContacts.find(contactId);
+    if (it != mContacts.end()) {
+        removeEntry(*it);
+        mContacts.erase(it);
+    }
+}
+
+void CDBirthdayUpcoming::clear()
+{
+    mEntries.clear();
+    mContacts.clear();
+}
+
+QList<uint> CDBirthdayUpcoming::upcomingBirthdays(uint offset, uint count, QStringList &summaries, QStringList &dates)
+{
+    QList<uint> contactIds;
+
+    rollOver();
+
+    if (offset >= uint(mEntries.count())) {
+        return contactIds;
+    }
+
+    const uint end = offset + qMin(qMin(count, MAX_PAGE_SIZE), mEntries.count() - offset);
+    for (uint i = offset; i < end; ++i) {
+        const Entry &entry(mEntries.at(i));
+        contactIds.append(entry.contactId);
+        summaries.append(entry.summary);
+        dates.append(entry.next.toString(Qt::ISODate));
+    }
+
+    return contactIds;
+}
+
+uint CDBirthdayUpcoming::upcomingBirthdayCount()
+{
+    rollOver();
+
+    return mEntries.count();
+}
+
+void CDBirthdayUpcoming::onMidnight()
+{
+    rollOver();
+    scheduleMidnight();
+}
+
+bool CDBirthdayUpcoming::entryLessThan(const Entry &lhs, const Entry &rhs)
+{
+    if (lhs.next != rhs.next) {
+        return lhs.next < rhs.next;
+    }
+    if (lhs.summary != rhs.summary) {
+        return lhs.summary < rhs.summary;
+    }
+    return lhs.contactId < rhs.contactId;
+}
+
+QDate CDBirthdayUpcoming::nextOccurrence(const QDate &date, const QDate &today)
+{
+    if (date >= today) {
+        return date;
+    }
+
+    QDate next = occurrenceInYear(date, today.year());
+    if (next < today) {
+        next = occurrenceInYear(date, today.year() + 1);
+    }
+    return next;
+}
+
+void CDBirthdayUpcoming::insertEntry(const Entry &entry)
+{
+    QList<Entry>::iterator it = qLowerBound(mEntries.begin(), mEntries.end(), entry, entryLessThan);
+    mEntries.insert(it, entry);
+}
+
+void CDBirthdayUpcoming::removeEntry(const Entry &entry)
+{
+    QList<Entry>::iterator it = qLowerBound(mEntries.begin(), mEntries.end(), entry, entryLessThan);
+    if (it != mEntries.end() && it->contactId == entry.contactId) {
+        mEntries.erase(it);
+    }
+}
+
+// The midnight timer does not fire on time across a suspend, and the clock may be set
+// back, so the date is checked again wherever the next occurrences are used
+void CDBirthdayUpcoming::rollOver()
+{
+    const QDate today = QDate::currentDate();
+    if (today == mToday) {
+        return;
+    }
+
+    const QDate previous = mToday;
+    mToday = today;
+
+    if (mToday < previous) {
+        // Birthdays that had passed may be upcoming again, so every occurrence is recomputed
+        QList<Entry> entries;
+        foreach (Entry entry, mContacts) {
+            entry.next = nextOccurrence(entry.date, mToday);
+            entries.append(entry);
+            mContacts.insert(entry.contactId, entry);
+        }
+
+        qSort(entries.begin(), entries.end(), entryLessThan);
+        mEntries = entries;
+
+        debug() << "Date moved back from" << previous << "to" << mToday
+                << "- recomputed" << mEntries.count() << "upcoming birthdays";
+    } else {
+        // Only the birthdays that have passed move, from the front to their next occurrence
+        QList<Entry> passed;
+        while (not mEntries.isEmpty() && mEntries.first().next < mToday) {
+            passed.append(mEntries.takeFirst());
+        }
+
+        foreach (Entry entry, passed) {
+            entry.next = nextOccurrence(entry.date, mToday);
+            insertEntry(entry);
+            mContacts.insert(entry.contactId, entry);
+        }
+
+        debug() << "Rolled over" << passed.count() << "upcoming birthdays";
+    }
+
+    // The timer was scheduled for the midnight following the date last seen
+    scheduleMidnight();
+}
+
+void CDBirthdayUpcoming::scheduleMidnight()
+{
+    // Wake shortly after midnight, so that the date has certainly changed
+    const QDateTime now = QDateTime::currentDateTime();
+    const QDateTime midnight(now.date().addDays(1), QTime(0, 0));
+    mMidnightTimer.start(now.msecsTo(midnight) + 1000);
+}
@@ -0,0 +1,93 @@
+/** This file is part of Contacts daemon
+ **
+ ** Copyright (c) 2010-2011 Nokia Corporation and/or its subsidiary(-ies).
+ **
+ ** Contact:  Nokia Corporation (info@qt.nokia.com)
+ **
+ ** GNU Lesser General Public License Usage
+ ** This file may be used under the terms of the GNU Lesser General Public License
+ ** version 2.1 as published by the Free Software Foundation and appearing in the
+ ** file LICENSE.LGPL included in the packaging of this file.  Please review the
+ ** following information to ensure the GNU Lesser General Public License version
+ ** 2.1 requirements will be met:
+ ** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+ **
+ ** In addition, as a special exception, Nokia gives you certain additional rights.
+ ** These rights are described in the Nokia Qt LGPL Exception version 1.1, included
+ ** in the file LGPL_EXCEPTION.txt in this package.
+ **
+ ** Other Usage
+ ** Alternatively, this file may be used in accordance with the terms and
+ ** conditions contained in a signed written agreement between you and Nokia.
+ **/
+
+#ifndef CDBIRTHDAYUPCOMING_H
+#define CDBIRTHDAYUPCOMING_H
+
+#include <QDate>
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QStringList>
+#include <QTimer>
+
+class CDBirthdayUpcoming : public QObject
+{
+    Q_OBJECT
+    Q_CLASSINFO("D-Bus Interface", "com.nokia.contactsd.birthdays")
+
+public:
+    //! Constructor.
+    explicit CDBirthdayUpcoming(QObject *parent = 0);
+    ~CDBirthdayUpcoming();
+
+    //! Makes the upcoming birthdays available on the session bus.
+    bool registerDBusObject();
+
+    //! Adds or updates the birthday of \a contactId.
+    void updateBirthday(quint32 contactId, const QDate &date, const QString &summary);
+
+    //! Removes the birthday of \a contactId.
+    void deleteBirthday(quint32 contactId);
+
+    //! Removes all birthdays.
+    void clear();
+
+    //! Returns the first occurrence of the birthday \a date on or after \a today.
+    static QDate nextOccurrence(const QDate &date, const QDate &today);
+
+public Q_SLOTS:
+    //! Returns the contact IDs of up to \a count birthdays from position \a offset, ordered
+    //! by their next occurrence, with the summaries and next occurrence dates of each.
+    QList<uint> upcomingBirthdays(uint offset, uint count, QStringList &summaries, QStringList &dates);
+
+    //! Returns the number of birthdays available.
+    uint upcomingBirthdayCount();
+
+private Q_SLOTS:
+    void onMidnight();
+
+private:
+    struct Entry {
+        QDate next;
+        QString summary;
+        quint32 contactId;
+        QDate date;
+    };
+
+    static bool entryLessThan(const Entry &lhs, const Entry &rhs);
+
+    void insertEntry(const Entry &entry);
+    void removeEntry(const Entry &entry);
+    void rollOver();
+    void scheduleMidnight();
+
+private:
+    QList<Entry> mEntries;
+    QHash<quint32, Entry> mContacts;
+    QDate mToday;
+    QTimer mMidnightTimer;
+    bool mHaveRegisteredDBus;
+};
+
+#endif // CDBIRTHDAYUPCOMING_H
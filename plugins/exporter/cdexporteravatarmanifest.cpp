@@ -0,0 +1,201 @@
+/** This file is part of Contacts daemon
+ **
+ ** Copyright (c) 2014 Jolla Ltd.
+ **
+ ** Contact: Matt Vogt <matthew.vogt@jollamobile.com>
+ **
+ ** GNU Lesser General Public License Usage
+ ** This file may be used under the terms of the GNU Lesser General Public License
+ ** version 2.1 as published by the Free Software Foundation and appearing in the
+ ** file LICENSE.LGPL included in the packaging of this file.  Please review the
+ ** following information to ensure the GNU Lesser General Public License version
+ ** 2.1 requirements will be met:
+ ** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+ **/
+
+#include "cdexporteravatarmanifest.h"
+
+#include <QDataStream>
+#include <QDir>
+#include <QtDebug>
+
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const QString privilegedDirectory(QStringLiteral("/privileged/Contacts/"));
+
+QString linkPathFor(const QString &privilegedPath)
+{
+    QString path(privilegedPath);
+    return path.remove(path.indexOf(privilegedDirectory), 11);
+}
+
+}
+
+CDExporterAvatarManifest::CDExporterAvatarManifest()
+    : m_modified(false)
+    , m_loaded(false)
+{
+}
+
+void CDExporterAvatarManifest::load(const QByteArray &data)
+{
+    invalidate();
+
+    QDataStream ds(data);
+    while (!ds.atEnd()) {
+        QString privilegedPath;
+        Entry entry;
+        ds >> privilegedPath >> entry.linkPath >> entry.inode >> entry.mtime;
+        if (ds.status() != QDataStream::Ok) {
+            qWarning() << "Truncated avatar link manifest";
+            m_modified = true;
+            break;
+        }
+
+        m_entries.insert(privilegedPath, entry);
+    }
+
+    m_loaded = true;
+}
+
+void CDExporterAvatarManifest::invalidate()
+{
+    m_entries.clear();
+    m_modified = false;
+    m_loaded = false;
+}
+
+// Finds the non-privileged link for the privileged file, creating it if necessary.
+// Returns false if the file does not exist; if it cannot be linked, the path is empty.
+bool CDExporterAvatarManifest::link(const QString &privilegedPath, QString *nonprivilegedPath)
+{
+    struct stat source;
+    if (::stat(privilegedPath.toUtf8().constData(), &source) != 0) {
+        // Any link made for this file is now stale
+        release(privilegedPath);
+        return false;
+    }
+
+    QHash<QString, Entry>::iterator it = m_entries.find(privilegedPath);
+    if (it != m_entries.end() && (*it).inode == static_cast<quint64>(source.st_ino)) {
+        if ((*it).mtime != static_cast<qint64>(source.st_mtime)) {
+            // Modified in place; the link still refers to the same file
+            (*it).mtime = source.st_mtime;
+            m_modified = true;
+        }
+        *nonprivilegedPath = (*it).linkPath;
+        return true;
+    }
+
+    // This file is new to us, or has been replaced since it was linked
+    const QString linkPath(it != m_entries.end() ? (*it).linkPath : linkPathFor(privilegedPath));
+    if (!createLink(privilegedPath, linkPath, source.st_ino)) {
+        if (it != m_entries.end()) {
+            m_entries.erase(it);
+            m_modified = true;
+        }
+        nonprivilegedPath->clear();
+        return true;
+    }
+
+    Entry entry;
+    entry.linkPath = linkPath;
+    entry.inode = source.st_ino;
+    entry.mtime = source.st_mtime;
+    m_entries.insert(privilegedPath, entry);
+    m_modified = true;
+
+    *nonprivilegedPath = linkPath;
+    return true;
+}
+
+// Finds the non-privileged path the privileged file is linked from, or would be once
+// linked, without creating or releasing any link. Returns false if the file does not exist.
+bool CDExporterAvatarManifest::linkedPath(const QString &privilegedPath, QString *nonprivilegedPath) const
+{
+    struct stat source;
+    if (::stat(privilegedPath.toUtf8().constData(), &source) != 0) {
+        return false;
+    }
+
+    QHash<QString, Entry>::const_iterator it = m_entries.constFind(privilegedPath);
+    *nonprivilegedPath = (it != m_entries.constEnd()) ? (*it).linkPath : linkPathFor(privilegedPath);
+    return true;
+}
+
+// Removes the link for a file no longer referenced by some contact, if the file itself is gone
+void CDExporterAvatarManifest::release(const QString &privilegedPath)
+{
+    QHash<QString, Entry>::iterator it = m_entries.find(privilegedPath);
+    if (it == m_entries.end()) {
+        return;
+    }
+
+    struct stat source;
+    if (::stat(privilegedPath.toUtf8().constData(), &source) == 0 &&
+        static_cast<quint64>(source.st_ino) == (*it).inode) {
+        // Still valid; other contacts may refer to this file
+        return;
+    }
+
+    removeLink((*it).linkPath);
+    m_entries.erase(it);
+    m_modified = true;
+}
+
+QByteArray CDExporterAvatarManifest::data() const
+{
+    QByteArray cdata;
+    {
+        QDataStream write(&cdata, QIODevice::WriteOnly);
+        QHash<QString, Entry>::const_iterator it = m_entries.constBegin(), end = m_entries.constEnd();
+        for ( ; it != end; ++it) {
+            write << it.key() << (*it).linkPath << (*it).inode << (*it).mtime;
+        }
+    }
+    return cdata;
+}
+
+bool CDExporterAvatarManifest::createLink(const QString &privilegedPath, const QString &linkPath, quint64 inode)
+{
+    const QByteArray oldPath(privilegedPath.toUtf8());
+    const QByteArray newPath(linkPath.toUtf8());
+
+    struct stat existing;
+    if (::lstat(newPath.constData(), &existing) == 0) {
+        if (static_cast<quint64>(existing.st_ino) == inode) {
+            // Linked previously, before this link was recorded
+            return true;
+        }
+
+        // A stale link to a replaced file
+        removeLink(linkPath);
+    } else {
+        // Ensure the target directory exists
+        const int index = linkPath.lastIndexOf(QLatin1Char('/'));
+        if (index > 0) {
+            const QString dirPath(linkPath.left(index));
+            if (!QDir::root().mkpath(dirPath)) {
+                qWarning() << "Unable to create directory path:" << dirPath;
+            }
+        }
+    }
+
+    if (::link(oldPath.constData(), newPath.constData()) != 0) {
+        qWarning() << "Unable to create link to:" << privilegedPath << linkPath;
+        return false;
+    }
+
+    return true;
+}
+
+void CDExporterAvatarManifest::removeLink(const QString &linkPath)
+{
+    if (::unlink(linkPath.toUtf8().constData()) != 0 && errno != ENOENT) {
+        qWarning() << "Unable to remove stale avatar link:" << linkPath;
+    }
+}
@@ -0,0 +1,63 @@
+/** This file is part of Contacts daemon
+ **
+ ** Copyright (c) 2014 Jolla Ltd.
+ **
+ ** Contact: Matt Vogt <matthew.vogt@jollamobile.com>
+ **
+ ** GNU Lesser General Public License Usage
+ ** This file may be used under the terms of the GNU Lesser General Public License
+ ** version 2.1 as published by the Free Software Foundation and appearing in the
+ ** file LICENSE.LGPL included in the packaging of this file.  Please review the
+ ** following information to ensure the GNU Lesser General Public License version
+ ** 2.1 requirements will be met:
+ ** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+ **/
+
+#ifndef CDEXPORTERAVATARMANIFEST_H
+#define CDEXPORTERAVATARMANIFEST_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+
+// Records the links made to privileged avatar files from paths accessible to
+// non-privileged applications, with the identity of the file each was made for.
+// A link recorded for an unchanged file is reused without touching the filesystem
+// beyond a single stat of the source.
+class CDExporterAvatarManifest
+{
+public:
+    CDExporterAvatarManifest();
+
+    bool isLoaded() const { return m_loaded; }
+
+    void load(const QByteArray &data);
+    void invalidate();
+
+    bool link(const QString &privilegedPath, QString *nonprivilegedPath);
+    bool linkedPath(const QString &privilegedPath, QString *nonprivilegedPath) const;
+    void release(const QString &privilegedPath);
+
+    bool isModified() const { return m_modified; }
+    QByteArray data() const;
+
+    void committed() { m_modified = false; }
+
+private:
+    struct Entry {
+        Entry() : inode(0), mtime(0) {}
+
+        QString linkPath;
+        quint64 inode;
+        qint64 mtime;
+    };
+
+    bool createLink(const QString &privilegedPath, const QString &linkPath, quint64 inode);
+    void removeLink(const QString &linkPath);
+
+    QHash<QString, Entry> m_entries;    // keyed by privileged path
+    bool m_modified;
+    bool m_loaded;
+};
+
+#endif // CDEXPORTERAVATARMANIFEST_H
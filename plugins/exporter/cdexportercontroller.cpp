@@ -14,6 +14,7 @@
  **/
 
 #include "cdexportercontroller.h"
+#include "cdexporterfingerprint.h"
 #include "cdexporterplugin.h"
 #include "debug.h"
 
@@ -30,11 +31,11 @@
 #include <QContactIdFilter>
 
 #include <QDateTime>
+#include <QElapsedTimer>
 #include <QDBusConnection>
 #include <QDBusMessage>
 #include <QDBusPendingCall>
-
-#include <unistd.h>
+#include <QFileInfo>
 
 // buteo-syncfw
 #include <ProfileEngineDefs.h>
@@ -48,14 +49,54 @@ namespace {
 
 const QString exportSyncTarget(QStringLiteral("export"));
 const QString aggregateSyncTarget(QStringLiteral("aggregate"));
-const QString oobIdsKey(QStringLiteral("privilegedIds"));
+const QString oobIdsKey(QStringLiteral("privilegedIds"));          // Obsolete; read only for migration
+const QString oobIdMapKey(QStringLiteral("privilegedIdMap"));
+const QString oobIdDeltasKey(QStringLiteral("privilegedIdDeltas"));
+const QString oobIdDeltaSegmentsKey(QStringLiteral("privilegedIdDeltaSegments"));
 const QString avatarPathsKey(QStringLiteral("avatarPaths"));
+const QString avatarLinksKey(QStringLiteral("avatarLinks"));
+const QString exportCheckpointKey(QStringLiteral("exportCheckpoint"));
 
 // Delay 500ms for accumulate futher changes when a contact is updated
 // Wait 10s for further changes when a contact presence is updated
 const int syncDelay = 500;
 const int presenceSyncDelay = 10000;
 
+// While changes arrive more often than this, wait for the gap between them to pass
+const int maxBurstDelay = 3000;
+
+// Export changes at most this long after they occur, however often they are followed by others;
+// the data change bound may be overridden by configuration
+const int maxSyncLatency = 5000;
+const int maxPresenceSyncLatency = 30000;
+
+// Presence changes are mirrored without a sync, at most this long after they occur
+const int presenceMirrorDelay = 250;
+
+// Export notified contacts directly while there are few of them; otherwise do a full sync
+const int notifiedSyncLimit = 250;
+
+// Do a full sync at least this often after notified syncs, to catch anything they missed
+const int fullSyncInterval = 10 * 60 * 1000;
+
+// Export changes to the export DB in chunks of at most this many contacts
+const int exportChunkSize = 100;
+
+// Verify exported contacts in slices of this size, this long apart, while otherwise idle;
+// once all have been verified, start again after the cycle interval
+const int verifySliceSize = 50;
+const int verifySliceDelay = 2000;
+const int verifyCycleInterval = 30 * 60 * 1000;
+
+// A full sync pass may be preempted by new changes at most this many times in succession
+const int maxConsecutivePreemptions = 3;
+
+// The first delta segment has the key used before deltas were segmented
+QString idDeltaSegmentKey(int index)
+{
+    return index == 0 ? oobIdDeltasKey : oobIdDeltasKey + QStringLiteral("-%1").arg(index);
+}
+
 QMap<QString, QString> privilegedManagerParameters()
 {
     QMap<QString, QString> rv;
@@ -71,6 +112,21 @@ QMap<QString, QString> nonprivilegedManagerParameters()
     return rv;
 }
 
+QContactId apiId(quint32 internalId)
+{
+    return internalId ? QtContactsSqliteExtensions::apiContactId(internalId) : QContactId();
+}
+
+quint32 internalId(const QContactId &id)
+{
+    return id.isNull() ? 0 : QtContactsSqliteExtensions::internalContactId(id);
+}
+
+bool lessThanInternalId(const QContact &lhs, const QContact &rhs)
+{
+    return internalId(lhs.id()) < internalId(rhs.id());
+}
+
 QString managerName()
 {
     return QStringLiteral("org.nemomobile.contacts.sqlite");
@@ -224,56 +280,67 @@ void removeProvenanceInformation(QContact &contact)
     }
 }
 
-QHash<QUrl, QUrl> modifyAvatarUrls(QContact &contact)
+// Avatar paths may indicate files not accessible to non-privileged apps
+QString privilegedAvatarPath(const QContactAvatar &avatar)
+{
+    const QUrl imageUrl(avatar.imageUrl());
+    if (imageUrl.scheme().isEmpty() || imageUrl.isLocalFile()) {
+        const QString path(QFileInfo(imageUrl.path()).absoluteFilePath());
+        if (path.contains(QStringLiteral("/privileged/Contacts/"))) {
+            return path;
+        }
+    }
+    return QString();
+}
+
+QHash<QUrl, QUrl> modifyAvatarUrls(QContact &contact, CDExporterAvatarManifest &avatarLinks)
 {
     QHash<QUrl, QUrl> changes;
 
     foreach (const QContactAvatar &avatar, contact.details<QContactAvatar>()) {
-        const QUrl imageUrl(avatar.imageUrl());
-        if (imageUrl.scheme().isEmpty() || imageUrl.isLocalFile()) {
-            // Avatar paths may indicate files not accessible to non-privileged apps
-            // Link to them from an accessible path, and update the stored path in the avatar detail
-            const QString path(avatar.imageUrl().path());
-            if (QFile::exists(path)) {
-                const QFileInfo fi(path);
-                const QString privilegedPath(fi.absoluteFilePath());
-
-                int index = privilegedPath.indexOf(QStringLiteral("/privileged/Contacts/"));
-                if (index != -1) {
-                    // Try to make a nonprivileged version of this file
-                    QString nonprivilegedPath(QString(privilegedPath).remove(index, 11));
-                    if (!QFile::exists(nonprivilegedPath)) {
-                        // Ensure the target directory exists
-                        index = nonprivilegedPath.lastIndexOf(QLatin1Char('/'));
-                        if (index) {
-                            const QString dirPath(nonprivilegedPath.left(index));
-                            QDir dir(dirPath);
-                            if (!dir.exists() && !QDir::root().mkpath(dirPath)) {
-                                qWarning() << "Unable to create directory path:" << dirPath;
-                            }
-                        }
-
-                        // Try to link the file to the new path
-                        QByteArray oldPath(privilegedPath.toUtf8());
-                        QByteArray newPath(nonprivilegedPath.toUtf8());
-                        if (::link(oldPath.constData(), newPath.constData()) != 0) {
-                            qWarning() << "Unable to create link to:" << privilegedPath << nonprivilegedPath;
-                            nonprivilegedPath = QString();
-                        }
-                    }
+        const QString privilegedPath(privilegedAvatarPath(avatar));
+        if (!privilegedPath.isEmpty()) {
+            // Link to the file from an accessible path, and update the stored path in the avatar detail
+            QString nonprivilegedPath;
+            if (avatarLinks.link(privilegedPath, &nonprivilegedPath)) {
+                // Update the avatar to point to the alternative path
+                QContactAvatar copy(avatar);
+                copy.setImageUrl(QUrl::fromLocalFile(nonprivilegedPath));
+                contact.saveDetail(&copy);
+
+                changes.insert(copy.imageUrl(), avatar.imageUrl());
+            }
+        }
+    }
 
-                    // Update the avatar to point to the alternative path
-                    QContactAvatar copy(avatar);
-                    copy.setImageUrl(QUrl::fromLocalFile(nonprivilegedPath));
-                    contact.saveDetail(&copy);
+    return changes;
+}
 
-                    changes.insert(copy.imageUrl(), avatar.imageUrl());
-                }
+// Makes the avatar path changes modifyAvatarUrls() would, without linking any file
+void mapAvatarUrls(QContact &contact, const CDExporterAvatarManifest &avatarLinks)
+{
+    foreach (const QContactAvatar &avatar, contact.details<QContactAvatar>()) {
+        const QString privilegedPath(privilegedAvatarPath(avatar));
+        if (!privilegedPath.isEmpty()) {
+            QString nonprivilegedPath;
+            if (avatarLinks.linkedPath(privilegedPath, &nonprivilegedPath)) {
+                QContactAvatar copy(avatar);
+                copy.setImageUrl(QUrl::fromLocalFile(nonprivilegedPath));
+                contact.saveDetail(&copy);
             }
         }
     }
+}
 
-    return changes;
+// Releases the links made for avatar files that are no longer referenced
+void releaseAvatarLinks(const QHash<QUrl, QUrl> &obsoleteChanges, const QHash<QUrl, QUrl> &changes, CDExporterAvatarManifest &avatarLinks)
+{
+    QHash<QUrl, QUrl>::const_iterator it = obsoleteChanges.constBegin(), end = obsoleteChanges.constEnd();
+    for ( ; it != end; ++it) {
+        if (!changes.contains(it.key())) {
+            avatarLinks.release(QFileInfo((*it).path()).absoluteFilePath());
+        }
+    }
 }
 
 void reverseAvatarChanges(QContact &contact, const QHash<QUrl, QUrl> &changes)
@@ -318,62 +385,82 @@ QSet<QContactDetail::DetailType> getPresenceDetailTypes()
     return rv;
 }
 
+QSet<QContactDetail::DetailType> getPresenceComparisonExcludedTypes()
+{
+    return getPresenceDetailTypes() | ignorableDetailTypes();
+}
+
+// Checksum of the exported form of a contact, as stored in either database
+QByteArray exportChecksum(const QContact &contact)
+{
+    static QSet<QContactDetail::DetailType> excludedTypes(getPresenceComparisonExcludedTypes());
+
+    return CDExporterFingerprint::contactHash(contact, excludedTypes);
+}
+
 bool presenceOnlyChange(const QContact &oldContact, const QContact &newContact)
 {
     // A presence-only change affects only { Presence, OnlineAccount, OriginMetadata }
-    static QSet<QContactDetail::DetailType> presenceTypes(getPresenceDetailTypes());
+    static QSet<QContactDetail::DetailType> excludedTypes(getPresenceComparisonExcludedTypes());
 
-    QList<QContactDetail> oldDetails(oldContact.details());
+    return CDExporterFingerprint::changedTypes(CDExporterFingerprint::typeHashes(oldContact, excludedTypes),
+                                               CDExporterFingerprint::typeHashes(newContact, excludedTypes)).isEmpty();
+}
 
-    QList<QContactDetail>::const_iterator it = oldDetails.constBegin(), end = oldDetails.constEnd();
-    for ( ; it != end; ++it) {
-        QContactDetail::DetailType type((*it).type());
-        if (presenceTypes.contains(type) || ignorableDetailTypes().contains(type)) {
-            continue;
-        }
+// Copies the presence details of the given privileged contacts directly to their exported
+// counterparts, without involving the sync state. Contacts which have not been exported yet
+// are returned in unmirroredIds.
+bool mirrorPresence(QContactManager &privileged, QContactManager &nonprivileged, const CDExporterIdMap &idMap,
+                    const QSet<QContactId> &privilegedIds, QSet<QContactId> *unmirroredIds)
+{
+    if (!idMap.isLoaded()) {
+        *unmirroredIds = privilegedIds;
+        return true;
+    }
+
+    static const QList<QContactDetail::DetailType> presenceTypes(getPresenceDetailTypes().toList());
 
-        QList<QContactDetail>::const_iterator pit = oldDetails.constBegin();
-        while (pit != it && (*pit).type() != type) {
-            ++pit;
+    QList<QContactId> fetchIds;
+    foreach (const QContactId &privilegedId, privilegedIds) {
+        if (idMap.nonprivilegedId(internalId(privilegedId))) {
+            fetchIds.append(privilegedId);
+        } else {
+            unmirroredIds->insert(privilegedId);
         }
-        if (pit != it) {
-            // We have already tested this detail type
+    }
+    if (fetchIds.isEmpty()) {
+        return true;
+    }
+
+    QContactFetchHint fetchHint;
+    fetchHint.setOptimizationHints(QContactFetchHint::NoRelationships);
+    fetchHint.setDetailTypesHint(presenceTypes);
+
+    QList<QContact> mirroredContacts;
+    foreach (const QContact &contact, privileged.contacts(fetchIds, fetchHint)) {
+        if (contact.id().isNull()) {
+            // Removed since notification
             continue;
         }
 
-        // Test details of this type for changes
-        QList<QContactDetail> oldTypeDetails(oldContact.details(type));
-        QList<QContactDetail> newTypeDetails(newContact.details(type));
-        if (newTypeDetails.count() != oldTypeDetails.count()) {
-            return false;
+        QContact mirror;
+        mirror.setId(apiId(idMap.nonprivilegedId(internalId(contact.id()))));
+        foreach (const QContactDetail &detail, contact.details()) {
+            if (presenceTypes.contains(detail.type())) {
+                QContactDetail copy(detail);
+                mirror.saveDetail(&copy);
+            }
         }
 
-        // Compare the values to see if there are changes
-        QList<QContactDetail>::const_iterator oit = oldTypeDetails.constBegin(), oend = oldTypeDetails.constEnd();
-        for ( ; oit != oend; ++oit) {
-            QContactDetail oldDetail(*oit);
+        demangleDetailUris(mirror);
+        removeProvenanceInformation(mirror);
 
-            // Ignore differences in detail URIs
-            oldDetail.removeValue(QContactDetail::FieldDetailUri);
-            oldDetail.removeValue(QContactDetail::FieldLinkedDetailUris);
+        mirroredContacts.append(mirror);
+    }
 
-            QList<QContactDetail>::iterator nit = newTypeDetails.begin(), nend = newTypeDetails.end();
-            for ( ; nit != nend; ++nit) {
-                QContactDetail newDetail(*nit);
-                newDetail.removeValue(QContactDetail::FieldDetailUri);
-                newDetail.removeValue(QContactDetail::FieldLinkedDetailUris);
-                if (newDetail == oldDetail) {
-                    break;
-                }
-            }
-            if (nit != nend) {
-                // Don't match any other details to this one
-                newTypeDetails.erase(nit);
-            } else {
-                // No match found - this difference prevents a presence-only change
-                return false;
-            }
-        }
+    if (!mirroredContacts.isEmpty() && !nonprivileged.saveContacts(&mirroredContacts, presenceTypes)) {
+        qWarning() << "Unable to mirror presence changes to export DB - error:" << nonprivileged.error();
+        return false;
     }
 
     return true;
@@ -386,50 +473,67 @@ private:
     QContactManager &m_privileged;
     QContactManager &m_nonprivileged;
     QDateTime m_remoteSince;
-    QMap<QString, QString> m_privilegedIds;     // Hold in string form; conversion to QContactId is expensive and likely unnecessary
-    QMap<QString, QString> m_nonprivilegedIds;  // As above.
+    CDExporterIdMap &m_idMap;
+    CDExporterAvatarManifest &m_avatarLinks;
+    QHash<quint32, QByteArray> &m_exportChecksums;
     QContactId m_privilegedSelfId;
     QContactId m_nonprivilegedSelfId;
-    bool m_privilegedIdsModified;
     QHash<QContactId, QHash<QUrl, QUrl> > m_avatarPathChanges;
     bool m_avatarPathChangesModified;
+    const QAtomicInt *m_preemptRequest;
+    bool m_preempted;
+    QList<QPair<QString, qint64> > m_phaseTimes;
+
+    // Progress of the current (or an interrupted) full export, which exports contacts
+    // in ID order: those up to the mark have been exported
+    bool m_checkpointExports;
+    bool m_exportCheckpointLoaded;
+    bool m_exportCheckpointModified;
+    QDateTime m_exportCheckpointSince;
+    QDateTime m_exportCheckpointTime;
+    quint32 m_exportCheckpointMark;
+
+    // Checked at batch boundaries; a preempted pass stops without storing its sync state
+    bool checkPreempted()
+    {
+        if (!m_preempted && m_preemptRequest && m_preemptRequest->load() != 0) {
+            m_preempted = true;
+        }
+        return m_preempted;
+    }
+
+    bool timePhase(const QString &name, QElapsedTimer &timer, bool result)
+    {
+        m_phaseTimes.append(qMakePair(name, timer.restart()));
+        return result;
+    }
 
-    QContactId getPrivilegedId(const QContactId &nonprivilegedId) const { return QContactId::fromString(m_privilegedIds.value(nonprivilegedId.toString())); }
-    QContactId getNonprivilegedId(const QContactId &privilegedId) const { return QContactId::fromString(m_nonprivilegedIds.value(privilegedId.toString())); }
+    QContactId getPrivilegedId(const QContactId &nonprivilegedId) const { return apiId(m_idMap.privilegedId(internalId(nonprivilegedId))); }
+    QContactId getNonprivilegedId(const QContactId &privilegedId) const { return apiId(m_idMap.nonprivilegedId(internalId(privilegedId))); }
 
-    void registerIdPair(const QString &privilegedId, const QString &nonprivilegedId)
+    void registerIdPair(const QContactId &privilegedId, const QContactId &nonprivilegedId)
     {
-        m_privilegedIds.insert(nonprivilegedId, privilegedId);
-        m_nonprivilegedIds.insert(privilegedId, nonprivilegedId);
-        m_privilegedIdsModified = true;
+        m_idMap.registerPair(internalId(privilegedId), internalId(nonprivilegedId));
     }
-    void deregisterIdPair(const QString &privilegedId, const QString &nonprivilegedId)
+    void deregisterIdPair(const QContactId &privilegedId, const QContactId &nonprivilegedId)
     {
-        QMap<QString, QString>::iterator pit = m_privilegedIds.find(nonprivilegedId);
-        if (pit != m_privilegedIds.end()) {
-            if (*pit != privilegedId) {
-                qWarning() << "Mismatch on ID pair deregistration:" << *pit << "!=" << privilegedId;
-                m_privilegedIds.erase(pit);
-            }
-        }
-        QMap<QString, QString>::iterator nit = m_nonprivilegedIds.find(privilegedId);
-        if (nit != m_nonprivilegedIds.end()) {
-            if (*nit != nonprivilegedId) {
-                qWarning() << "Mismatch on ID pair deregistration:" << *nit << "!=" << nonprivilegedId;
-                m_nonprivilegedIds.erase(nit);
-            }
-        }
-        m_privilegedIdsModified = true;
+        m_idMap.deregisterPair(internalId(privilegedId), internalId(nonprivilegedId));
     }
 
     void registerAvatarPathChange(const QContactId &contactId, const QHash<QUrl, QUrl> &changes)
     {
+        const QHash<QUrl, QUrl> obsoleteChanges(m_avatarPathChanges.value(contactId));
+        if (obsoleteChanges == changes) {
+            return;
+        }
+
+        releaseAvatarLinks(obsoleteChanges, changes, m_avatarLinks);
         m_avatarPathChanges.insert(contactId, changes);
         m_avatarPathChangesModified = true;
     }
     void deregisterAvatarPathChange(const QContactId &contactId)
     {
-        m_avatarPathChanges.remove(contactId);
+        releaseAvatarLinks(m_avatarPathChanges.take(contactId), QHash<QUrl, QUrl>(), m_avatarLinks);
         m_avatarPathChangesModified = true;
     }
 
@@ -445,32 +549,65 @@ private:
             return false;
         }
 
-        // Read our extra OOB data
+        // Read our extra OOB data; the ID mapping is only read when not already held
+        QStringList keys;
+        keys << avatarPathsKey << exportCheckpointKey;
+        if (!m_idMap.isLoaded()) {
+            keys << oobIdMapKey << oobIdDeltaSegmentsKey << oobIdDeltasKey << oobIdsKey;
+        }
+        if (!m_avatarLinks.isLoaded()) {
+            keys << avatarLinksKey;
+        }
+
         QMap<QString, QVariant> values;
-        if (!d->m_engine->fetchOOB(d->m_stateData[m_accountId].m_oobScope, QStringList() << oobIdsKey << avatarPathsKey, &values)) {
+        if (!d->m_engine->fetchOOB(d->m_stateData[m_accountId].m_oobScope, keys, &values)) {
             qWarning() << "Failed to read sync state data for" << exportSyncTarget;
             return false;
         }
 
-        // Read the IDs from storage
-        {
-            QByteArray cdata = values.value(oobIdsKey).toByteArray();
-            QDataStream ds(cdata);
-            ds >> m_privilegedIds;
-        }
+        if (!m_idMap.isLoaded()) {
+            const QByteArray legacyData(values.value(oobIdsKey).toByteArray());
+            if (!values.contains(oobIdMapKey) && !legacyData.isEmpty()) {
+                // Convert the mapping stored in string form by earlier versions
+                QMap<QString, QString> privilegedIds;
+                QDataStream ds(legacyData);
+                ds >> privilegedIds;
 
-        // Create a reversed ID mapping
-        QMap<QString, QString>::const_iterator it = m_privilegedIds.constBegin(), end = m_privilegedIds.constEnd();
-        for ( ; it != end; ++it) {
-            m_nonprivilegedIds.insert(it.value(), it.key());
+                m_idMap.loadLegacy(privilegedIds);
+            } else {
+                QList<QByteArray> deltaSegments;
+                if (values.contains(oobIdDeltasKey)) {
+                    deltaSegments.append(values.value(oobIdDeltasKey).toByteArray());
+                }
+
+                const int segmentCount(values.value(oobIdDeltaSegmentsKey).toInt());
+                if (segmentCount > 1) {
+                    QStringList segmentKeys;
+                    for (int i = 1; i < segmentCount; ++i) {
+                        segmentKeys.append(idDeltaSegmentKey(i));
+                    }
+
+                    QMap<QString, QVariant> segmentValues;
+                    if (!d->m_engine->fetchOOB(d->m_stateData[m_accountId].m_oobScope, segmentKeys, &segmentValues)) {
+                        qWarning() << "Failed to read ID mapping deltas for" << exportSyncTarget;
+                        return false;
+                    }
+                    foreach (const QString &key, segmentKeys) {
+                        deltaSegments.append(segmentValues.value(key).toByteArray());
+                    }
+                }
+
+                m_idMap.load(values.value(oobIdMapKey).toByteArray(), deltaSegments);
+            }
         }
 
         // Ensure that the self IDS are mapped to each other
-        if (m_privilegedIds.isEmpty()) {
-            const QString privilegedSelfId(m_privilegedSelfId.toString());
-            const QString nonprivilegedSelfId(m_nonprivilegedSelfId.toString());
+        if (m_idMap.isEmpty()) {
+            registerIdPair(m_privilegedSelfId, m_nonprivilegedSelfId);
+        }
 
-            registerIdPair(privilegedSelfId, nonprivilegedSelfId);
+        if (!m_avatarLinks.isLoaded()) {
+            m_avatarLinks.load(values.value(avatarLinksKey).toByteArray());
         }
 
         // Retrieve any avatar path changes we have made
@@ -480,21 +617,53 @@ private:
             ds >> m_avatarPathChanges;
         }
 
+        // Retrieve the progress of any interrupted export
+        {
+            const QByteArray cdata(values.value(exportCheckpointKey).toByteArray());
+            if (!cdata.isEmpty()) {
+                QDataStream ds(cdata);
+                ds >> m_exportCheckpointSince >> m_exportCheckpointTime >> m_exportCheckpointMark;
+                if (ds.status() == QDataStream::Ok) {
+                    m_exportCheckpointLoaded = true;
+                } else {
+                    qWarning() << "Ignoring invalid export checkpoint";
+                    m_exportCheckpointModified = true;
+                }
+            }
+        }
+
         return true;
     }
 
-    bool finalizeSync()
+    bool exportCheckpointed(const QContact &contact) const
     {
-        // Store the set of existing IDs to OOB
+        if (!m_checkpointExports || internalId(contact.id()) > m_exportCheckpointMark) {
+            return false;
+        }
+
+        // Contacts modified since they were checkpointed must be exported again
+        const QDateTime lastModified(contact.detail<QContactTimestamp>().lastModified());
+        return lastModified.isValid() && lastModified <= m_exportCheckpointTime;
+    }
+
+    bool storeExportState(bool checkpoint = false)
+    {
+        // Store the changes to the ID mapping to OOB. Compacting at each checkpoint of a
+        // large export would rewrite the whole mapping every time, so it waits for the end
         QMap<QString, QVariant> values;
 
-        if (m_privilegedIdsModified) {
-            QByteArray cdata;
-            {
-                QDataStream write(&cdata, QIODevice::WriteOnly);
-                write << m_privilegedIds;
+        const bool compactIds(checkpoint ? m_idMap.compactionRequired() : m_idMap.needsCompaction());
+        if (compactIds) {
+            values.insert(oobIdMapKey, QVariant(m_idMap.snapshotData()));
+            for (int i = 0; i < m_idMap.storedSegmentCount(); ++i) {
+                values.insert(idDeltaSegmentKey(i), QVariant(QByteArray()));
             }
-            values.insert(oobIdsKey, QVariant(cdata));
+            values.insert(oobIdDeltaSegmentsKey, QVariant(0));
+            values.insert(oobIdsKey, QVariant(QByteArray()));
+        } else if (m_idMap.hasPendingChanges()) {
+            const int segmentIndex(m_idMap.deltaSegmentIndex());
+            values.insert(idDeltaSegmentKey(segmentIndex), QVariant(m_idMap.deltaSegmentData()));
+            values.insert(oobIdDeltaSegmentsKey, QVariant(segmentIndex + 1));
         }
 
         if (m_avatarPathChangesModified) {
@@ -506,13 +675,49 @@ private:
             values.insert(avatarPathsKey, QVariant(cdata));
         }
 
+        if (m_avatarLinks.isModified()) {
+            values.insert(avatarLinksKey, QVariant(m_avatarLinks.data()));
+        }
+
+        if (m_exportCheckpointModified) {
+            QByteArray cdata;
+            if (m_exportCheckpointMark) {
+                QDataStream write(&cdata, QIODevice::WriteOnly);
+                write << m_exportCheckpointSince << m_exportCheckpointTime << m_exportCheckpointMark;
+            }
+            values.insert(exportCheckpointKey, QVariant(cdata));
+        }
+
         if (!values.isEmpty()) {
             if (!d->m_engine->storeOOB(d->m_stateData[m_accountId].m_oobScope, values)) {
                 qWarning() << "Failed to store sync state data to OOB storage";
+
+                // Reload the mapping from storage for the next sync
+                m_idMap.invalidate();
+                m_avatarLinks.invalidate();
                 return false;
             }
         }
 
+        m_idMap.committed(compactIds);
+        m_avatarLinks.committed();
+        m_exportCheckpointModified = false;
+
+        return true;
+    }
+
+    bool finalizeSync()
+    {
+        if (m_checkpointExports && (m_exportCheckpointLoaded || m_exportCheckpointMark)) {
+            // The export is complete
+            m_exportCheckpointMark = 0;
+            m_exportCheckpointModified = true;
+        }
+
+        if (!storeExportState()) {
+            return false;
+        }
+
         if (!storeSyncStateData(m_accountId)) {
             qWarning() << "Unable to store final state after sync completion";
             return false;
@@ -626,9 +831,9 @@ private:
             // Find the IDs allocated in the primary DB
             QList<QPair<QContactId, int> >::const_iterator it = additionIds.constBegin(), end = additionIds.constEnd();
             for ( ; it != end; ++it) {
-                const QString nonprivilegedId((*it).first.toString());
+                const QContactId &nonprivilegedId((*it).first);
                 const int additionIndex((*it).second);
-                const QString privilegedId(modifiedContacts.at(additionIndex).id().toString());
+                const QContactId privilegedId(modifiedContacts.at(additionIndex).id());
 
                 registerIdPair(privilegedId, nonprivilegedId);
             }
@@ -648,23 +853,47 @@ private:
         return true;
     }
 
-    void prepareExportContact(QContact &contact, const QContactId &privilegedId)
+    QHash<QUrl, QUrl> convertToExportForm(QContact &contact)
+    {
+        // Remap avatar paths
+        const QHash<QUrl, QUrl> avatarChanges(modifyAvatarUrls(contact, m_avatarLinks));
+
+        removePrivilegedForm(contact);
+
+        return avatarChanges;
+    }
+
+    // The same conversion as convertToExportForm(), for comparison only: no avatar links
+    // are made or released
+    void convertToComparisonForm(QContact &contact) const
+    {
+        mapAvatarUrls(contact, m_avatarLinks);
+
+        removePrivilegedForm(contact);
+    }
+
+    static void removePrivilegedForm(QContact &contact)
     {
         // Remove the timestamp detail
         QContactTimestamp ts(contact.detail<QContactTimestamp>());
         contact.removeDetail(&ts);
 
-        // Remap avatar path changes
-        registerAvatarPathChange(privilegedId, modifyAvatarUrls(contact));
-
         // Remove any detail URI mangling used in the privileged DB
         demangleDetailUris(contact);
 
         removeProvenanceInformation(contact);
     }
 
+    void prepareExportContact(QContact &contact, const QContactId &privilegedId)
+    {
+        registerAvatarPathChange(privilegedId, convertToExportForm(contact));
+    }
+
     bool syncPrivilegedToNonprivileged(bool importChanges, bool debug)
     {
+        // Contacts modified after this time are not covered by our checkpoints
+        const QDateTime exportStart(QDateTime::currentDateTimeUtc());
+
         // Find privileged DB changes we need to reflect (including presence changes)
         QDateTime localSince;
         QList<QContact> locallyAdded, locallyModified, locallyDeleted;
@@ -685,13 +914,81 @@ private:
             }
         }
 
-        QList<QContact> addedContacts;
-        QList<QContact> modifiedContacts;
+        m_checkpointExports = true;
+        if (m_exportCheckpointLoaded && m_exportCheckpointSince == localSince) {
+            qWarning() << "CDExport: resuming export after contact" << m_exportCheckpointMark;
+        } else {
+            // Any checkpoint recorded against a different change set no longer applies
+            m_exportCheckpointLoaded = false;
+            m_exportCheckpointModified = (m_exportCheckpointMark != 0);
+            m_exportCheckpointMark = 0;
+            m_exportCheckpointSince = localSince;
+            m_exportCheckpointTime = exportStart;
+        }
+
+        return exportLocalChanges(locallyAdded, locallyModified, locallyDeleted, importChanges);
+    }
+
+    // Finds the privileged DB state of only the notified contacts, rather than consulting the change log
+    bool determineNotifiedChanges(const QSet<QContactId> &changedIds, const QSet<QContactId> &removedIds,
+                                  QList<QContact> *locallyAdded, QList<QContact> *locallyModified, QList<QContact> *locallyDeleted)
+    {
+        foreach (const QContactId &privilegedId, removedIds) {
+            if (!getNonprivilegedId(privilegedId).isNull()) {
+                QContact contact;
+                contact.setId(privilegedId);
+                locallyDeleted->append(contact);
+            }
+        }
+
+        if (changedIds.isEmpty()) {
+            return true;
+        }
+
+        QContactFetchHint fetchHint;
+        fetchHint.setOptimizationHints(QContactFetchHint::NoRelationships);
+
+        QMap<int, QContactManager::Error> fetchErrors;
+        const QList<QContact> contacts(m_privileged.contacts(changedIds.toList(), fetchHint, &fetchErrors));
+
+        QMap<int, QContactManager::Error>::const_iterator it = fetchErrors.constBegin(), end = fetchErrors.constEnd();
+        for ( ; it != end; ++it) {
+            // Contacts removed since the notification will be reported as removed
+            if (it.value() != QContactManager::DoesNotExistError) {
+                qWarning() << "Unable to fetch notified contacts - error:" << it.value();
+                return false;
+            }
+        }
+
+        foreach (const QContact &contact, contacts) {
+            const QContactId privilegedId(contact.id());
+            if (privilegedId.isNull()) {
+                continue;
+            }
+
+            // Only aggregates and the self contact are exported
+            if (privilegedId != m_privilegedSelfId &&
+                contact.detail<QContactSyncTarget>().syncTarget() != aggregateSyncTarget) {
+                continue;
+            }
+
+            if (privilegedId == m_privilegedSelfId || !getNonprivilegedId(privilegedId).isNull()) {
+                locallyModified->append(contact);
+            } else {
+                locallyAdded->append(contact);
+            }
+        }
+
+        return true;
+    }
+
+    bool exportLocalChanges(const QList<QContact> &locallyAdded, const QList<QContact> &locallyModified,
+                            const QList<QContact> &locallyDeleted, bool importChanges)
+    {
         QList<QContactId> removedContactIds;
+        QList<QContact> exportContacts;
         QContact selfContact;
 
-        QList<QContactId> additionIds;
-
         // Apply primary DB changes to the nonprivileged DB
         foreach (QContact contact, locallyDeleted) {
             const QContactId privilegedId(contact.id());
@@ -701,10 +998,11 @@ private:
             }
 
             deregisterAvatarPathChange(privilegedId);
+            m_exportChecksums.remove(internalId(privilegedId));
         }
 
         // Note: a contact reported as deleted cannot also be in the added or modified lists
-        foreach (QContact contact, locallyAdded + locallyModified) {
+        foreach (const QContact &contact, locallyAdded + locallyModified) {
             const QContactId privilegedId(contact.id());
 
             if (privilegedId == m_privilegedSelfId) {
@@ -715,30 +1013,21 @@ private:
                 continue;
             }
 
-            const QContactId nonprivilegedId(getNonprivilegedId(privilegedId));
-            contact.setId(nonprivilegedId);
-            if (nonprivilegedId.isNull()) {
-                // This is an addition
-                additionIds.append(privilegedId);
-
-                // Remove the primary DB ID
-                contact.setId(QContactId());
+            if (exportCheckpointed(contact)) {
+                // Already exported by an interrupted pass
+                continue;
             }
 
-            // Represent this contact as an aggregate in the export DB
-            QContactSyncTarget st = contact.detail<QContactSyncTarget>();
-            st.setSyncTarget(aggregateSyncTarget);
-            contact.saveDetail(&st);
-
-            prepareExportContact(contact, privilegedId);
+            exportContacts.append(contact);
+        }
 
-            if (nonprivilegedId.isNull()) {
-                addedContacts.append(contact);
-            } else {
-                modifiedContacts.append(contact);
-            }
+        if (checkPreempted()) {
+            return false;
         }
 
+        // Export in ID order, so that the progress of the export is described by the last ID exported
+        qSort(exportContacts.begin(), exportContacts.end(), lessThanInternalId);
+
         // Remove any deleted contacts first so their details cannot conflict with subsequent additions
         while (!removedContactIds.isEmpty()) {
             QMap<int, QContactManager::Error> removeErrors;
@@ -769,137 +1058,30 @@ private:
 
                 // Removing contacts is less important than updating - if we can perform updates,
                 // then failure to remove should not abort the sync attempt
-                if (!modifiedContacts.isEmpty()) {
+                if (!locallyModified.isEmpty()) {
                     break;
                 }
                 return false;
             }
         }
 
-        if (!modifiedContacts.isEmpty() || !addedContacts.isEmpty()) {
-            if (!modifiedContacts.isEmpty()) {
-                // Partition this modified set into two groups - those that only include presence changes, and the remainder
-                QMap<QContactId, const QContact *> potentialPresenceChanges;
-                foreach (const QContact &contact, modifiedContacts) {
-                    // Only contacts with online accounts can have presence changes
-                    if (!contact.details<QContactOnlineAccount>().isEmpty()) {
-                        potentialPresenceChanges.insert(contact.id(), &contact);
-                    }
-                }
-
-                if (!potentialPresenceChanges.isEmpty()) {
-                    QList<QContact> presenceChangedContacts;
-
-                    QContactIdFilter idFilter;
-                    idFilter.setIds(potentialPresenceChanges.keys());
-                    QContactFetchHint fetchHint;
-                    fetchHint.setOptimizationHints(QContactFetchHint::NoRelationships);
-
-                    QSet<QContactId> presenceChangedIds;
-                    foreach (QContact contact, m_nonprivileged.contacts(idFilter, QList<QContactSortOrder>(), fetchHint)) {
-                        const QContact *newContact(potentialPresenceChanges.value(contact.id()));
-                        if (presenceOnlyChange(contact, *newContact)) {
-                            presenceChangedContacts.append(*newContact);
-                            presenceChangedIds.insert(contact.id());
-                        }
-                    }
-
-                    if (!presenceChangedIds.isEmpty()) {
-                        // Remove the presence-only changed contacts from the modified list
-                        QList<QContact>::iterator it = modifiedContacts.begin();
-                        while (it != modifiedContacts.end()) {
-                            if (presenceChangedIds.contains((*it).id())) {
-                                it = modifiedContacts.erase(it);
-                            } else {
-                                ++it;
-                            }
-                        }
-                    }
-
-                    // Save the presence changes first
-                    if (!m_nonprivileged.saveContacts(&presenceChangedContacts, getPresenceDetailTypes().toList())) {
-                        qWarning() << "Unable to save privileged DB presence changes to export DB!";
-                        // Don't abort the sync operation for presence update failure
-                    }
-                }
-            }
-
-            size_t addedContactsOffset = modifiedContacts.count();
-            if (!addedContacts.isEmpty()) {
-                modifiedContacts.append(addedContacts);
+        // Export in bounded chunks, so that the export DB is not locked for the whole export
+        for (int offset = 0; offset < exportContacts.count(); offset += exportChunkSize) {
+            if (checkPreempted()) {
+                return false;
             }
 
-            while (!modifiedContacts.isEmpty()) {
-                QMap<int, QContactManager::Error> saveErrors;
-                if (m_nonprivileged.saveContacts(&modifiedContacts, &saveErrors)) {
-                    break;
-                }
-
-                if (!importChanges) {
-                    // If changes to the export database are not reimported, then deletions from the
-                    // export database must be handled by recreating the contact
-                    if (!saveErrors.isEmpty()) {
-                        // Are these errors that we can handle?
-                        QMap<int, QContactManager::Error>::const_iterator it = saveErrors.constBegin(), end = saveErrors.constEnd();
-                        for ( ; it != end; ++it) {
-                            // If some contact in the batch does not exist, any others in the batch will report LockedError
-                            if ((it.value() != QContactManager::DoesNotExistError) &&
-                                (it.value() != QContactManager::LockedError)) {
-                                // This error is a problem we shouldn't ignore
-                                qWarning() << "Error updating ID:" << modifiedContacts.at(it.key()).id() << "error:" << it.value();
-                                break;
-                            }
-                        }
-                        if (it == end) {
-                            // All errors can be handled - convert the failed modifications to additions
-                            QList<int> removeIndices;
-                            for (it = saveErrors.constBegin(); it != end; ++it) {
-                                if (it.value() == QContactManager::DoesNotExistError) {
-                                    const int index(it.key());
-                                    QContact modified(modifiedContacts.at(index));
-
-                                    const QContactId obsoleteId(modified.id());
-                                    const QContactId privilegedId(getPrivilegedId(obsoleteId));
-
-                                    deregisterIdPair(privilegedId.toString(), obsoleteId.toString());
-
-                                    removeIndices.append(index);
-
-                                    // Convert the failed modification to an addition
-                                    modified.setId(QContactId());
-                                    modifiedContacts.append(modified);
-                                    additionIds.append(privilegedId);
-                                    qWarning() << "Recreating remotely deleted contact:" << privilegedId;
-                                }
-                            }
-
-                            // Remove the invalid modifications from the save list
-                            while (!removeIndices.isEmpty()) {
-                                const int index(removeIndices.takeLast());
-                                modifiedContacts.removeAt(index);
-                                --addedContactsOffset;
-                            }
-
-                            // Attempt the save again
-                            continue;
-                        }
-                    }
-                }
-
-                // We can't handle this error - abort the save
-                qWarning() << "Unable to save privileged DB modifications to export DB!";
+            const QList<QContact> chunk(exportContacts.mid(offset, exportChunkSize));
+            if (!exportChunk(chunk, importChanges)) {
                 return false;
             }
 
-            if (!additionIds.isEmpty()) {
-                // Find the IDs allocated in the export DB
-                QList<QContactId>::const_iterator iit = additionIds.constBegin(), iend = additionIds.constEnd();
-                QList<QContact>::const_iterator cit = modifiedContacts.constBegin() + addedContactsOffset;
-                for ( ; iit != iend; ++iit, ++cit) {
-                    const QString privilegedId((*iit).toString());
-                    const QString nonprivilegedId((*cit).id().toString());
+            if (m_checkpointExports) {
+                m_exportCheckpointMark = qMax(m_exportCheckpointMark, internalId(chunk.last().id()));
+                m_exportCheckpointModified = true;
 
-                    registerIdPair(privilegedId, nonprivilegedId);
+                if (!storeExportState(true)) {
+                    return false;
                 }
             }
         }
@@ -914,43 +1096,517 @@ private:
         return true;
     }
 
-public:
-    SyncAdapter(QContactManager &privileged, QContactManager &nonprivileged)
-        : TwoWayContactSyncAdapter(exportSyncTarget, privileged)
-        , m_privileged(privileged)
-        , m_nonprivileged(nonprivileged)
-        , m_privilegedIdsModified(false)
-        , m_avatarPathChangesModified(false)
+    bool exportChunk(const QList<QContact> &privilegedContacts, bool importChanges)
     {
-        m_privilegedSelfId = m_privileged.selfContactId();
-        m_nonprivilegedSelfId = m_nonprivileged.selfContactId();
-    }
+        QList<QContact> addedContacts;
+        QList<QContact> modifiedContacts;
+
+        QList<QContactId> additionIds;
+        QHash<quint32, QByteArray> checksums;
+
+        foreach (QContact contact, privilegedContacts) {
+            const QContactId privilegedId(contact.id());
+
+            const QContactId nonprivilegedId(getNonprivilegedId(privilegedId));
+            contact.setId(nonprivilegedId);
+            if (nonprivilegedId.isNull()) {
+                // This is an addition
+                additionIds.append(privilegedId);
+
+                // Remove the primary DB ID
+                contact.setId(QContactId());
+            }
+
+            // Represent this contact as an aggregate in the export DB
+            QContactSyncTarget st = contact.detail<QContactSyncTarget>();
+            st.setSyncTarget(aggregateSyncTarget);
+            contact.saveDetail(&st);
+
+            prepareExportContact(contact, privilegedId);
+            checksums.insert(internalId(privilegedId), exportChecksum(contact));
+
+            if (nonprivilegedId.isNull()) {
+                addedContacts.append(contact);
+            } else {
+                modifiedContacts.append(contact);
+            }
+        }
+
+        if (modifiedContacts.isEmpty() && addedContacts.isEmpty()) {
+            return true;
+        }
+
+        if (!modifiedContacts.isEmpty()) {
+            // Partition this modified set into two groups - those that only include presence changes, and the remainder
+            QMap<QContactId, const QContact *> potentialPresenceChanges;
+            foreach (const QContact &contact, modifiedContacts) {
+                // Only contacts with online accounts can have presence changes
+                if (!contact.details<QContactOnlineAccount>().isEmpty()) {
+                    potentialPresenceChanges.insert(contact.id(), &contact);
+                }
+            }
+
+            if (!potentialPresenceChanges.isEmpty()) {
+                QList<QContact> presenceChangedContacts;
+
+                QContactIdFilter idFilter;
+                idFilter.setIds(potentialPresenceChanges.keys());
+                QContactFetchHint fetchHint;
+                fetchHint.setOptimizationHints(QContactFetchHint::NoRelationships);
+
+                QSet<QContactId> presenceChangedIds;
+                foreach (QContact contact, m_nonprivileged.contacts(idFilter, QList<QContactSortOrder>(), fetchHint)) {
+                    const QContact *newContact(potentialPresenceChanges.value(contact.id()));
+                    if (presenceOnlyChange(contact, *newContact)) {
+                        presenceChangedContacts.append(*newContact);
+                        presenceChangedIds.insert(contact.id());
+                    }
+                }
+
+                if (!presenceChangedIds.isEmpty()) {
+                    // Remove the presence-only changed contacts from the modified list
+                    QList<QContact>::iterator it = modifiedContacts.begin();
+                    while (it != modifiedContacts.end()) {
+                        if (presenceChangedIds.contains((*it).id())) {
+                            it = modifiedContacts.erase(it);
+                        } else {
+                            ++it;
+                        }
+                    }
+                }
+
+                // Save the presence changes first
+                if (!m_nonprivileged.saveContacts(&presenceChangedContacts, getPresenceDetailTypes().toList())) {
+                    qWarning() << "Unable to save privileged DB presence changes to export DB!";
+                    // Don't abort the sync operation for presence update failure
+                }
+            }
+        }
+
+        size_t addedContactsOffset = modifiedContacts.count();
+        if (!addedContacts.isEmpty()) {
+            modifiedContacts.append(addedContacts);
+        }
+
+        while (!modifiedContacts.isEmpty()) {
+            QMap<int, QContactManager::Error> saveErrors;
+            if (m_nonprivileged.saveContacts(&modifiedContacts, &saveErrors)) {
+                break;
+            }
+
+            if (!importChanges) {
+                // If changes to the export database are not reimported, then deletions from the
+                // export database must be handled by recreating the contact
+                if (!saveErrors.isEmpty()) {
+                    // Are these errors that we can handle?
+                    QMap<int, QContactManager::Error>::const_iterator it = saveErrors.constBegin(), end = saveErrors.constEnd();
+                    for ( ; it != end; ++it) {
+                        // If some contact in the batch does not exist, any others in the batch will report LockedError
+                        if ((it.value() != QContactManager::DoesNotExistError) &&
+                            (it.value() != QContactManager::LockedError)) {
+                            // This error is a problem we shouldn't ignore
+                            qWarning() << "Error updating ID:" << modifiedContacts.at(it.key()).id() << "error:" << it.value();
+                            break;
+                        }
+                    }
+                    if (it == end) {
+                        // All errors can be handled - convert the failed modifications to additions
+                        QList<int> removeIndices;
+                        for (it = saveErrors.constBegin(); it != end; ++it) {
+                            if (it.value() == QContactManager::DoesNotExistError) {
+                                const int index(it.key());
+                                QContact modified(modifiedContacts.at(index));
+
+                                const QContactId obsoleteId(modified.id());
+                                const QContactId privilegedId(getPrivilegedId(obsoleteId));
+
+                                deregisterIdPair(privilegedId, obsoleteId);
+
+                                removeIndices.append(index);
+
+                                // Convert the failed modification to an addition
+                                modified.setId(QContactId());
+                                modifiedContacts.append(modified);
+                                additionIds.append(privilegedId);
+                                qWarning() << "Recreating remotely deleted contact:" << privilegedId;
+                            }
+                        }
+
+                        // Remove the invalid modifications from the save list
+                        while (!removeIndices.isEmpty()) {
+                            const int index(removeIndices.takeLast());
+                            modifiedContacts.removeAt(index);
+                            --addedContactsOffset;
+                        }
+
+                        // Attempt the save again
+                        continue;
+                    }
+                }
+            }
+
+            // We can't handle this error - abort the save
+            qWarning() << "Unable to save privileged DB modifications to export DB!";
+            return false;
+        }
+
+        if (!additionIds.isEmpty()) {
+            // Find the IDs allocated in the export DB
+            QList<QContactId>::const_iterator iit = additionIds.constBegin(), iend = additionIds.constEnd();
+            QList<QContact>::const_iterator cit = modifiedContacts.constBegin() + addedContactsOffset;
+            for ( ; iit != iend; ++iit, ++cit) {
+                registerIdPair(*iit, (*cit).id());
+            }
+        }
+
+        // Record the exported form for verification
+        QHash<quint32, QByteArray>::const_iterator it = checksums.constBegin(), end = checksums.constEnd();
+        for ( ; it != end; ++it) {
+            m_exportChecksums.insert(it.key(), it.value());
+        }
+
+        return true;
+    }
+
+public:
+    SyncAdapter(QContactManager &privileged, QContactManager &nonprivileged, CDExporterIdMap &idMap,
+                CDExporterAvatarManifest &avatarLinks, QHash<quint32, QByteArray> &exportChecksums,
+                const QAtomicInt *preemptRequest = 0)
+        : TwoWayContactSyncAdapter(exportSyncTarget, privileged)
+        , m_privileged(privileged)
+        , m_nonprivileged(nonprivileged)
+        , m_idMap(idMap)
+        , m_avatarLinks(avatarLinks)
+        , m_exportChecksums(exportChecksums)
+        , m_avatarPathChangesModified(false)
+        , m_preemptRequest(preemptRequest)
+        , m_preempted(false)
+        , m_checkpointExports(false)
+        , m_exportCheckpointLoaded(false)
+        , m_exportCheckpointModified(false)
+        , m_exportCheckpointMark(0)
+    {
+        m_privilegedSelfId = m_privileged.selfContactId();
+        m_nonprivilegedSelfId = m_nonprivileged.selfContactId();
+    }
 
     bool sync(bool importChanges, bool debug)
     {
+        QElapsedTimer timer;
+        timer.start();
+
         // Proceed through the steps of the TWCSA algorithm, where the nonprivileged database
         // is equivalent to 'remote' and the privileged database is equivalent to 'local'
-        return (prepareSync() &&
-                syncNonprivilegedToPrivileged(importChanges, debug) &&
-                syncPrivilegedToNonprivileged(importChanges, debug) &&
-                finalizeSync());
+        if (!timePhase(QStringLiteral("prepare"), timer, prepareSync()) || checkPreempted()) {
+            return false;
+        }
+
+        if (!timePhase(QStringLiteral("import"), timer, syncNonprivilegedToPrivileged(importChanges, debug))) {
+            return false;
+        }
+
+        if (!timePhase(QStringLiteral("export"), timer, syncPrivilegedToNonprivileged(importChanges, debug))) {
+            if (m_preempted) {
+                // The sync state is not advanced, but keep the mapping of any contacts already paired
+                storeExportState();
+            }
+            return false;
+        }
+
+        return timePhase(QStringLiteral("finalize"), timer, finalizeSync());
+    }
+
+    // Finds the privileged counterparts of contacts changed in the export DB since the last full sync
+    bool determinePendingImports(QSet<QContactId> *privilegedIds)
+    {
+        QList<QContactId> nonprivilegedIds(m_nonprivileged.contactIds(modifiedSinceFilter(m_remoteSince)));
+        if (m_nonprivileged.error() == QContactManager::NoError) {
+            nonprivilegedIds.append(m_nonprivileged.contactIds(removedSinceFilter(m_remoteSince)));
+        }
+        if (m_nonprivileged.error() != QContactManager::NoError) {
+            qWarning() << "Unable to determine pending imports - error:" << m_nonprivileged.error();
+            return false;
+        }
+
+        foreach (const QContactId &nonprivilegedId, nonprivilegedIds) {
+            const QContactId privilegedId(getPrivilegedId(nonprivilegedId));
+            if (!privilegedId.isNull()) {
+                privilegedIds->insert(privilegedId);
+            }
+        }
+        return true;
+    }
+
+    bool syncNotified(const QSet<QContactId> &changedIds, const QSet<QContactId> &removedIds, bool importChanges, bool debug)
+    {
+        // Export only the notified contacts. The sync state timestamps are not advanced,
+        // so the next full sync will still reconcile these contacts
+        QElapsedTimer timer;
+        timer.start();
+
+        if (!timePhase(QStringLiteral("prepare"), timer, prepareSync())) {
+            return false;
+        }
+
+        QSet<QContactId> exportIds(changedIds);
+        if (importChanges) {
+            // Contacts with changes still to be imported are left to the full sync which imports them;
+            // exporting them now would overwrite those changes, or recreate a contact deleted there
+            QSet<QContactId> pendingImportIds;
+            if (!determinePendingImports(&pendingImportIds)) {
+                return false;
+            }
+            exportIds.subtract(pendingImportIds);
+        }
+
+        QList<QContact> locallyAdded, locallyModified, locallyDeleted;
+        if (!determineNotifiedChanges(exportIds, removedIds, &locallyAdded, &locallyModified, &locallyDeleted)) {
+            return false;
+        }
+
+        if (debug) {
+            qDebug() << "notified changes -----------------------------";
+            qDebug() << "locallyAdded:" << locallyAdded;
+            qDebug() << "locallyModified:" << locallyModified;
+            qDebug() << "locallyDeleted:" << locallyDeleted;
+        }
+
+        return (timePhase(QStringLiteral("export"), timer, exportLocalChanges(locallyAdded, locallyModified, locallyDeleted, importChanges)) &&
+                timePhase(QStringLiteral("finalize"), timer, storeExportState()));
+    }
+
+    // Compares the exported copies of the given privileged contacts to the form in which they
+    // were exported, and exports again any which differ
+    bool verify(const QList<quint32> &privilegedIds, int *drifted, int *repaired)
+    {
+        if (!prepareSync()) {
+            return false;
+        }
+
+        QList<QContactId> ids;
+        foreach (quint32 privilegedId, privilegedIds) {
+            if (apiId(privilegedId) != m_privilegedSelfId) {
+                ids.append(apiId(privilegedId));
+            }
+        }
+
+        QContactFetchHint fetchHint;
+        fetchHint.setOptimizationHints(QContactFetchHint::NoRelationships);
+
+        // Contacts removed since they were exported will be handled by sync
+        QMap<int, QContactManager::Error> fetchErrors;
+        const QList<QContact> privilegedContacts(m_privileged.contacts(ids, fetchHint, &fetchErrors));
+
+        QList<QContactId> nonprivilegedIds;
+        QHash<QContactId, QByteArray> expectedChecksums;
+        foreach (const QContact &contact, privilegedContacts) {
+            const QContactId nonprivilegedId(getNonprivilegedId(contact.id()));
+            if (contact.id().isNull() || nonprivilegedId.isNull()) {
+                continue;
+            }
+
+            QByteArray checksum(m_exportChecksums.value(internalId(contact.id())));
+            if (checksum.isEmpty()) {
+                // Not exported since we started; the current form should have been exported
+                QContact exported(contact);
+                convertToComparisonForm(exported);
+                checksum = exportChecksum(exported);
+                m_exportChecksums.insert(internalId(contact.id()), checksum);
+            }
+
+            nonprivilegedIds.append(nonprivilegedId);
+            expectedChecksums.insert(nonprivilegedId, checksum);
+        }
+
+        // Exported contacts which no longer exist are reported as errors, and will not match
+        QSet<QContactId> matchingIds;
+        foreach (const QContact &contact, m_nonprivileged.contacts(nonprivilegedIds, fetchHint, &fetchErrors)) {
+            if (!contact.id().isNull() && exportChecksum(contact) == expectedChecksums.value(contact.id())) {
+                matchingIds.insert(contact.id());
+            }
+        }
+
+        QList<QContact> driftedContacts;
+        foreach (const QContact &contact, privilegedContacts) {
+            const QContactId nonprivilegedId(getNonprivilegedId(contact.id()));
+            if (expectedChecksums.contains(nonprivilegedId) && !matchingIds.contains(nonprivilegedId)) {
+                driftedContacts.append(contact);
+            }
+        }
+
+        *drifted = driftedContacts.count();
+        if (driftedContacts.isEmpty()) {
+            return true;
+        }
+
+        qWarning() << "CDExport: repairing" << driftedContacts.count() << "exported contacts which differ from the privileged DB";
+        if (!exportChunk(driftedContacts, false) || !storeExportState()) {
+            return false;
+        }
+
+        *repaired = driftedContacts.count();
+        return true;
+    }
+
+    bool preempted() const { return m_preempted; }
+
+    QString phaseTimes() const
+    {
+        QStringList times;
+        QList<QPair<QString, qint64> >::const_iterator it = m_phaseTimes.constBegin(), end = m_phaseTimes.constEnd();
+        for ( ; it != end; ++it) {
+            times.append(QStringLiteral("%1 %2ms").arg((*it).first).arg((*it).second));
+        }
+        return times.join(QStringLiteral(", "));
+    }
+
+    QVariantMap phaseTimeMap() const
+    {
+        QVariantMap times;
+        QList<QPair<QString, qint64> >::const_iterator it = m_phaseTimes.constBegin(), end = m_phaseTimes.constEnd();
+        for ( ; it != end; ++it) {
+            times.insert((*it).first, (*it).second);
+        }
+        return times;
     }
 };
 
 }
 
+CDExporterWorker::CDExporterWorker(QAtomicInt *preemptRequest)
+    : QObject(0)
+    , m_privilegedManager(0)
+    , m_nonprivilegedManager(0)
+    , m_preemptRequest(preemptRequest)
+{
+}
+
+CDExporterWorker::~CDExporterWorker()
+{
+    delete m_privilegedManager;
+    delete m_nonprivilegedManager;
+}
+
+void CDExporterWorker::initialize()
+{
+    // The managers are created here so that they belong to the worker thread
+    m_privilegedManager = new QContactManager(managerName(), privilegedManagerParameters());
+    m_nonprivilegedManager = new QContactManager(managerName(), nonprivilegedManagerParameters());
+}
+
+void CDExporterWorker::sync(bool fullSync, const QList<QContactId> &changedIds, const QList<QContactId> &removedIds, bool importChanges, bool debug)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    // Only full passes are preemptable; notified passes are bounded by notifiedSyncLimit
+    SyncAdapter adapter(*m_privilegedManager, *m_nonprivilegedManager, m_idMap, m_avatarLinks, m_exportChecksums,
+                        fullSync ? m_preemptRequest : 0);
+
+    bool success;
+    if (fullSync) {
+        success = adapter.sync(importChanges, debug);
+    } else {
+        success = adapter.syncNotified(changedIds.toSet(), removedIds.toSet(), importChanges, debug);
+    }
+
+    const qint64 elapsed(timer.elapsed());
+    if (adapter.preempted()) {
+        qWarning() << "CDExport: full sync preempted after" << elapsed << "ms:" << adapter.phaseTimes();
+    } else if (debug || elapsed >= syncDelay) {
+        qWarning() << "CDExport:" << (fullSync ? "full" : "notified") << "sync took" << elapsed << "ms:" << adapter.phaseTimes();
+    }
+
+    m_lastPhaseTimes = adapter.phaseTimeMap();
+    Q_EMIT syncFinished(success, adapter.preempted(), fullSync, changedIds, removedIds, elapsed);
+}
+
+void CDExporterWorker::verify()
+{
+    if (m_verifyQueue.isEmpty()) {
+        // Start a new verification cycle
+        m_verifyQueue = m_idMap.privilegedIds();
+        qSort(m_verifyQueue);
+    }
+
+    const QList<quint32> slice(m_verifyQueue.mid(0, verifySliceSize));
+    m_verifyQueue = m_verifyQueue.mid(slice.count());
+
+    SyncAdapter adapter(*m_privilegedManager, *m_nonprivilegedManager, m_idMap, m_avatarLinks, m_exportChecksums);
+
+    int drifted = 0;
+    int repaired = 0;
+    const bool success(adapter.verify(slice, &drifted, &repaired));
+    if (!success) {
+        qWarning() << "Unable to verify exported contacts";
+        m_verifyQueue.clear();
+    }
+
+    Q_EMIT verified(success, slice.count(), drifted, repaired, m_verifyQueue.isEmpty());
+}
+
+void CDExporterWorker::mirrorPresence(const QList<QContactId> &changedIds)
+{
+    const QSet<QContactId> ids(changedIds.toSet());
+
+    QSet<QContactId> unmirroredIds;
+    if (!::mirrorPresence(*m_privilegedManager, *m_nonprivilegedManager, m_idMap, ids, &unmirroredIds)) {
+        unmirroredIds = ids;
+    }
+
+    Q_EMIT presenceMirrored(unmirroredIds.toList());
+}
+
 CDExporterController::CDExporterController(QObject *parent)
     : QObject(parent)
     , m_privilegedManager(managerName(), privilegedManagerParameters())
     , m_nonprivilegedManager(managerName(), nonprivilegedManagerParameters())
+    , m_fullSyncRequired(true)
+    , m_syncInProgress(false)
+    , m_fullSyncInProgress(false)
+    , m_consecutivePreemptions(0)
+    , m_dataChangePending(false)
+    , m_changeInterval(maxBurstDelay)
+    , m_lastSyncDuration(0)
+    , m_verifyInProgress(false)
+    , m_verifyCycleActive(false)
+    , m_verifyChecked(0)
+    , m_verifyDrifted(0)
+    , m_verifyRepaired(0)
     , m_disabledConf(QStringLiteral("/org/nemomobile/contacts/export/disabled"))
     , m_debugConf(QStringLiteral("/org/nemomobile/contacts/export/debug"))
     , m_importConf(QStringLiteral("/org/nemomobile/contacts/export/import"))
+    , m_maxLatencyConf(QStringLiteral("/org/nemomobile/contacts/export/maxLatency"))
+    , m_worker(new CDExporterWorker(&m_preemptRequest))
 {
+    qRegisterMetaType<QList<QContactId> >();
+
+    // Synchronization runs on the worker thread, with its own manager instances;
+    // the managers owned here only report changes
+    m_worker->moveToThread(&m_workerThread);
+    connect(&m_workerThread, SIGNAL(finished()), m_worker, SLOT(deleteLater()));
+    connect(m_worker, SIGNAL(syncFinished(bool,bool,bool,QList<QContactId>,QList<QContactId>,qint64)),
+            this, SLOT(onWorkerSyncFinished(bool,bool,bool,QList<QContactId>,QList<QContactId>,qint64)));
+    connect(m_worker, SIGNAL(presenceMirrored(QList<QContactId>)), this, SLOT(onWorkerPresenceMirrored(QList<QContactId>)));
+    connect(m_worker, SIGNAL(verified(bool,int,int,int,bool)), this, SLOT(onWorkerVerified(bool,int,int,int,bool)));
+    m_workerThread.start();
+    QMetaObject::invokeMethod(m_worker, "initialize", Qt::QueuedConnection);
+
     // Use a timer to delay reaction, so we don't sync until sequential changes have completed
     m_syncTimer.setSingleShot(true);
     connect(&m_syncTimer, SIGNAL(timeout()), this, SLOT(onSyncTimeout()));
 
+    m_presenceTimer.setSingleShot(true);
+    m_presenceTimer.setInterval(presenceMirrorDelay);
+    connect(&m_presenceTimer, SIGNAL(timeout()), this, SLOT(onPresenceMirrorTimeout()));
+
+    m_fullSyncTimer.setSingleShot(true);
+    m_fullSyncTimer.setInterval(fullSyncInterval);
+    connect(&m_fullSyncTimer, SIGNAL(timeout()), this, SLOT(onFullSyncTimeout()));
+
+    m_verifyTimer.setSingleShot(true);
+    connect(&m_verifyTimer, SIGNAL(timeout()), this, SLOT(onVerifyTimeout()));
+
     connect(&m_privilegedManager, SIGNAL(contactsAdded(QList<QContactId>)), this, SLOT(onPrivilegedContactsAdded(QList<QContactId>)));
     connect(&m_privilegedManager, SIGNAL(contactsChanged(QList<QContactId>)), this, SLOT(onPrivilegedContactsChanged(QList<QContactId>)));
     connect(&m_privilegedManager, SIGNAL(contactsRemoved(QList<QContactId>)), this, SLOT(onPrivilegedContactsRemoved(QList<QContactId>)));
@@ -966,6 +1622,7 @@ CDExporterController::CDExporterController(QObject *parent)
 
     if (m_disabledConf.value().toInt() == 0) {
         // Do an initial sync
+        m_pendingSince.start();
         m_syncTimer.start(1);
     } else {
         qWarning() << "Contacts database export is disabled";
@@ -974,29 +1631,43 @@ CDExporterController::CDExporterController(QObject *parent)
 
 CDExporterController::~CDExporterController()
 {
+    // Stop any running pass at its next batch boundary, and wait for the worker to finish
+    m_preemptRequest.store(1);
+    m_workerThread.quit();
+    m_workerThread.wait();
 }
 
 void CDExporterController::onPrivilegedContactsAdded(const QList<QContactId> &addedIds)
 {
-    Q_UNUSED(addedIds)
+    m_changedIds.unite(addedIds.toSet());
     scheduleSync(DataChange);
 }
 
 void CDExporterController::onPrivilegedContactsChanged(const QList<QContactId> &changedIds)
 {
-    Q_UNUSED(changedIds)
+    m_changedIds.unite(changedIds.toSet());
     scheduleSync(DataChange);
 }
 
 void CDExporterController::onPrivilegedContactsPresenceChanged(const QList<QContactId> &changedIds)
 {
-    Q_UNUSED(changedIds)
-    scheduleSync(PresenceChange);
+    if (m_disabledConf.value().toInt() != 0) {
+        return;
+    }
+
+    // Presence is mirrored directly rather than exported by sync
+    m_presenceChangedIds.unite(changedIds.toSet());
+    if (!m_presenceTimer.isActive()) {
+        m_presenceTimer.start();
+    }
 }
 
 void CDExporterController::onPrivilegedContactsRemoved(const QList<QContactId> &removedIds)
 {
-    Q_UNUSED(removedIds)
+    foreach (const QContactId &id, removedIds) {
+        m_changedIds.remove(id);
+        m_removedIds.insert(id);
+    }
     scheduleSync(DataChange);
 }
 
@@ -1004,6 +1675,8 @@ void CDExporterController::onNonprivilegedContactsAdded(const QList<QContactId>
 {
     Q_UNUSED(addedIds)
     if (m_importConf.value().toInt() > 0) {
+        // Imports are found from the nonprivileged change log
+        m_fullSyncRequired = true;
         scheduleSync(DataChange);
     }
 }
@@ -1012,6 +1685,7 @@ void CDExporterController::onNonprivilegedContactsChanged(const QList<QContactId
 {
     Q_UNUSED(changedIds)
     if (m_importConf.value().toInt() > 0) {
+        m_fullSyncRequired = true;
         scheduleSync(DataChange);
     }
 }
@@ -1020,10 +1694,35 @@ void CDExporterController::onNonprivilegedContactsRemoved(const QList<QContactId
 {
     Q_UNUSED(removedIds)
     if (m_importConf.value().toInt() > 0) {
+        m_fullSyncRequired = true;
         scheduleSync(DataChange);
     }
 }
 
+void CDExporterController::onPresenceMirrorTimeout()
+{
+    const QList<QContactId> changedIds(m_presenceChangedIds.toList());
+    m_presenceChangedIds.clear();
+
+    QMetaObject::invokeMethod(m_worker, "mirrorPresence", Qt::QueuedConnection,
+                              Q_ARG(QList<QContactId>, changedIds));
+}
+
+void CDExporterController::onWorkerPresenceMirrored(const QList<QContactId> &unmirroredIds)
+{
+    if (!unmirroredIds.isEmpty()) {
+        // These contacts must be exported by sync
+        m_changedIds.unite(unmirroredIds.toSet());
+        scheduleSync(PresenceChange);
+    }
+}
+
+void CDExporterController::onFullSyncTimeout()
+{
+    m_fullSyncRequired = true;
+    scheduleSync(DataChange);
+}
+
 void CDExporterController::onSyncContactsChanged(const QStringList &syncTargets)
 {
     Q_FOREACH (const QString &syncTarget, syncTargets) {
@@ -1034,16 +1733,175 @@ void CDExporterController::onSyncContactsChanged(const QStringList &syncTargets)
 
 void CDExporterController::onSyncTimeout()
 {
+    if (m_syncInProgress) {
+        // New changes preempt a running full pass, unless that would starve it
+        if (m_fullSyncInProgress && m_consecutivePreemptions < maxConsecutivePreemptions &&
+            (!m_changedIds.isEmpty() || !m_removedIds.isEmpty())) {
+            m_preemptRequest.store(1);
+        }
+
+        // Any outstanding changes are synced when the running pass finishes
+        return;
+    }
+
     const bool importChanges(m_importConf.value().toInt() > 0);
     const bool debug(m_debugConf.value().toInt() > 0);
 
-    // Perform a sync between the privileged and non-privileged managers
-    SyncAdapter adapter(m_privilegedManager, m_nonprivilegedManager);
-    if (!adapter.sync(importChanges, debug)) {
-        qWarning() << "Unable to synchronize database changes!";
+    const QList<QContactId> changedIds(m_changedIds.toList());
+    const QList<QContactId> removedIds(m_removedIds.toList());
+    m_changedIds.clear();
+    m_removedIds.clear();
+
+    const int notifiedCount(changedIds.count() + removedIds.count());
+    bool fullSync(m_fullSyncRequired || notifiedCount > notifiedSyncLimit);
+    if (fullSync && m_consecutivePreemptions > 0 && m_consecutivePreemptions < maxConsecutivePreemptions &&
+        notifiedCount > 0 && notifiedCount <= notifiedSyncLimit) {
+        // Export the changes that preempted the last full pass before resuming it
+        fullSync = false;
+    }
+
+    if (fullSync) {
+        m_fullSyncRequired = false;
+        m_fullSyncTimer.stop();
+    } else if (notifiedCount == 0) {
+        m_pendingSince.invalidate();
+        m_dataChangePending = false;
+        triggerExternalSync();
+        return;
+    }
+
+    // The export lag is measured from the oldest change included in this pass
+    m_passPendingSince = m_pendingSince;
+    m_pendingSince.invalidate();
+    m_dataChangePending = false;
+
+    // Perform a sync between the privileged and non-privileged managers on the worker thread
+    m_syncInProgress = true;
+    m_fullSyncInProgress = fullSync;
+    QMetaObject::invokeMethod(m_worker, "sync", Qt::QueuedConnection,
+                              Q_ARG(bool, fullSync),
+                              Q_ARG(QList<QContactId>, changedIds),
+                              Q_ARG(QList<QContactId>, removedIds),
+                              Q_ARG(bool, importChanges),
+                              Q_ARG(bool, debug));
+}
+
+void CDExporterController::onWorkerSyncFinished(bool success, bool preempted, bool fullSync,
+                                                const QList<QContactId> &changedIds, const QList<QContactId> &removedIds,
+                                                qint64 elapsed)
+{
+    m_syncInProgress = false;
+    m_fullSyncInProgress = false;
+    m_preemptRequest.store(0);
+
+    if (preempted) {
+        // Nothing was committed by the preempted pass; it must be repeated
+        ++m_consecutivePreemptions;
+        m_fullSyncRequired = true;
+
+        foreach (const QContactId &id, removedIds) {
+            if (!m_changedIds.contains(id)) {
+                m_removedIds.insert(id);
+            }
+        }
+        foreach (const QContactId &id, changedIds) {
+            if (!m_removedIds.contains(id)) {
+                m_changedIds.insert(id);
+            }
+        }
+    } else if (!success) {
+        if (fullSync) {
+            qWarning() << "Unable to synchronize database changes!";
+        } else {
+            qWarning() << "Unable to export notified changes; falling back to full sync";
+            m_fullSyncRequired = true;
+        }
+    } else if (fullSync) {
+        m_consecutivePreemptions = 0;
+    } else if (!m_fullSyncTimer.isActive()) {
+        m_fullSyncTimer.start();
+    }
+
+    m_lastSyncDuration = elapsed;
+    const qint64 lag(m_passPendingSince.isValid() ? m_passPendingSince.elapsed() : 0);
+    if (m_debugConf.value().toInt() > 0) {
+        qWarning() << "CDExport: sync pass finished in" << elapsed << "ms, export lag" << lag << "ms";
+    }
+
+    triggerExternalSync();
+
+    if (m_fullSyncRequired || !m_changedIds.isEmpty() || !m_removedIds.isEmpty()) {
+        // Changes carried over from this pass are as old as the pass itself
+        if (m_passPendingSince.isValid() && (!m_pendingSince.isValid() || m_passPendingSince < m_pendingSince)) {
+            m_pendingSince = m_passPendingSince;
+        } else if (!m_pendingSince.isValid()) {
+            m_pendingSince.start();
+        }
+        m_dataChangePending = true;
+        startSyncTimer();
+    } else {
+        scheduleVerification();
+    }
+    m_passPendingSince.invalidate();
+}
+
+bool CDExporterController::exportIdle() const
+{
+    return !m_syncInProgress && !m_syncTimer.isActive() && !m_fullSyncRequired &&
+           m_changedIds.isEmpty() && m_removedIds.isEmpty();
+}
+
+void CDExporterController::scheduleVerification()
+{
+    // Verification cannot distinguish drift from nonprivileged changes to be imported
+    if (m_verifyTimer.isActive() || m_verifyInProgress ||
+        m_disabledConf.value().toInt() != 0 || m_importConf.value().toInt() > 0) {
+        return;
+    }
+
+    m_verifyTimer.start(m_verifyCycleActive ? verifySliceDelay : verifyCycleInterval);
+}
+
+void CDExporterController::onVerifyTimeout()
+{
+    // Verification resumes once the pending changes have been exported
+    if (!exportIdle()) {
+        return;
     }
 
-    // And trigger a sync to external Contacts sync sources
+    m_verifyInProgress = true;
+    QMetaObject::invokeMethod(m_worker, "verify", Qt::QueuedConnection);
+}
+
+void CDExporterController::onWorkerVerified(bool success, int checked, int drifted, int repaired, bool cycleComplete)
+{
+    m_verifyInProgress = false;
+    m_verifyChecked += checked;
+    m_verifyDrifted += drifted;
+    m_verifyRepaired += repaired;
+
+    if (cycleComplete) {
+        if (m_verifyDrifted > 0 || !success || m_debugConf.value().toInt() > 0) {
+            qWarning() << "CDExport: verification" << (success ? "completed:" : "failed:") << m_verifyDrifted
+                       << "of" << m_verifyChecked << "exported contacts differed," << m_verifyRepaired << "repaired";
+        }
+
+        m_verifyCycleActive = false;
+        m_verifyChecked = 0;
+        m_verifyDrifted = 0;
+        m_verifyRepaired = 0;
+    } else {
+        m_verifyCycleActive = true;
+    }
+
+    if (exportIdle()) {
+        scheduleVerification();
+    }
+}
+
+void CDExporterController::triggerExternalSync()
+{
+    // Trigger a sync to external Contacts sync sources
     if (!m_syncTargetsNeedingSync.isEmpty()) {
         qWarning() << "CDExport: triggering contacts sync" << QStringList(m_syncTargetsNeedingSync.toList()).join(QStringLiteral(":"));
         QDBusMessage message = QDBusMessage::createMethodCall(
@@ -1063,8 +1921,50 @@ void CDExporterController::onSyncTimeout()
 void CDExporterController::scheduleSync(ChangeType type)
 {
     // Something has changed that needs to be exported
-    if (m_disabledConf.value().toInt() == 0) {
-        m_syncTimer.start(type == PresenceChange ? presenceSyncDelay : syncDelay);
+    if (m_disabledConf.value().toInt() != 0) {
+        return;
+    }
+
+    // Track the recent interval between changes
+    if (m_lastChangeTimer.isValid()) {
+        const qint64 interval(qMin<qint64>(m_lastChangeTimer.restart(), maxBurstDelay));
+        m_changeInterval = (m_changeInterval * 3 + interval) / 4;
+    } else {
+        m_lastChangeTimer.start();
     }
+
+    if (!m_pendingSince.isValid()) {
+        m_pendingSince.start();
+    }
+    if (type == DataChange) {
+        m_dataChangePending = true;
+    }
+
+    startSyncTimer();
+}
+
+void CDExporterController::startSyncTimer()
+{
+    qint64 delay(m_dataChangePending ? syncDelay : presenceSyncDelay);
+
+    // Wait out a burst of changes, rather than syncing for each of them
+    if (m_changeInterval < maxBurstDelay) {
+        delay = qMax(delay, qMin<qint64>(m_changeInterval + m_changeInterval / 2, maxBurstDelay));
+    }
+
+    // Don't sync more often than syncs can be completed
+    delay = qMax(delay, m_lastSyncDuration);
+
+    // But never defer the oldest pending change beyond the latency bound
+    const qint64 maxLatency(m_dataChangePending ? m_maxLatencyConf.value(maxSyncLatency).toInt() : maxPresenceSyncLatency);
+    const qint64 pendingAge(m_pendingSince.isValid() ? m_pendingSince.elapsed() : 0);
+    delay = qMax<qint64>(qMin(delay, maxLatency - pendingAge), 0);
+
+    if (m_debugConf.value().toInt() > 0) {
+        qWarning() << "CDExport: sync scheduled in" << delay << "ms, change interval" << m_changeInterval
+                   << "ms, last sync" << m_lastSyncDuration << "ms, oldest change" << pendingAge << "ms";
+    }
+
+    m_syncTimer.start(static_cast<int>(delay));
 }
 
@@ -16,18 +16,59 @@
 #ifndef CDEXPORTERCONTROLLER_H
 #define CDEXPORTERCONTROLLER_H
 
+#include <QAtomicInt>
+#include <QElapsedTimer>
 #include <QObject>
+#include <QThread>
 #include <QTimer>
 #include <QSet>
 #include <QStringList>
 #include <QString>
+#include <QVariantMap>
 
 #include <QContactManager>
 
 #include <MGConfItem>
 
+#include "cdexporteravatarmanifest.h"
+#include "cdexporteridmap.h"
+
 QTCONTACTS_USE_NAMESPACE
 
+// Performs synchronization on behalf of the controller, on a thread of its own
+class CDExporterWorker : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit CDExporterWorker(QAtomicInt *preemptRequest);
+    ~CDExporterWorker();
+
+    // The duration in milliseconds of each phase of the last sync pass
+    QVariantMap lastPhaseTimes() const { return m_lastPhaseTimes; }
+
+public slots:
+    void initialize();
+    void sync(bool fullSync, const QList<QContactId> &changedIds, const QList<QContactId> &removedIds, bool importChanges, bool debug);
+    void mirrorPresence(const QList<QContactId> &changedIds);
+    void verify();
+
+signals:
+    void syncFinished(bool success, bool preempted, bool fullSync, const QList<QContactId> &changedIds, const QList<QContactId> &removedIds, qint64 elapsed);
+    void presenceMirrored(const QList<QContactId> &unmirroredIds);
+    void verified(bool success, int checked, int drifted, int repaired, bool cycleComplete);
+
+private:
+    QContactManager *m_privilegedManager;
+    QContactManager *m_nonprivilegedManager;
+    CDExporterIdMap m_idMap;
+    CDExporterAvatarManifest m_avatarLinks;
+    QHash<quint32, QByteArray> m_exportChecksums;   // keyed by privileged ID
+    QList<quint32> m_verifyQueue;
+    QVariantMap m_lastPhaseTimes;
+    QAtomicInt *m_preemptRequest;
+};
+
 class CDExporterController : public QObject
 {
     Q_OBJECT
@@ -49,19 +90,64 @@ private slots:
     void onSyncContactsChanged(const QStringList &syncTargets);
 
     void onSyncTimeout();
+    void onPresenceMirrorTimeout();
+    void onFullSyncTimeout();
+
+    void onWorkerSyncFinished(bool success, bool preempted, bool fullSync, const QList<QContactId> &changedIds, const QList<QContactId> &removedIds, qint64 elapsed);
+    void onWorkerPresenceMirrored(const QList<QContactId> &unmirroredIds);
+
+    void onVerifyTimeout();
+    void onWorkerVerified(bool success, int checked, int drifted, int repaired, bool cycleComplete);
 
 private:
     enum ChangeType { PresenceChange, DataChange };
     void scheduleSync(ChangeType type);
+    void startSyncTimer();
+    bool exportIdle() const;
+    void scheduleVerification();
+    void triggerExternalSync();
 
     QContactManager m_privilegedManager;
     QContactManager m_nonprivilegedManager;
     QTimer m_syncTimer;
+    QTimer m_fullSyncTimer;
+    QTimer m_presenceTimer;
     QSet<QString> m_syncTargetsNeedingSync;
 
+    // Privileged contacts notified as changed since the last sync
+    QSet<QContactId> m_changedIds;
+    QSet<QContactId> m_removedIds;
+    // Privileged contacts with presence changes not yet mirrored
+    QSet<QContactId> m_presenceChangedIds;
+    bool m_fullSyncRequired;
+    bool m_syncInProgress;
+    bool m_fullSyncInProgress;
+    int m_consecutivePreemptions;
+
+    // Debounce state: age of the oldest unexported change, and the recent change rate
+    QElapsedTimer m_pendingSince;
+    QElapsedTimer m_passPendingSince;
+    QElapsedTimer m_lastChangeTimer;
+    bool m_dataChangePending;
+    qint64 m_changeInterval;
+    qint64 m_lastSyncDuration;
+
+    // Progress of the current verification cycle
+    QTimer m_verifyTimer;
+    bool m_verifyInProgress;
+    bool m_verifyCycleActive;
+    int m_verifyChecked;
+    int m_verifyDrifted;
+    int m_verifyRepaired;
+
     MGConfItem m_disabledConf;
     MGConfItem m_debugConf;
     MGConfItem m_importConf;
+    MGConfItem m_maxLatencyConf;
+
+    QAtomicInt m_preemptRequest;
+    QThread m_workerThread;
+    CDExporterWorker *m_worker;
 };
 
 #endif // CDEXPORTERCONTROLLER_H
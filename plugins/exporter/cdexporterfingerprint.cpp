@@ -0,0 +1,123 @@
+/** This file is part of Contacts daemon
+ **
+ ** Copyright (c) 2014 Jolla Ltd.
+ **
+ ** Contact: Matt Vogt <matthew.vogt@jollamobile.com>
+ **
+ ** GNU Lesser General Public License Usage
+ ** This file may be used under the terms of the GNU Lesser General Public License
+ ** version 2.1 as published by the Free Software Foundation and appearing in the
+ ** file LICENSE.LGPL included in the packaging of this file.  Please review the
+ ** following information to ensure the GNU Lesser General Public License version
+ ** 2.1 requirements will be met:
+ ** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+ **/
+
+#include "cdexporterfingerprint.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QList>
+
+#include <qtcontacts-extensions.h>
+
+namespace {
+
+bool ignoredField(int field)
+{
+    return field == QContactDetail::FieldDetailUri ||
+           field == QContactDetail::FieldLinkedDetailUris ||
+           field == QContactDetail__FieldProvenance;
+}
+
+}
+
+namespace CDExporterFingerprint {
+
+QByteArray detailHash(const QContactDetail &detail)
+{
+    QByteArray data;
+    {
+        QDataStream write(&data, QIODevice::WriteOnly);
+
+        // The value map is ordered by field, so equal details serialize identically
+        const QMap<int, QVariant> values(detail.values());
+        QMap<int, QVariant>::const_iterator it = values.constBegin(), end = values.constEnd();
+        for ( ; it != end; ++it) {
+            if (!ignoredField(it.key())) {
+                write << it.key() << it.value();
+            }
+        }
+    }
+
+    return QCryptographicHash::hash(data, QCryptographicHash::Md5);
+}
+
+TypeHashes typeHashes(const QContact &contact, const QSet<QContactDetail::DetailType> &excludedTypes)
+{
+    QHash<QContactDetail::DetailType, QList<QByteArray> > detailHashes;
+    foreach (const QContactDetail &detail, contact.details()) {
+        const QContactDetail::DetailType type(detail.type());
+        if (!excludedTypes.contains(type)) {
+            detailHashes[type].append(detailHash(detail));
+        }
+    }
+
+    TypeHashes rv;
+
+    QHash<QContactDetail::DetailType, QList<QByteArray> >::iterator it = detailHashes.begin(), end = detailHashes.end();
+    for ( ; it != end; ++it) {
+        // Sort so that the same set of details matches regardless of order
+        QList<QByteArray> &hashes(it.value());
+        qSort(hashes);
+
+        QCryptographicHash typeHash(QCryptographicHash::Md5);
+        foreach (const QByteArray &hash, hashes) {
+            typeHash.addData(hash);
+        }
+        rv.insert(it.key(), typeHash.result());
+    }
+
+    return rv;
+}
+
+QSet<QContactDetail::DetailType> changedTypes(const TypeHashes &oldHashes, const TypeHashes &newHashes)
+{
+    QSet<QContactDetail::DetailType> rv;
+
+    TypeHashes::const_iterator it = oldHashes.constBegin(), end = oldHashes.constEnd();
+    for ( ; it != end; ++it) {
+        if (newHashes.value(it.key()) != it.value()) {
+            rv.insert(it.key());
+        }
+    }
+    for (it = newHashes.constBegin(), end = newHashes.constEnd(); it != end; ++it) {
+        if (!oldHashes.contains(it.key())) {
+            rv.insert(it.key());
+        }
+    }
+
+    return rv;
+}
+
+QByteArray contactHash(const QContact &contact, const QSet<QContactDetail::DetailType> &excludedTypes)
+{
+    const TypeHashes hashes(typeHashes(contact, excludedTypes));
+
+    QList<QContactDetail::DetailType> types(hashes.keys());
+    qSort(types);
+
+    QCryptographicHash hash(QCryptographicHash::Md5);
+    foreach (QContactDetail::DetailType type, types) {
+        QByteArray data;
+        {
+            QDataStream write(&data, QIODevice::WriteOnly);
+            write << static_cast<quint32>(type);
+        }
+        hash.addData(data);
+        hash.addData(hashes.value(type));
+    }
+    return hash.result();
+}
+
+}
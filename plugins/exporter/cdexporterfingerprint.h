@@ -0,0 +1,46 @@
+/** This file is part of Contacts daemon
+ **
+ ** Copyright (c) 2014 Jolla Ltd.
+ **
+ ** Contact: Matt Vogt <matthew.vogt@jollamobile.com>
+ **
+ ** GNU Lesser General Public License Usage
+ ** This file may be used under the terms of the GNU Lesser General Public License
+ ** version 2.1 as published by the Free Software Foundation and appearing in the
+ ** file LICENSE.LGPL included in the packaging of this file.  Please review the
+ ** following information to ensure the GNU Lesser General Public License version
+ ** 2.1 requirements will be met:
+ ** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+ **/
+
+#ifndef CDEXPORTERFINGERPRINT_H
+#define CDEXPORTERFINGERPRINT_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QSet>
+
+#include <QContact>
+#include <QContactDetail>
+
+QTCONTACTS_USE_NAMESPACE
+
+// Fingerprints of contact details which ignore the fields that differ between
+// the privileged and exported forms of a contact (detail URIs and provenance)
+namespace CDExporterFingerprint {
+
+typedef QHash<QContactDetail::DetailType, QByteArray> TypeHashes;
+
+QByteArray detailHash(const QContactDetail &detail);
+
+// One hash per detail type present in the contact, independent of detail order
+TypeHashes typeHashes(const QContact &contact, const QSet<QContactDetail::DetailType> &excludedTypes);
+
+QSet<QContactDetail::DetailType> changedTypes(const TypeHashes &oldHashes, const TypeHashes &newHashes);
+
+// A single hash of all the included details of the contact
+QByteArray contactHash(const QContact &contact, const QSet<QContactDetail::DetailType> &excludedTypes);
+
+}
+
+#endif // CDEXPORTERFINGERPRINT_H
@@ -0,0 +1,199 @@
+/** This file is part of Contacts daemon
+ **
+ ** Copyright (c) 2014 Jolla Ltd.
+ **
+ ** Contact: Matt Vogt <matthew.vogt@jollamobile.com>
+ **
+ ** GNU Lesser General Public License Usage
+ ** This file may be used under the terms of the GNU Lesser General Public License
+ ** version 2.1 as published by the Free Software Foundation and appearing in the
+ ** file LICENSE.LGPL included in the packaging of this file.  Please review the
+ ** following information to ensure the GNU Lesser General Public License version
+ ** 2.1 requirements will be met:
+ ** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+ **/
+
+#include "cdexporteridmap.h"
+
+#include <QContactId>
+#include <QDataStream>
+#include <QtDebug>
+
+#include <qtcontacts-extensions.h>
+
+QTCONTACTS_USE_NAMESPACE
+
+namespace {
+
+// Rewrite the full snapshot once the deltas outnumber a quarter of the pairs
+const int minimumCompactionDeltas = 256;
+
+// Start a new delta segment once the open one reaches this size
+const int deltaSegmentSize = 4096;
+
+}
+
+CDExporterIdMap::CDExporterIdMap()
+    : m_closedSegments(0)
+    , m_storedSegments(0)
+    , m_deltaCount(0)
+    , m_compactionRequired(false)
+    , m_loaded(false)
+{
+}
+
+void CDExporterIdMap::load(const QByteArray &snapshot, const QList<QByteArray> &deltaSegments)
+{
+    invalidate();
+
+    {
+        QDataStream ds(snapshot);
+        ds >> m_privilegedIds;
+    }
+
+    QHash<quint32, quint32>::const_iterator it = m_privilegedIds.constBegin(), end = m_privilegedIds.constEnd();
+    for ( ; it != end; ++it) {
+        m_nonprivilegedIds.insert(it.value(), it.key());
+    }
+
+    foreach (const QByteArray &segment, deltaSegments) {
+        QDataStream ds(segment);
+        while (!ds.atEnd()) {
+            quint8 type;
+            quint32 privilegedId, nonprivilegedId;
+            ds >> type >> privilegedId >> nonprivilegedId;
+            if (ds.status() != QDataStream::Ok) {
+                qWarning() << "Truncated ID mapping delta data; compacting";
+                m_compactionRequired = true;
+                break;
+            }
+
+            apply(type, privilegedId, nonprivilegedId);
+            ++m_deltaCount;
+        }
+        if (m_compactionRequired) {
+            // Later deltas cannot be applied without those lost
+            break;
+        }
+    }
+
+    // Further deltas are appended to the last segment, until it is full
+    m_storedSegments = deltaSegments.count();
+    if (!deltaSegments.isEmpty() && deltaSegments.last().size() < deltaSegmentSize) {
+        m_closedSegments = m_storedSegments - 1;
+        m_openSegment = deltaSegments.last();
+    } else {
+        m_closedSegments = m_storedSegments;
+    }
+    m_loaded = true;
+}
+
+void CDExporterIdMap::loadLegacy(const QMap<QString, QString> &privilegedIds)
+{
+    invalidate();
+
+    QMap<QString, QString>::const_iterator it = privilegedIds.constBegin(), end = privilegedIds.constEnd();
+    for ( ; it != end; ++it) {
+        const quint32 nonprivilegedId(QtContactsSqliteExtensions::internalContactId(QContactId::fromString(it.key())));
+        const quint32 privilegedId(QtContactsSqliteExtensions::internalContactId(QContactId::fromString(it.value())));
+        if (privilegedId && nonprivilegedId) {
+            apply(AddPair, privilegedId, nonprivilegedId);
+        }
+    }
+
+    // The converted mapping must be stored in the new form
+    m_compactionRequired = true;
+    m_loaded = true;
+}
+
+void CDExporterIdMap::invalidate()
+{
+    m_privilegedIds.clear();
+    m_nonprivilegedIds.clear();
+    m_openSegment.clear();
+    m_pendingDeltas.clear();
+    m_closedSegments = 0;
+    m_storedSegments = 0;
+    m_deltaCount = 0;
+    m_compactionRequired = false;
+    m_loaded = false;
+}
+
+void CDExporterIdMap::registerPair(quint32 privilegedId, quint32 nonprivilegedId)
+{
+    if (m_privilegedIds.value(nonprivilegedId) == privilegedId &&
+        m_nonprivilegedIds.value(privilegedId) == nonprivilegedId) {
+        return;
+    }
+
+    apply(AddPair, privilegedId, nonprivilegedId);
+    appendDelta(AddPair, privilegedId, nonprivilegedId);
+}
+
+void CDExporterIdMap::deregisterPair(quint32 privilegedId, quint32 nonprivilegedId)
+{
+    QHash<quint32, quint32>::const_iterator pit = m_privilegedIds.constFind(nonprivilegedId);
+    if (pit != m_privilegedIds.constEnd() && *pit != privilegedId) {
+        qWarning() << "Mismatch on ID pair deregistration:" << *pit << "!=" << privilegedId;
+    }
+    QHash<quint32, quint32>::const_iterator nit = m_nonprivilegedIds.constFind(privilegedId);
+    if (nit != m_nonprivilegedIds.constEnd() && *nit != nonprivilegedId) {
+        qWarning() << "Mismatch on ID pair deregistration:" << *nit << "!=" << nonprivilegedId;
+    }
+
+    apply(RemovePair, privilegedId, nonprivilegedId);
+    appendDelta(RemovePair, privilegedId, nonprivilegedId);
+}
+
+bool CDExporterIdMap::needsCompaction() const
+{
+    return m_compactionRequired ||
+           (m_deltaCount > minimumCompactionDeltas && m_deltaCount > m_privilegedIds.count() / 4);
+}
+
+QByteArray CDExporterIdMap::snapshotData() const
+{
+    QByteArray cdata;
+    {
+        QDataStream write(&cdata, QIODevice::WriteOnly);
+        write << m_privilegedIds;
+    }
+    return cdata;
+}
+
+void CDExporterIdMap::committed(bool compacted)
+{
+    if (compacted) {
+        m_openSegment.clear();
+        m_closedSegments = 0;
+        m_storedSegments = 0;
+        m_deltaCount = 0;
+        m_compactionRequired = false;
+    } else if (!m_pendingDeltas.isEmpty()) {
+        m_openSegment.append(m_pendingDeltas);
+        m_storedSegments = qMax(m_storedSegments, m_closedSegments + 1);
+        if (m_openSegment.size() >= deltaSegmentSize) {
+            ++m_closedSegments;
+            m_openSegment.clear();
+        }
+    }
+    m_pendingDeltas.clear();
+}
+
+void CDExporterIdMap::apply(quint8 type, quint32 privilegedId, quint32 nonprivilegedId)
+{
+    if (type == AddPair) {
+        m_privilegedIds.insert(nonprivilegedId, privilegedId);
+        m_nonprivilegedIds.insert(privilegedId, nonprivilegedId);
+    } else {
+        m_privilegedIds.remove(nonprivilegedId);
+        m_nonprivilegedIds.remove(privilegedId);
+    }
+}
+
+void CDExporterIdMap::appendDelta(quint8 type, quint32 privilegedId, quint32 nonprivilegedId)
+{
+    QDataStream write(&m_pendingDeltas, QIODevice::WriteOnly | QIODevice::Append);
+    write << type << privilegedId << nonprivilegedId;
+    ++m_deltaCount;
+}
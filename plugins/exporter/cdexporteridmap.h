@@ -0,0 +1,80 @@
+/** This file is part of Contacts daemon
+ **
+ ** Copyright (c) 2014 Jolla Ltd.
+ **
+ ** Contact: Matt Vogt <matthew.vogt@jollamobile.com>
+ **
+ ** GNU Lesser General Public License Usage
+ ** This file may be used under the terms of the GNU Lesser General Public License
+ ** version 2.1 as published by the Free Software Foundation and appearing in the
+ ** file LICENSE.LGPL included in the packaging of this file.  Please review the
+ ** following information to ensure the GNU Lesser General Public License version
+ ** 2.1 requirements will be met:
+ ** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+ **/
+
+#ifndef CDEXPORTERIDMAP_H
+#define CDEXPORTERIDMAP_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QMap>
+#include <QString>
+
+// Maps the internal IDs of privileged contacts to those of their exported copies.
+// The mapping is kept in memory across syncs; only the pairs added or removed
+// since the last store need to be written back. Those deltas are stored in bounded
+// segments, so that only the last segment is rewritten with each store.
+class CDExporterIdMap
+{
+public:
+    CDExporterIdMap();
+
+    bool isLoaded() const { return m_loaded; }
+    bool isEmpty() const { return m_nonprivilegedIds.isEmpty(); }
+
+    void load(const QByteArray &snapshot, const QList<QByteArray> &deltaSegments);
+    void loadLegacy(const QMap<QString, QString> &privilegedIds);
+    void invalidate();
+
+    quint32 privilegedId(quint32 nonprivilegedId) const { return m_privilegedIds.value(nonprivilegedId); }
+    quint32 nonprivilegedId(quint32 privilegedId) const { return m_nonprivilegedIds.value(privilegedId); }
+    QList<quint32> privilegedIds() const { return m_nonprivilegedIds.keys(); }
+
+    void registerPair(quint32 privilegedId, quint32 nonprivilegedId);
+    void deregisterPair(quint32 privilegedId, quint32 nonprivilegedId);
+
+    bool hasPendingChanges() const { return !m_pendingDeltas.isEmpty() || m_compactionRequired; }
+    bool compactionRequired() const { return m_compactionRequired; }
+    bool needsCompaction() const;
+
+    QByteArray snapshotData() const;
+
+    // The segment to store the pending deltas in, and its content including them
+    int deltaSegmentIndex() const { return m_closedSegments; }
+    QByteArray deltaSegmentData() const { return m_openSegment + m_pendingDeltas; }
+
+    // The number of segments holding stored deltas, which are superseded by a snapshot
+    int storedSegmentCount() const { return m_storedSegments; }
+
+    void committed(bool compacted);
+
+private:
+    enum DeltaType { AddPair = 1, RemovePair };
+
+    void apply(quint8 type, quint32 privilegedId, quint32 nonprivilegedId);
+    void appendDelta(quint8 type, quint32 privilegedId, quint32 nonprivilegedId);
+
+    QHash<quint32, quint32> m_privilegedIds;    // keyed by nonprivileged ID
+    QHash<quint32, quint32> m_nonprivilegedIds; // keyed by privileged ID
+    QByteArray m_openSegment;
+    QByteArray m_pendingDeltas;
+    int m_closedSegments;
+    int m_storedSegments;
+    int m_deltaCount;
+    bool m_compactionRequired;
+    bool m_loaded;
+};
+
+#endif // CDEXPORTERIDMAP_H
@@ -18,11 +18,17 @@ INCLUDEPATH += $$TOP_SOURCEDIR/src
 DEFINES += ENABLE_DEBUG
 
 HEADERS  = \
+    cdexporteravatarmanifest.h \
     cdexportercontroller.h \
+    cdexporterfingerprint.h \
+    cdexporteridmap.h \
     cdexporterplugin.h
 
 SOURCES  = \
+    cdexporteravatarmanifest.cpp \
     cdexportercontroller.cpp \
+    cdexporterfingerprint.cpp \
+    cdexporteridmap.cpp \
     cdexporterplugin.cpp
 
 TARGET = exporterplugin
@@ -0,0 +1,171 @@
+/** This file is part of Contacts daemon
+ **
+ ** Copyright (c) 2013 Jolla Ltd.
+ **
+ ** Contact: Matt Vogt <matthew.vogt@jollamobile.com>
+ **
+ ** GNU Lesser General Public License Usage
+ ** This file may be used under the terms of the GNU Lesser General Public License
+ ** version 2.1 as published by the Free Software Foundation and appearing in the
+ ** file LICENSE.LGPL included in the packaging of this file.  Please review the
+ ** following information to ensure the GNU Lesser General Public License version
+ ** 2.1 requirements will be met:
+ ** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+ **/
+
+#include "cdsimcontactwriter.h"
+#include "debug.h"
+
+#include <QContactDeactivated>
+#include <QContactPhoneNumber>
+
+#include <QElapsedTimer>
+
+using namespace Contactsd;
+
+namespace {
+
+QMap<QString, QString> contactManagerParameters()
+{
+    QMap<QString, QString> rv;
+    rv.insert(QStringLiteral("mergePresenceChanges"), QStringLiteral("false"));
+    return rv;
+}
+
+}
+
+CDSimContactWriter::CDSimContactWriter(QObject *parent)
+    : QObject(parent)
+    , m_manager(QStringLiteral("org.nemomobile.contacts.sqlite"), contactManagerParameters())
+{
+    m_flushTimer.setSingleShot(true);
+    m_flushTimer.setInterval(0);
+    connect(&m_flushTimer, SIGNAL(timeout()), this, SLOT(flush()));
+}
+
+CDSimContactWriter::~CDSimContactWriter()
+{
+}
+
+QContactManager &CDSimContactWriter::contactManager()
+{
+    return m_manager;
+}
+
+void CDSimContactWriter::submit(CDSimController *controller, const Batch &batch)
+{
+    if (m_pendingBatches.contains(controller)) {
+        Batch &pending(m_pendingBatches[controller]);
+        pending.saveContacts.append(batch.saveContacts);
+        pending.updateContacts.append(batch.updateContacts);
+        pending.reactivateIds.append(batch.reactivateIds);
+        pending.removeIds.append(batch.removeIds);
+    } else {
+        m_pendingControllers.append(controller);
+        m_pendingBatches.insert(controller, batch);
+    }
+
+    if (!m_flushTimer.isActive()) {
+        m_flushTimer.start();
+    }
+}
+
+void CDSimContactWriter::cancel(CDSimController *controller)
+{
+    m_pendingControllers.removeAll(controller);
+    m_pendingBatches.remove(controller);
+}
+
+// Only the deactivated state is written; the other details of these contacts are untouched
+bool CDSimContactWriter::setDeactivated(const QList<QContactId> &ids, bool deactivate)
+{
+    if (ids.isEmpty())
+        return true;
+
+    QList<QContact> contacts;
+    foreach (const QContactId &id, ids) {
+        QContact contact;
+        contact.setId(id);
+        if (deactivate) {
+            QContactDeactivated deactivated;
+            contact.saveDetail(&deactivated);
+        }
+        contacts.append(contact);
+    }
+
+    return m_manager.saveContacts(&contacts, QList<QContactDetail::DetailType>() << QContactDeactivated::Type);
+}
+
+void CDSimContactWriter::flush()
+{
+    if (m_pendingControllers.isEmpty())
+        return;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // Combine the batches of all controllers, so that each kind of change is written in one transaction
+    QList<QContact> saveContacts;
+    QList<QContact> updateContacts;
+    QList<QContactId> reactivateIds;
+    QList<QContactId> removeIds;
+    QList<int> saveOffsets;
+    foreach (CDSimController *controller, m_pendingControllers) {
+        const Batch &batch(m_pendingBatches[controller]);
+
+        saveOffsets.append(saveContacts.count());
+        saveContacts.append(batch.saveContacts);
+        updateContacts.append(batch.updateContacts);
+        reactivateIds.append(batch.reactivateIds);
+        removeIds.append(batch.removeIds);
+    }
+
+    const QList<CDSimController *> controllers(m_pendingControllers);
+    const QHash<CDSimController *, Batch> batches(m_pendingBatches);
+    m_pendingControllers.clear();
+    m_pendingBatches.clear();
+
+    // A failed write is rolled back entirely, so it fails every contributing controller
+    QSet<CDSimController *> failed;
+
+    if (!setDeactivated(reactivateIds, false)) {
+        qWarning() << "Error reactivating sim contacts";
+        foreach (CDSimController *controller, controllers) {
+            if (!batches[controller].reactivateIds.isEmpty())
+                failed.insert(controller);
+        }
+    }
+
+    if (!updateContacts.isEmpty()
+            && !m_manager.saveContacts(&updateContacts, QList<QContactDetail::DetailType>() << QContactPhoneNumber::Type)) {
+        qWarning() << "Error while updating imported sim contacts";
+        foreach (CDSimController *controller, controllers) {
+            if (!batches[controller].updateContacts.isEmpty())
+                failed.insert(controller);
+        }
+    }
+
+    if (!saveContacts.isEmpty() && !m_manager.saveContacts(&saveContacts)) {
+        qWarning() << "Error while saving imported sim contacts";
+        foreach (CDSimController *controller, controllers) {
+            if (!batches[controller].saveContacts.isEmpty())
+                failed.insert(controller);
+        }
+    }
+
+    if (!removeIds.isEmpty() && !m_manager.removeContacts(removeIds)) {
+        qWarning() << "Error while removing obsolete sim contacts";
+        foreach (CDSimController *controller, controllers) {
+            if (!batches[controller].removeIds.isEmpty())
+                failed.insert(controller);
+        }
+    }
+
+    qDebug() << "Wrote sim contacts for" << controllers.count() << "controllers in" << timer.elapsed() << "ms";
+
+    for (int i = 0; i < controllers.count(); ++i) {
+        CDSimController *controller(controllers.at(i));
+        const QList<QContact> savedContacts(saveContacts.mid(saveOffsets.at(i), batches[controller].saveContacts.count()));
+        emit batchWritten(controller, savedContacts, !failed.contains(controller));
+    }
+}
@@ -0,0 +1,67 @@
+/** This file is part of Contacts daemon
+ **
+ ** Copyright (c) 2013 Jolla Ltd.
+ **
+ ** Contact: Matt Vogt <matthew.vogt@jollamobile.com>
+ **
+ ** GNU Lesser General Public License Usage
+ ** This file may be used under the terms of the GNU Lesser General Public License
+ ** version 2.1 as published by the Free Software Foundation and appearing in the
+ ** file LICENSE.LGPL included in the packaging of this file.  Please review the
+ ** following information to ensure the GNU Lesser General Public License version
+ ** 2.1 requirements will be met:
+ ** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+ **/
+
+#ifndef CDSIMCONTACTWRITER_H
+#define CDSIMCONTACTWRITER_H
+
+#include <QtCore>
+
+#include <QContactManager>
+#include <QContact>
+
+#ifdef USING_QTPIM
+QTCONTACTS_USE_NAMESPACE
+#endif
+
+class CDSimController;
+
+// Writes the changes of every SIM controller to the database, batching the changes
+// submitted by each controller in the same event loop iteration into one write
+class CDSimContactWriter : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Batch {
+        QList<QContact> saveContacts;
+        QList<QContact> updateContacts;
+        QList<QContactId> reactivateIds;
+        QList<QContactId> removeIds;
+    };
+
+    explicit CDSimContactWriter(QObject *parent = 0);
+    ~CDSimContactWriter();
+
+    QContactManager &contactManager();
+
+    void submit(CDSimController *controller, const Batch &batch);
+    void cancel(CDSimController *controller);
+
+    bool setDeactivated(const QList<QContactId> &ids, bool deactivate);
+
+Q_SIGNALS:
+    void batchWritten(CDSimController *controller, const QList<QContact> &savedContacts, bool success);
+
+private Q_SLOTS:
+    void flush();
+
+private:
+    QContactManager m_manager;
+    QTimer m_flushTimer;
+    QList<CDSimController *> m_pendingControllers;
+    QHash<CDSimController *, Batch> m_pendingBatches;
+};
+
+#endif // CDSIMCONTACTWRITER_H
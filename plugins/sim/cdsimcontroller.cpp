@@ -14,11 +14,12 @@
  **/
 
 #include "cdsimcontroller.h"
+#include "cdsimcontactwriter.h"
 #include "cdsimplugin.h"
 #include "debug.h"
 
+#include <QContactChangeLogFilter>
 #include <QContactDetailFilter>
-#include <QContactDeactivated>
 #include <QContactNickname>
 #include <QContactPhoneNumber>
 #include <QContactSyncTarget>
@@ -26,26 +27,70 @@
 
 #include <QVersitContactImporter>
 
+#include <QCryptographicHash>
+#include <QElapsedTimer>
+
 using namespace Contactsd;
 
 namespace {
 
-QMap<QString, QString> contactManagerParameters()
+void appendKeyValues(QString *key, QList<int> values)
+{
+    qSort(values);
+
+    key->append(QChar::fromLatin1('|'));
+    foreach (int value, values) {
+        key->append(QString::number(value));
+        key->append(QChar::fromLatin1(','));
+    }
+}
+
+// Phone numbers are duplicates if their number, contexts and subtypes all match
+QString phoneNumberKey(const QContactPhoneNumber &phoneNumber)
+{
+    QString key(phoneNumber.number());
+    appendKeyValues(&key, phoneNumber.contexts());
+    appendKeyValues(&key, phoneNumber.subTypes());
+    return key;
+}
+
+// Hash the phonebook data in slices, rather than converting the entire phonebook at once
+QByteArray phonebookFingerprint(const QString &vcardData)
 {
-    QMap<QString, QString> rv;
-    rv.insert(QStringLiteral("mergePresenceChanges"), QStringLiteral("false"));
-    return rv;
+    const int sliceLength = 4096;
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    int offset = 0;
+    while (offset < vcardData.length()) {
+        int length = qMin(sliceLength, vcardData.length() - offset);
+        if (vcardData.at(offset + length - 1).isHighSurrogate() && (offset + length) < vcardData.length()) {
+            // Don't split a surrogate pair
+            ++length;
+        }
+        hash.addData(vcardData.mid(offset, length).toUtf8());
+        offset += length;
+    }
+    return hash.result().toHex();
 }
 
+const int simImportChunkSize = 50;
+
 }
 
-CDSimController::CDSimController(QObject *parent, const QString &syncTarget)
+CDSimController::CDSimController(QObject *parent, const QString &syncTarget, CDSimContactWriter *writer)
     : QObject(parent)
-    , m_manager(QStringLiteral("org.nemomobile.contacts.sqlite"), contactManagerParameters())
+    , m_writer(writer ? writer : new CDSimContactWriter(this))
+    , m_manager(m_writer->contactManager())
     , m_simPresent(false)
     , m_transientImport(true)
     , m_phonebookAvailable(false)
     , m_simSyncTarget(syncTarget)
+    , m_vcardOffset(0)
+    , m_importSucceeded(false)
+    , m_finishingImport(false)
+    , m_parseTime(0)
+    , m_diffTime(0)
+    , m_writeTime(0)
     , m_busy(false)
     , m_voicemailConf(0)
     , m_transientImportConf(QString::fromLatin1("/org/nemomobile/contacts/sim/transient_import"))
@@ -67,6 +112,9 @@ CDSimController::CDSimController(QObject *parent, const QString &syncTarget)
     connect(&m_contactReader, SIGNAL(stateChanged(QVersitReader::State)),
             this, SLOT(readerStateChanged(QVersitReader::State)));
 
+    connect(m_writer, SIGNAL(batchWritten(CDSimController *, const QList<QContact> &, bool)),
+            this, SLOT(batchWritten(CDSimController *, const QList<QContact> &, bool)));
+
     // Resync the contacts list whenever the phonebook availability changes
     connect(&m_modem, SIGNAL(interfacesChanged(const QStringList &)),
             this, SLOT(interfacesChanged(const QStringList &)));
@@ -92,6 +140,71 @@ QContactFilter CDSimController::deactivatedFilter() const
     return QContactStatusFlags::matchFlag(QContactStatusFlags::IsDeactivated, QContactFilter::MatchContains);
 }
 
+// The fingerprint of the phonebook last imported is stored for each sync target, modem and SIM card
+QString CDSimController::phonebookFingerprintKey() const
+{
+    QString modem(m_modemPath);
+    QString card(m_simManager.cardIdentifier());
+    if (card.isEmpty())
+        card = QString::fromLatin1("unknown");
+
+    QString key(QString::fromLatin1("/org/nemomobile/contacts/sim/phonebook_fingerprint/%1_%2_%3").arg(m_simSyncTarget).arg(modem).arg(card));
+    for (int i = QString::fromLatin1("/org/nemomobile/contacts/sim/phonebook_fingerprint/").length(); i < key.length(); ++i) {
+        const QChar c(key.at(i));
+        if (!c.isLetterOrNumber() && c != QChar::fromLatin1('_'))
+            key[i] = QChar::fromLatin1('_');
+    }
+    return key;
+}
+
+// Finds whether any SIM contact has been added, modified or removed since the given time.
+// Deactivated contacts can't be modified by others; deactivation itself is not a change.
+bool CDSimController::storedContactsChangedSince(const QDateTime &since) const
+{
+    QContactChangeLogFilter addedFilter;
+    addedFilter.setEventType(QContactChangeLogFilter::EventAdded);
+    addedFilter.setSince(since);
+
+    QContactChangeLogFilter changedFilter;
+    changedFilter.setEventType(QContactChangeLogFilter::EventChanged);
+    changedFilter.setSince(since);
+
+    QContactChangeLogFilter removedFilter;
+    removedFilter.setEventType(QContactChangeLogFilter::EventRemoved);
+    removedFilter.setSince(since);
+
+    // If the change log can't be read, the contacts must be assumed to have changed
+    const QList<QContactId> changedIds(m_manager.contactIds(simSyncTargetFilter() & (addedFilter | changedFilter)));
+    if (m_manager.error() != QContactManager::NoError || !changedIds.isEmpty())
+        return true;
+
+    const QList<QContactId> removedIds(m_manager.contactIds(simSyncTargetFilter() & removedFilter));
+    return m_manager.error() != QContactManager::NoError || !removedIds.isEmpty();
+}
+
+bool CDSimController::phonebookUnchanged(const QByteArray &fingerprint)
+{
+    const QStringList stored(MGConfItem(phonebookFingerprintKey()).value().toStringList());
+    if (stored.count() != 2 || stored.at(0) != QString::fromLatin1(fingerprint))
+        return false;
+
+    // The stored contacts must still be those imported from this phonebook
+    bool ok = false;
+    const qint64 storedTime(stored.at(1).toLongLong(&ok));
+    return ok && !storedContactsChangedSince(QDateTime::fromMSecsSinceEpoch(storedTime).toUTC());
+}
+
+// The fingerprint is stored with the time the SIM contacts were last written by this controller
+void CDSimController::storePhonebookFingerprint(const QByteArray &fingerprint)
+{
+    MGConfItem item(phonebookFingerprintKey());
+    if (fingerprint.isEmpty()) {
+        item.unset();
+    } else {
+        item.set(QStringList() << QString::fromLatin1(fingerprint) << QString::number(QDateTime::currentMSecsSinceEpoch()));
+    }
+}
+
 QContactManager &CDSimController::contactManager()
 {
     return m_manager;
@@ -135,16 +248,22 @@ void CDSimController::performTransientImport()
             qWarning() << "No modem path is configured";
         } else {
             // Read all contacts from the SIM
-            m_phonebook.setModemPath(m_modemPath);
-            m_phonebook.beginImport();
+            requestPhonebookData();
             setBusy(true);
         }
     } else {
+        abortSimImport();
         m_simContacts.clear();
         deactivateAllSimContacts();
     }
 }
 
+void CDSimController::requestPhonebookData()
+{
+    m_phonebook.setModemPath(m_modemPath);
+    m_phonebook.beginImport();
+}
+
 void CDSimController::transientImportConfigurationChanged()
 {
     bool importEnabled(true);
@@ -178,11 +297,34 @@ void CDSimController::interfacesChanged(const QStringList &interfaces)
 
 void CDSimController::vcardDataAvailable(const QString &vcardData)
 {
-    // Create contact records from the SIM VCard data
+    const QByteArray fingerprint(phonebookFingerprint(vcardData));
+
+    if (m_readerFingerprint.isEmpty() && phonebookUnchanged(fingerprint)) {
+        // This phonebook has already been imported; it only needs to be made visible again.
+        // Reactivation is not a change to the imported contacts, so the fingerprint is stored again
+        qDebug() << "SIM phonebook unchanged:" << m_modemPath;
+        storePhonebookFingerprint(reactivateAllSimContacts() ? fingerprint : QByteArray());
+        setBusy(false);
+        return;
+    }
+
+    abortSimImport();
+
+    // Create contact records from the SIM VCard data, a chunk at a time
     m_simContacts.clear();
-    m_contactReader.setData(vcardData.toUtf8());
-    m_contactReader.startReading();
+    m_readerFingerprint = fingerprint;
+    m_vcardData = vcardData;
+    m_vcardOffset = 0;
+    m_importTimer.start();
+    m_parseTime = m_diffTime = m_writeTime = 0;
+
+    // Indexing the stored contacts is accounted as part of the diff
+    m_phaseTimer.start();
+    beginSimImport();
+    m_diffTime += m_phaseTimer.elapsed();
     setBusy(true);
+
+    readNextVCardChunk();
 }
 
 void CDSimController::vcardReadFailed()
@@ -191,194 +333,191 @@ void CDSimController::vcardReadFailed()
     setBusy(false);
 }
 
+void CDSimController::readNextVCardChunk()
+{
+    if (m_readerFingerprint.isEmpty() || m_contactReader.state() == QVersitReader::ActiveState)
+        return;
+
+    // Find the end of the next chunk of cards
+    int end = m_vcardOffset;
+    for (int count = 0; count < simImportChunkSize && end < m_vcardData.length(); ++count) {
+        const int index = m_vcardData.indexOf(QString::fromLatin1("END:VCARD"), end, Qt::CaseInsensitive);
+        if (index == -1) {
+            end = m_vcardData.length();
+            break;
+        }
+
+        end = m_vcardData.indexOf(QChar::fromLatin1('\n'), index);
+        end = (end == -1) ? m_vcardData.length() : end + 1;
+    }
+
+    const QByteArray data(m_vcardData.mid(m_vcardOffset, end - m_vcardOffset).toUtf8());
+    m_vcardOffset = end;
+
+    m_phaseTimer.start();
+    m_contactReader.setData(data);
+    if (!m_contactReader.startReading()) {
+        qWarning() << "Unable to read VCard data from SIM:" << m_contactReader.error();
+        m_importSucceeded = false;
+        finishSimImport();
+    }
+}
+
 void CDSimController::readerStateChanged(QVersitReader::State state)
 {
-    if (state != QVersitReader::FinishedState)
+    if (state != QVersitReader::FinishedState || m_readerFingerprint.isEmpty())
         return;
 
-    QList<QVersitDocument> results = m_contactReader.results();
-    if (results.isEmpty()) {
-        qDebug() << "No contacts found in SIM";
-        m_simContacts.clear();
-        removeAllSimContacts();
-    } else {
+    const QList<QVersitDocument> results = m_contactReader.results();
+    if (!results.isEmpty()) {
         QVersitContactImporter importer;
         importer.importDocuments(results);
         m_simContacts = importer.contacts();
-        if (m_simContacts.isEmpty()) {
-            qDebug() << "No contacts imported from SIM data";
-            removeAllSimContacts();
-        } else {
-            // import or remove contacts from local storage as necessary.
-            ensureSimContactsPresent();
-        }
     }
+    m_parseTime += m_phaseTimer.elapsed();
 
-    setBusy(false);
+    // import contacts to local storage as necessary; the next chunk is read once they are written
+    importSimContacts();
 }
 
 void CDSimController::deactivateAllSimContacts()
 {
-    QList<QContactId> ids = m_manager.contactIds(simSyncTargetFilter());
-    if (ids.size()) {
-        QList<QContact> deactivatedContacts;
-
-        foreach (QContact contact, m_manager.contacts(ids)) {
-            QContactDeactivated deactivated;
-            contact.saveDetail(&deactivated);
-            deactivatedContacts.append(contact);
-        }
+    setSimContactsDeactivated(m_manager.contactIds(simSyncTargetFilter()), true);
+}
 
-        if (!m_manager.saveContacts(&deactivatedContacts)) {
-            qWarning() << "Error deactivating sim contacts";
-        }
-    }
+bool CDSimController::reactivateAllSimContacts()
+{
+    return setSimContactsDeactivated(m_manager.contactIds(simSyncTargetFilter() & deactivatedFilter()), false);
 }
 
-void CDSimController::removeAllSimContacts()
+bool CDSimController::setSimContactsDeactivated(const QList<QContactId> &ids, bool deactivate)
 {
-    QList<QContactId> doomedIds = m_manager.contactIds(simSyncTargetFilter());
-    if (doomedIds.size()) {
-        if (!m_manager.removeContacts(doomedIds)) {
-            qWarning() << "Error removing sim contacts from device storage";
-        }
+    QElapsedTimer timer;
+    timer.start();
+
+    if (!m_writer->setDeactivated(ids, deactivate)) {
+        qWarning() << "Error" << (deactivate ? "deactivating" : "reactivating") << "sim contacts";
+        return false;
     }
+
+    if (!ids.isEmpty())
+        qDebug() << (deactivate ? "Deactivated" : "Reactivated") << ids.count() << "sim contacts in" << timer.elapsed() << "ms";
+    return true;
 }
 
-void CDSimController::ensureSimContactsPresent()
+void CDSimController::beginSimImport()
 {
-    // Ensure all contacts from the SIM are present in the store
+    // Index all contacts previously imported from the SIM, including deactivated ones
     QContactFetchHint hint;
     hint.setDetailTypesHint(QList<QContactDetail::DetailType>() << QContactNickname::Type << QContactPhoneNumber::Type);
     hint.setOptimizationHints(QContactFetchHint::NoRelationships | QContactFetchHint::NoActionPreferences | QContactFetchHint::NoBinaryBlobs);
 
     QList<QContact> storedSimContacts = m_manager.contacts(simSyncTargetFilter(), QList<QContactSortOrder>(), hint);
+    const QList<QContact> deactivatedSimContacts = m_manager.contacts(simSyncTargetFilter() & deactivatedFilter(), QList<QContactSortOrder>(), hint);
+    storedSimContacts.append(deactivatedSimContacts);
 
-    // Also find any deactivated SIM contacts
-    storedSimContacts.append(m_manager.contacts(simSyncTargetFilter() & deactivatedFilter(), QList<QContactSortOrder>(), hint));
+    m_deactivatedSimIds.clear();
+    foreach (const QContact &contact, deactivatedSimContacts) {
+        m_deactivatedSimIds.insert(contact.id());
+    }
 
-    QMap<QString, QContact> existingContacts;
+    m_storedSimContacts.clear();
     foreach (const QContact &contact, storedSimContacts) {
         // Identify imported SIM contacts by their nickname record
         const QString nickname(contact.detail<QContactNickname>().nickname().trimmed());
-        existingContacts.insert(nickname, contact);
+        m_storedSimContacts.insert(nickname, contact);
     }
 
-    // coalesce SIM contacts with the same display label.
+    m_importedNumbers.clear();
+    m_importSucceeded = true;
+}
+
+// Ensures the contacts read in the current chunk are present in the store
+void CDSimController::importSimContacts()
+{
+    m_phaseTimer.start();
+
+    // coalesce SIM contacts with the same display label, removing any duplicate phone numbers.
     QList<QContact> coalescedSimContacts;
+    QList<QSet<QString> > coalescedPhoneNumberKeys;
+    QHash<QString, int> coalescedIndices;
     foreach (const QContact &simContact, m_simContacts) {
-        const QContactDisplayLabel &displayLabel = simContact.detail<QContactDisplayLabel>();
-        const QList<QContactPhoneNumber> &phoneNumbers = simContact.details<QContactPhoneNumber>();
-
-        // search for a pre-existing match in the coalesced list.
-        bool coalescedContactFound = false;
-        for (int i = 0; i < coalescedSimContacts.size(); ++i) {
-            QContact coalescedContact = coalescedSimContacts.at(i);
-            if (coalescedContact.detail<QContactDisplayLabel>().label().trimmed() == displayLabel.label().trimmed()) {
-                // found a match.  Coalesce the phone numbers and update the contact in the list.
-                QList<QContactPhoneNumber> coalescedPhoneNumbers = coalescedContact.details<QContactPhoneNumber>();
-                foreach (QContactPhoneNumber phn, phoneNumbers) {
-                    // check to see if the coalesced phone numbers list contains this number
-                    bool coalescedNumberFound = false;
-                    foreach (const QContactPhoneNumber &cphn, coalescedPhoneNumbers) {
-                        if (phn.number() == cphn.number()
-                                && phn.contexts() == cphn.contexts()
-                                && phn.subTypes() == cphn.subTypes()) {
-                            // already exists in the coalesced contact, no need to add it.
-                            coalescedNumberFound = true;
-                            break;
-                        }
-                    }
-
-                    // if not, add the number to the coalesced contact and to the coalesced list
-                    if (!coalescedNumberFound) {
-                        coalescedContact.saveDetail(&phn);
-                        coalescedPhoneNumbers.append(phn);
-                    }
+        const QString label(simContact.detail<QContactDisplayLabel>().label().trimmed());
+
+        QHash<QString, int>::const_iterator cit = coalescedIndices.constFind(label);
+        if (cit == coalescedIndices.constEnd()) {
+            // no match? add to list, without its duplicate numbers.
+            QContact coalescedContact(simContact);
+            QSet<QString> phoneNumberKeys;
+            foreach (QContactPhoneNumber phoneNumber, coalescedContact.details<QContactPhoneNumber>()) {
+                const QString key(phoneNumberKey(phoneNumber));
+                if (phoneNumberKeys.contains(key)) {
+                    coalescedContact.removeDetail(&phoneNumber);
+                } else {
+                    phoneNumberKeys.insert(key);
                 }
-                coalescedSimContacts.replace(i, coalescedContact);
-                coalescedContactFound = true;
-                break;
             }
+
+            coalescedIndices.insert(label, coalescedSimContacts.count());
+            coalescedSimContacts.append(coalescedContact);
+            coalescedPhoneNumberKeys.append(phoneNumberKeys);
+            continue;
         }
 
-        // no match? add to list.
-        if (!coalescedContactFound) {
-            coalescedSimContacts.append(simContact);
+        // found a match.  Coalesce the phone numbers not already present in the coalesced contact.
+        QContact &coalescedContact(coalescedSimContacts[*cit]);
+        QSet<QString> &phoneNumberKeys(coalescedPhoneNumberKeys[*cit]);
+        foreach (QContactPhoneNumber phoneNumber, simContact.details<QContactPhoneNumber>()) {
+            const QString key(phoneNumberKey(phoneNumber));
+            if (!phoneNumberKeys.contains(key)) {
+                coalescedContact.saveDetail(&phoneNumber);
+                phoneNumberKeys.insert(key);
+            }
         }
     }
 
-    QList<QContact> importContacts;
+    CDSimContactWriter::Batch batch;
     foreach (QContact simContact, coalescedSimContacts) {
         // SIM imports have their name in the display label
         QContactDisplayLabel displayLabel = simContact.detail<QContactDisplayLabel>();
 
-        // first, remove any duplicate phone number details from the sim contact
-        QList<QContactPhoneNumber> existingSimPhoneNumbers;
-        foreach (QContactPhoneNumber phoneNumber, simContact.details<QContactPhoneNumber>()) {
-            bool foundDuplicateNumber = false;
-            for (int i = 0; i < existingSimPhoneNumbers.size(); ++i) {
-                if (existingSimPhoneNumbers.at(i).number() == phoneNumber.number()
-                        && existingSimPhoneNumbers.at(i).contexts() == phoneNumber.contexts()
-                        && existingSimPhoneNumbers.at(i).subTypes() == phoneNumber.subTypes()) {
-                    // an exact duplicate of this number already exists in the sim contact.
-                    foundDuplicateNumber = true;
-                    simContact.removeDetail(&phoneNumber);
-                    break;
-                }
-            }
-
-            if (!foundDuplicateNumber) {
-                existingSimPhoneNumbers.append(phoneNumber);
-            }
+        // Numbers of a contact may be spread over several chunks; obsolete numbers are
+        // only removed once all of them have been read, in finishSimImport()
+        const QString label(displayLabel.label().trimmed());
+        QSet<QString> &importedNumbers(m_importedNumbers[label]);
+        foreach (const QContactPhoneNumber &phoneNumber, simContact.details<QContactPhoneNumber>()) {
+            importedNumbers.insert(phoneNumberKey(phoneNumber));
         }
 
         // then, determine whether this contact is already represented in the device phonebook
-        QMap<QString, QContact>::iterator it = existingContacts.find(displayLabel.label().trimmed());
-        if (it != existingContacts.end()) {
-            // Ensure this contact has the right phone numbers
+        QHash<QString, QContact>::iterator it = m_storedSimContacts.find(label);
+        if (it != m_storedSimContacts.end()) {
+            // Ensure this contact has all of the numbers read so far
             QContact &dbContact(*it);
 
-            QList<QContactPhoneNumber> existingNumbers(dbContact.details<QContactPhoneNumber>());
+            QSet<QString> existingNumbers;
+            foreach (const QContactPhoneNumber &phoneNumber, dbContact.details<QContactPhoneNumber>()) {
+                existingNumbers.insert(phoneNumberKey(phoneNumber));
+            }
+
             bool modified = false;
             foreach (QContactPhoneNumber phoneNumber, simContact.details<QContactPhoneNumber>()) {
-                bool foundExistingNumber = false;
-                for (int i = 0; i < existingNumbers.size(); ++i) {
-                    if (existingNumbers.at(i).number() == phoneNumber.number()
-                            && existingNumbers.at(i).contexts() == phoneNumber.contexts()
-                            && existingNumbers.at(i).subTypes() == phoneNumber.subTypes()) {
-                        // this number was not modified.  We don't need to change it.
-                        foundExistingNumber = true;
-                        existingNumbers.removeAt(i);
-                        break;
-                    }
-                }
-
-                if (!foundExistingNumber) {
-                    // this number is new, or modified.  We need to change it.
+                if (!existingNumbers.contains(phoneNumberKey(phoneNumber))) {
+                    // this number is new, or modified.  We need to add it.
                     dbContact.saveDetail(&phoneNumber);
                     modified = true;
                 }
             }
 
-            // Remove any obsolete numbers
-            foreach (QContactPhoneNumber phoneNumber, existingNumbers) {
-                dbContact.removeDetail(&phoneNumber);
-                modified = true;
-            }
-
             // Reactivate this contact if necessary
-            if (!dbContact.details<QContactDeactivated>().isEmpty()) {
-                QContactDeactivated deactivated = dbContact.detail<QContactDeactivated>();
-                dbContact.removeDetail(&deactivated);
-                modified = true;
+            if (m_deactivatedSimIds.remove(dbContact.id())) {
+                batch.reactivateIds.append(dbContact.id());
             }
 
             if (modified) {
-                // Add the modified contact to the import set
-                importContacts.append(dbContact);
+                // Add the modified contact to the update set
+                batch.updateContacts.append(dbContact);
             }
-            existingContacts.erase(it);
         } else {
             // We need to import this contact
 
@@ -393,28 +532,132 @@ void CDSimController::ensureSimContactsPresent()
             syncTarget.setSyncTarget(m_simSyncTarget);
             simContact.saveDetail(&syncTarget);
 
-            importContacts.append(simContact);
+            batch.saveContacts.append(simContact);
         }
     }
 
-    if (!importContacts.isEmpty()) {
-        // Import any contacts which were modified or are not currently present
-        if (!m_manager.saveContacts(&importContacts)) {
-            qWarning() << "Error while saving imported sim contacts";
-        }
+    m_simContacts.clear();
+
+    m_diffTime += m_phaseTimer.elapsed();
+    m_phaseTimer.start();
+    m_writer->submit(this, batch);
+}
+
+void CDSimController::batchWritten(CDSimController *controller, const QList<QContact> &savedContacts, bool success)
+{
+    if (controller != this || m_readerFingerprint.isEmpty())
+        return;
+
+    m_writeTime += m_phaseTimer.elapsed();
+
+    if (!success)
+        m_importSucceeded = false;
+
+    // Index the stored form of these contacts, for any further numbers in later chunks
+    foreach (const QContact &contact, savedContacts) {
+        m_storedSimContacts.insert(contact.detail<QContactNickname>().nickname().trimmed(), contact);
+    }
+
+    if (m_finishingImport) {
+        completeSimImport();
+    } else if (m_vcardOffset < m_vcardData.length()) {
+        readNextVCardChunk();
+    } else {
+        finishSimImport();
+    }
+}
+
+void CDSimController::abortSimImport()
+{
+    if (m_contactReader.state() == QVersitReader::ActiveState) {
+        m_contactReader.cancel();
+        m_contactReader.waitForFinished();
+    }
+
+    if (!m_readerFingerprint.isEmpty()) {
+        // The contacts imported so far remain; the next import will complete the diff
+        qDebug() << "SIM import aborted:" << m_modemPath;
+        m_writer->cancel(this);
+        storePhonebookFingerprint(QByteArray());
+        m_storedSimContacts.clear();
+        m_deactivatedSimIds.clear();
+        m_importedNumbers.clear();
+        m_vcardData.clear();
+        m_vcardOffset = 0;
+        m_finishingImport = false;
+        m_readerFingerprint.clear();
+    }
+}
+
+void CDSimController::finishSimImport()
+{
+    m_finishingImport = true;
+
+    if (!m_importSucceeded) {
+        // The contacts not yet read may still be on the SIM; leave the stored state for the next import
+        qWarning() << "SIM import incomplete, not removing obsolete contacts:" << m_modemPath;
+        completeSimImport();
+        return;
     }
 
-    if (!existingContacts.isEmpty()) {
-        // Remove any imported contacts no longer on the SIM
-        QList<QContactId> obsoleteIds;
-        foreach (const QContact &contact, existingContacts.values()) {
-            obsoleteIds.append(contact.id());
+    m_phaseTimer.start();
+
+    if (m_importedNumbers.isEmpty()) {
+        qDebug() << "No contacts imported from SIM data";
+    }
+
+    // Remove any imported contacts no longer on the SIM, and any numbers no longer on their SIM entry
+    CDSimContactWriter::Batch batch;
+    QHash<QString, QContact>::iterator it = m_storedSimContacts.begin(), end = m_storedSimContacts.end();
+    for ( ; it != end; ++it) {
+        QHash<QString, QSet<QString> >::const_iterator nit = m_importedNumbers.constFind(it.key());
+        if (nit == m_importedNumbers.constEnd()) {
+            batch.removeIds.append((*it).id());
+            continue;
         }
 
-        if (!m_manager.removeContacts(obsoleteIds)) {
-            qWarning() << "Error while removing obsolete sim contacts";
+        QContact &dbContact(*it);
+        QSet<QString> remainingNumbers(*nit);
+
+        bool modified = false;
+        foreach (QContactPhoneNumber phoneNumber, dbContact.details<QContactPhoneNumber>()) {
+            // Also drop any duplicates of a number still present
+            if (!remainingNumbers.remove(phoneNumberKey(phoneNumber))) {
+                dbContact.removeDetail(&phoneNumber);
+                modified = true;
+            }
+        }
+
+        if (modified) {
+            batch.updateContacts.append(dbContact);
         }
     }
+
+    m_diffTime += m_phaseTimer.elapsed();
+    m_phaseTimer.start();
+    m_writer->submit(this, batch);
+}
+
+void CDSimController::completeSimImport()
+{
+    QVariantMap phaseTimes;
+    phaseTimes.insert(QStringLiteral("parse"), m_parseTime);
+    phaseTimes.insert(QStringLiteral("diff"), m_diffTime);
+    phaseTimes.insert(QStringLiteral("write"), m_writeTime);
+    phaseTimes.insert(QStringLiteral("total"), m_importTimer.elapsed());
+    qDebug() << "SIM import completed:" << m_modemPath << phaseTimes;
+    emit importPhasesTimed(phaseTimes);
+
+    storePhonebookFingerprint(m_importSucceeded && !m_importedNumbers.isEmpty() ? m_readerFingerprint : QByteArray());
+
+    m_storedSimContacts.clear();
+    m_deactivatedSimIds.clear();
+    m_importedNumbers.clear();
+    m_vcardData.clear();
+    m_vcardOffset = 0;
+    m_finishingImport = false;
+    m_readerFingerprint.clear();
+    setBusy(false);
 }
 
 void CDSimController::voicemailConfigurationChanged()
@@ -424,7 +667,11 @@ void CDSimController::voicemailConfigurationChanged()
         return;
     }
 
-    const QString voicemailTarget(QString::fromLatin1("voicemail"));
+    // Each SIM has its own voicemail contact, named after its sync target
+    QString voicemailTarget(QString::fromLatin1("voicemail"));
+    if (m_simSyncTarget.startsWith(QLatin1String("sim"))) {
+        voicemailTarget.append(m_simSyncTarget.mid(3));
+    }
 
     QContactDetailFilter syncTargetFilter;
     syncTargetFilter.setDetailType(QContactSyncTarget::Type, QContactSyncTarget::FieldSyncTarget);
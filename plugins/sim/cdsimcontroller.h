@@ -38,12 +38,14 @@ QTVERSIT_USE_NAMESPACE
 #error "SIM plugin has not been ported to QtMobility Contacts/Versit"
 #endif
 
+class CDSimContactWriter;
+
 class CDSimController : public QObject
 {
     Q_OBJECT
 
 public:
-    explicit CDSimController(QObject *parent = 0, const QString &syncTarget = QString::fromLatin1("sim"));
+    explicit CDSimController(QObject *parent = 0, const QString &syncTarget = QString::fromLatin1("sim"), CDSimContactWriter *writer = 0);
     ~CDSimController();
 
     QContactManager &contactManager();
@@ -52,8 +54,11 @@ public:
 
     bool busy() const;
 
+    QString phonebookFingerprintKey() const;
+
 Q_SIGNALS:
     void busyChanged(bool);
+    void importPhasesTimed(const QVariantMap &phaseTimes);
 
 public Q_SLOTS:
     void simPresenceChanged(bool present);
@@ -64,19 +69,37 @@ public Q_SLOTS:
     void transientImportConfigurationChanged();
     void interfacesChanged(const QStringList &interfaces);
 
+private Q_SLOTS:
+    void batchWritten(CDSimController *controller, const QList<QContact> &savedContacts, bool success);
+
+protected:
+    // Requests the phonebook data, which is delivered to vcardDataAvailable()
+    virtual void requestPhonebookData();
+
 private:
     void setBusy(bool busy);
     void deactivateAllSimContacts();
-    void removeAllSimContacts();
-    void ensureSimContactsPresent();
+    bool reactivateAllSimContacts();
+    bool setSimContactsDeactivated(const QList<QContactId> &ids, bool deactivate);
+    void beginSimImport();
+    void readNextVCardChunk();
+    void importSimContacts();
+    void finishSimImport();
+    void completeSimImport();
+    void abortSimImport();
     void updateVoicemailConfiguration();
     void performTransientImport();
 
     QContactDetailFilter simSyncTargetFilter() const;
     QContactFilter deactivatedFilter() const;
 
+    bool storedContactsChangedSince(const QDateTime &since) const;
+    bool phonebookUnchanged(const QByteArray &fingerprint);
+    void storePhonebookFingerprint(const QByteArray &fingerprint);
+
 private:
-    QContactManager m_manager;
+    CDSimContactWriter *m_writer;
+    QContactManager &m_manager;
     QVersitReader m_contactReader;
 
     QOfonoSimManager m_simManager;
@@ -91,6 +114,19 @@ private:
     QOfonoMessageWaiting m_messageWaiting;
 
     QList<QContact> m_simContacts;
+    QByteArray m_readerFingerprint;
+    QString m_vcardData;
+    int m_vcardOffset;
+    QHash<QString, QContact> m_storedSimContacts;
+    QSet<QContactId> m_deactivatedSimIds;
+    QHash<QString, QSet<QString> > m_importedNumbers;
+    bool m_importSucceeded;
+    bool m_finishingImport;
+    QElapsedTimer m_importTimer;
+    QElapsedTimer m_phaseTimer;
+    qint64 m_parseTime;
+    qint64 m_diffTime;
+    qint64 m_writeTime;
     bool m_busy;
 
     MGConfItem *m_voicemailConf;
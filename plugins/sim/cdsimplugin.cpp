@@ -14,6 +14,7 @@
  **/
 
 #include "cdsimcontroller.h"
+#include "cdsimcontactwriter.h"
 #include "cdsimplugin.h"
 #include "debug.h"
 
@@ -21,8 +22,33 @@
 
 using namespace Contactsd;
 
+namespace {
+
+// Derived from the modem path alone, so that each modem keeps its contacts whatever
+// the order modems are reported in: the first modem keeps the original sync target,
+// and others are suffixed with their modem name, e.g. "sim-ril_1". A device with
+// only one modem always uses the original target, whatever its modem is named.
+QString simSyncTarget(const QString &modemPath, bool primary)
+{
+    const QString modemName(modemPath.mid(modemPath.lastIndexOf(QChar::fromLatin1('/')) + 1));
+
+    const int indexStart = modemName.lastIndexOf(QChar::fromLatin1('_')) + 1;
+    bool numbered = false;
+    const int index = indexStart > 0 ? modemName.mid(indexStart).toInt(&numbered) : 0;
+
+    QString syncTarget(QString::fromLatin1("sim"));
+    if (!primary || (numbered && index > 0)) {
+        syncTarget.append(QChar::fromLatin1('-'));
+        syncTarget.append(modemName);
+    }
+    return syncTarget;
+}
+
+}
+
 CDSimPlugin::CDSimPlugin()
-    : mController(0)
+    : mWriter(0)
+    , mOfonoManager(0)
 {
 }
 
@@ -34,16 +60,44 @@ void CDSimPlugin::init()
 {
     debug() << "Initializing contactsd sim plugin";
 
-    mController = new CDSimController(this);
+    // All controllers share one writer, so their imports don't contend for the database
+    mWriter = new CDSimContactWriter(this);
 
-    QOfonoManager ofonoManager;
-    const QStringList &modems(ofonoManager.modems());
+    mOfonoManager = new QOfonoManager(this);
+    connect(mOfonoManager, SIGNAL(modemAdded(QString)), this, SLOT(modemAdded(QString)));
+
+    const QStringList &modems(mOfonoManager->modems());
     if (modems.isEmpty()) {
         qWarning() << "No modem available for sim plugin";
-    } else {
-        // TODO: select the correct modem
-        mController->setModemPath(modems.first());
     }
+
+    foreach (const QString &modemPath, modems) {
+        addController(modemPath, modems.count() == 1);
+    }
+}
+
+void CDSimPlugin::modemAdded(const QString &modemPath)
+{
+    // A modem reported after startup keeps the original target only if no other modem uses it
+    addController(modemPath, mControllers.isEmpty());
+}
+
+void CDSimPlugin::addController(const QString &modemPath, bool onlyModem)
+{
+    if (mControllers.contains(modemPath))
+        return;
+
+    // Unnumbered modem names can't tell which one is first; only one of them keeps the original target
+    QString syncTarget(onlyModem ? QString::fromLatin1("sim") : simSyncTarget(modemPath, true));
+    if (mSyncTargets.contains(syncTarget)) {
+        syncTarget = simSyncTarget(modemPath, false);
+    }
+    mSyncTargets.insert(syncTarget);
+    debug() << "Using sync target" << syncTarget << "for modem" << modemPath;
+
+    CDSimController *controller = new CDSimController(this, syncTarget, mWriter);
+    controller->setModemPath(modemPath);
+    mControllers.insert(modemPath, controller);
 }
 
 CDSimPlugin::MetaData CDSimPlugin::metaData()
@@ -16,14 +16,18 @@
 #ifndef CDSIMPLUGIN_H
 #define CDSIMPLUGIN_H
 
+#include <QList>
 #include <QMap>
 #include <QObject>
+#include <QSet>
 #include <QString>
 #include <QVariant>
 
 #include "base-plugin.h"
 
 class CDSimController;
+class CDSimContactWriter;
+class QOfonoManager;
 
 class CDSimPlugin : public Contactsd::BasePlugin
 {
@@ -37,8 +41,16 @@ public:
     void init();
     MetaData metaData();
 
+private Q_SLOTS:
+    void modemAdded(const QString &modemPath);
+
 private:
-    CDSimController *mController;
+    void addController(const QString &modemPath, bool onlyModem);
+
+    CDSimContactWriter *mWriter;
+    QOfonoManager *mOfonoManager;
+    QMap<QString, CDSimController *> mControllers;
+    QSet<QString> mSyncTargets;
 };
 
 #endif // CDSIMPLUGIN_H
@@ -15,10 +15,12 @@ INCLUDEPATH += $$TOP_SOURCEDIR/src
 DEFINES += ENABLE_DEBUG
 
 HEADERS  = \
+    cdsimcontactwriter.h \
     cdsimcontroller.h \
     cdsimplugin.h
 
 SOURCES  = \
+    cdsimcontactwriter.cpp \
     cdsimcontroller.cpp \
     cdsimplugin.cpp
 
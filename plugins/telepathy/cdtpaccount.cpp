@@ -28,19 +28,24 @@
 #include <TelepathyQt/PendingVariant>
 #include <TelepathyQt/Profile>
 
+#include <QCryptographicHash>
+
 #include "cdtpaccount.h"
 #include "cdtpaccountcacheloader.h"
 #include "cdtpaccountcachewriter.h"
 #include "cdtpcontact.h"
+#include "cdtpextrainfoscheduler.h"
 #include "debug.h"
 
 static const int DisconnectGracePeriod = 30 * 1000; // ms
 
 using namespace Contactsd;
 
-CDTpAccount::CDTpAccount(const Tp::AccountPtr &account, const QStringList &toAvoid, bool newAccount, QObject *parent)
+CDTpAccount::CDTpAccount(const Tp::AccountPtr &account, CDTpExtraInfoScheduler *extraInfoScheduler,
+        const QStringList &toAvoid, bool newAccount, QObject *parent)
     : QObject(parent),
       mAccount(account),
+      mExtraInfoScheduler(extraInfoScheduler),
       mContactsToAvoid(toAvoid),
       mReady(false),
       mHasRoster(false),
@@ -220,6 +225,7 @@ void CDTpAccount::setConnection(const Tp::ConnectionPtr &connection)
     mContacts.clear();
     mHasRoster = false;
     mCurrentConnection = connection;
+    mExtraInfoScheduler->cancel(mAccount->objectPath());
 
     if (connection) {
         /* If the connection has no roster, no need to bother with sync signals */
@@ -412,14 +418,8 @@ CDTpContactPtr CDTpAccount::insertContact(const Tp::ContactPtr &contact)
 
 void CDTpAccount::maybeRequestExtraInfo(Tp::ContactPtr contact)
 {
-    if (!contact->isAvatarTokenKnown()) {
-        debug() << contact->id() << "first seen: request avatar";
-        contact->requestAvatarData();
-    }
-    if (!contact->isContactInfoKnown()) {
-        debug() << contact->id() << "first seen: refresh ContactInfo";
-        contact->refreshInfo();
-    }
+    // Requests are paced by the scheduler, to avoid flooding the CM and storage
+    mExtraInfoScheduler->enqueue(mAccount->objectPath(), contact);
 }
 
 void CDTpAccount::makeRosterCache()
@@ -441,6 +441,40 @@ QVariantMap CDTpAccount::storageInfo() const
     return mStorageInfo;
 }
 
+/* Hash of the persistent account properties that end up in storage, either on
+ * the self contact or on the QCOA of the account's contacts. If the hash did not
+ * change across a restart, the stored account details need no update. Presence
+ * and roster state are left out, as they are never the same right after startup. */
+QByteArray CDTpAccount::propertiesHash() const
+{
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+
+    stream << mAccount->isEnabled()
+           << mAccount->displayName()
+           << mAccount->nickname()
+           << mAccount->avatar().avatarData
+           << mAccount->iconName()
+           << mAccount->serviceName()
+           << mAccount->protocolName()
+           << mAccount->normalizedName()
+           << mStorageInfo.value(QLatin1String("providerDisplayName")).toString();
+
+    return QCryptographicHash::hash(data, QCryptographicHash::Sha1);
+}
+
+CDTpAccount::ReconciliationStamp CDTpAccount::takeReconciliationStamp()
+{
+    ReconciliationStamp stamp = mReconciliationStamp;
+    mReconciliationStamp = ReconciliationStamp();
+    return stamp;
+}
+
+void CDTpAccount::setReconciliationStamp(const ReconciliationStamp &stamp)
+{
+    mReconciliationStamp = stamp;
+}
+
 void CDTpAccount::onRequestedStorageSpecificInformation(Tp::PendingOperation *op)
 {
     if (!op->isValid()) {
@@ -24,6 +24,7 @@
 #ifndef CDTPACCOUNT_H
 #define CDTPACCOUNT_H
 
+#include <QDateTime>
 #include <QObject>
 
 #include <TelepathyQt/Account>
@@ -36,6 +37,8 @@
 #include "types.h"
 #include "cdtpcontact.h"
 
+class CDTpExtraInfoScheduler;
+
 class CDTpAccount : public QObject, public Tp::RefCounted
 {
     Q_OBJECT
@@ -52,7 +55,14 @@ public:
     };
     Q_DECLARE_FLAGS(Changes, Change)
 
+    struct ReconciliationStamp {
+        QByteArray propertiesHash;
+        QByteArray rosterFingerprint;
+        QDateTime watermark;
+    };
+
     CDTpAccount(const Tp::AccountPtr &account,
+            CDTpExtraInfoScheduler *extraInfoScheduler,
             const QStringList &contactsToAvoid = QStringList(),
             bool newAccount = false, QObject *parent = 0);
     ~CDTpAccount();
@@ -75,6 +85,11 @@ public:
 
     QVariantMap storageInfo() const;
 
+    QByteArray propertiesHash() const;
+    ReconciliationStamp reconciliationStamp() const { return mReconciliationStamp; }
+    ReconciliationStamp takeReconciliationStamp();
+    void setReconciliationStamp(const ReconciliationStamp &stamp);
+
 Q_SIGNALS:
     void changed(CDTpAccountPtr accountWrapper, CDTpAccount::Changes changes);
     void rosterChanged(CDTpAccountPtr accountWrapper);
@@ -113,10 +128,12 @@ private:
     Tp::AccountPtr mAccount;
     Tp::ConnectionPtr mCurrentConnection;
     Tp::Client::AccountInterfaceStorageInterface *mAccountStorage;
+    CDTpExtraInfoScheduler *mExtraInfoScheduler;
     QVariantMap mStorageInfo;
     QHash<QString, CDTpContactPtr> mContacts;
     QHash<QString, CDTpContact::Info> mRosterCache;
     QStringList mContactsToAvoid;
+    ReconciliationStamp mReconciliationStamp;
     QTimer mDisconnectTimeout;
     bool mReady;
     bool mHasRoster;
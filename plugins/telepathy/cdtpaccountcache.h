@@ -30,11 +30,25 @@
 #include "base-plugin.h"
 
 namespace CDTpAccountCache {
-    static int Version = 1;
+    static int Version = 2;
 
     static QString cacheFilePath(const CDTpAccount *account) {
         return Contactsd::BasePlugin::cacheDir().absoluteFilePath(account->account()->objectPath().replace(QLatin1Char('/'), QLatin1Char('_')));
     }
+
+    // QHash iteration order is not stable across runs, so hash in key order
+    static QByteArray rosterFingerprint(const QHash<QString, CDTpContact::Info> &cache) {
+        QStringList ids = cache.keys();
+        ids.sort();
+
+        QByteArray data;
+        QDataStream stream(&data, QIODevice::WriteOnly);
+        foreach (const QString &id, ids) {
+            stream << id << cache.value(id);
+        }
+
+        return QCryptographicHash::hash(data, QCryptographicHash::Sha1);
+    }
 }
 
 #endif // CDTPACCOUNTCACHE_H
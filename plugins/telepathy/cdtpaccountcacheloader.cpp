@@ -76,5 +76,21 @@ void CDTpAccountCacheLoader::run()
     mAccount->setRosterCache(cache);
 
     debug() << "Loaded" << cache.size() << "contacts from cache for account" << accountPath;
+
+    CDTpAccount::ReconciliationStamp stamp;
+    stream >> stamp.propertiesHash >> stamp.rosterFingerprint >> stamp.watermark;
+
+    if (stream.status() != QDataStream::Ok) {
+        debug() << "No reconciliation stamp in cache file" << cacheFile.fileName();
+        return;
+    }
+
+    // Only trust the stamp if it describes the roster we just loaded
+    if (stamp.rosterFingerprint != CDTpAccountCache::rosterFingerprint(cache)) {
+        warning() << "Roster fingerprint mismatch in cache file" << cacheFile.fileName();
+        return;
+    }
+
+    mAccount->setReconciliationStamp(stamp);
 }
 
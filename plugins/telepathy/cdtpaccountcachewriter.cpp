@@ -48,10 +48,12 @@ void CDTpAccountCacheWriter::run()
     const QString rosterFileName = CDTpAccountCache::cacheFilePath(mAccount);
     const QHash<QString, CDTpContact::Info> cache = mAccount->rosterCache();
 
-    if (cache.isEmpty()) {
-        QFile(rosterFileName).remove();
-        return;
-    }
+    // The file is written even for an empty roster, since the reconciliation
+    // stamp also lets offline and disabled accounts skip their restart sync
+    CDTpAccount::ReconciliationStamp stamp;
+    stamp.propertiesHash = mAccount->propertiesHash();
+    stamp.rosterFingerprint = CDTpAccountCache::rosterFingerprint(cache);
+    stamp.watermark = QDateTime::currentDateTimeUtc();
 
     QTemporaryFile tempFile(rosterFileName);
     tempFile.setAutoRemove(false);
@@ -71,6 +73,7 @@ void CDTpAccountCacheWriter::run()
     QDataStream stream(&buffer);
     stream << CDTpAccountCache::Version;
     stream << cache;
+    stream << stamp.propertiesHash << stamp.rosterFingerprint << stamp.watermark;
 
     buffer.close();
 
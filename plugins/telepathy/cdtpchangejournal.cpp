@@ -0,0 +1,415 @@
+/** This file is part of Contacts daemon
+ **
+ ** Copyright (c) 2010-2011 Nokia Corporation and/or its subsidiary(-ies).
+ **
+ ** Contact:  Nokia Corporation (info@qt.nokia.com)
+ **
+ ** GNU Lesser General Public License Usage
+ ** This file may be used under the terms of the GNU Lesser General Public License
+ ** version 2.1 as published by the Free Software Foundation and appearing in the
+ ** file LICENSE.LGPL included in the packaging of this file.  Please review the
+ ** following information to ensure the GNU Lesser General Public License version
+ ** 2.1 requirements will be met:
+ ** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+ **
+ ** In addition, as a special exception, Nokia gives you certain additional rights.
+ ** These rights are described in the Nokia Qt LGPL Exception version 1.1, included
+ ** in the file LGPL_EXCEPTION.txt in this package.
+ **
+ ** Other Usage
+ ** Alternatively, this file may be used in accordance with the terms and
+ ** conditions contained in a signed written agreement between you and Nokia.
+ **/
+
+#include "cdtpchangejournal.h"
+
+#include <QDataStream>
+#include <QSet>
+#include <QTemporaryFile>
+
+#include <debug.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+using namespace Contactsd;
+
+/* The journal starts with a header naming the session that writes it, followed
+ * by change and commit records. A clean shutdown removes the file, so finding it
+ * at startup means the previous run was killed with the listed changes pending.
+ *
+ * Stored and removed records list the contacts written since the last clean
+ * shutdown, which is when the accounts last wrote their reconciliation stamps.
+ * They are carried over by every run until the next clean shutdown.
+ *
+ * Records are flushed to the kernel as they are appended, which is enough to
+ * survive the daemon being killed; they are not synced to disk individually. */
+
+namespace {
+
+const quint32 JournalMagic = 0x43445450; // "CDTP"
+const qint32 JournalVersion = 2;
+
+// Compact the file once it holds this many more records than twice the live ones
+const int CompactionSlack = 256;
+
+}
+
+CDTpChangeJournal::CDTpChangeJournal()
+    : mSequence(0)
+    , mHeaderSize(0)
+    , mRecordCount(0)
+    , mRecovered(false)
+{
+}
+
+CDTpChangeJournal::~CDTpChangeJournal()
+{
+    close();
+}
+
+bool CDTpChangeJournal::open(const QString &fileName)
+{
+    mFile.setFileName(fileName);
+
+    if (mFile.exists()) {
+        load();
+    }
+
+    // Start this session's journal with the entries still pending from the last one
+    mSessionStart = QDateTime::currentDateTimeUtc();
+    rewrite();
+
+    if (!mFile.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        warning() << "Could not open change journal" << fileName << ":" << mFile.errorString();
+        return false;
+    }
+
+    return true;
+}
+
+void CDTpChangeJournal::close()
+{
+    if (!mFile.isOpen()) {
+        return;
+    }
+
+    mFile.close();
+
+    // The stored and removed records are only needed while the stamps are older
+    if (mContacts.isEmpty() && mAccounts.isEmpty()) {
+        mFile.remove();
+    } else {
+        // Keep the unstored changes for the next run
+        warning() << "Closing change journal with" << mContacts.count() << "contact and"
+                  << mAccounts.count() << "account changes pending";
+    }
+}
+
+QHash<QString, uint> CDTpChangeJournal::takeRecoveredContacts(const QString &accountPath)
+{
+    QHash<QString, uint> rv;
+
+    const QString addressPrefix(accountPath + QLatin1Char('!'));
+
+    QHash<QString, uint>::iterator it = mRecoveredContacts.begin();
+    while (it != mRecoveredContacts.end()) {
+        if (it.key().startsWith(addressPrefix)) {
+            rv.insert(it.key().mid(addressPrefix.length()), it.value());
+            it = mRecoveredContacts.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    return rv;
+}
+
+uint CDTpChangeJournal::takeRecoveredAccount(const QString &accountPath)
+{
+    return mRecoveredAccounts.take(accountPath);
+}
+
+/* Returns the changes stored for the account's contacts since the last clean
+ * shutdown, keyed by contact ID */
+QHash<QString, uint> CDTpChangeJournal::storedContacts(const QString &accountPath) const
+{
+    QHash<QString, uint> rv;
+
+    const QString addressPrefix(accountPath + QLatin1Char('!'));
+
+    QHash<QString, uint>::const_iterator it = mStored.constBegin(), end = mStored.constEnd();
+    for ( ; it != end; ++it) {
+        if (it.key().startsWith(addressPrefix)) {
+            rv.insert(it.key().mid(addressPrefix.length()), it.value());
+        }
+    }
+
+    return rv;
+}
+
+void CDTpChangeJournal::appendContact(const QString &address, uint changes)
+{
+    Entry &entry(mContacts[address]);
+    entry.changes |= changes;
+    entry.sequence = ++mSequence;
+
+    append(ContactChange, address, changes, entry.sequence);
+}
+
+void CDTpChangeJournal::appendAccount(const QString &accountPath, uint changes)
+{
+    Entry &entry(mAccounts[accountPath]);
+    entry.changes |= changes;
+    entry.sequence = ++mSequence;
+
+    append(AccountChange, accountPath, changes, entry.sequence);
+}
+
+/* Marks the given changes to a contact as stored, if they cover everything
+ * appended for it up to the sequence number of the stored batch */
+void CDTpChangeJournal::commitContact(const QString &address, uint changes, quint64 sequence)
+{
+    commit(ContactCommit, &mContacts, address, changes, sequence);
+}
+
+void CDTpChangeJournal::commitAccount(const QString &accountPath)
+{
+    commit(AccountCommit, &mAccounts, accountPath, ~0u, mSequence);
+}
+
+/* Records that changes are about to be written to the stored contact, so that
+ * they are not mistaken for external changes after a kill */
+void CDTpChangeJournal::recordStored(const QString &address, uint changes)
+{
+    QHash<QString, uint>::iterator it = mStored.find(address);
+    if (it == mStored.end()) {
+        it = mStored.insert(address, 0);
+    } else if ((*it | changes) == *it) {
+        return;
+    }
+
+    *it |= changes;
+    append(ContactStored, address, changes, mSequence);
+}
+
+void CDTpChangeJournal::recordRemoved(const QString &contactId)
+{
+    if (mRemoved.contains(contactId)) {
+        return;
+    }
+
+    mRemoved.insert(contactId);
+    append(ContactRemoved, contactId, 0, mSequence);
+}
+
+void CDTpChangeJournal::discardAccount(const QString &accountPath)
+{
+    const QString addressPrefix(accountPath + QLatin1Char('!'));
+
+    Q_FOREACH (const QString &address, mContacts.keys()) {
+        if (address.startsWith(addressPrefix)) {
+            commitContact(address, ~0u, mSequence);
+        }
+    }
+    commitAccount(accountPath);
+
+    takeRecoveredContacts(accountPath);
+    takeRecoveredAccount(accountPath);
+}
+
+void CDTpChangeJournal::discardOtherAccounts(const QStringList &accountPaths)
+{
+    QSet<QString> obsoletePaths;
+    Q_FOREACH (const QString &address, mContacts.keys()) {
+        obsoletePaths.insert(address.left(address.indexOf(QLatin1Char('!'))));
+    }
+    Q_FOREACH (const QString &accountPath, mAccounts.keys()) {
+        obsoletePaths.insert(accountPath);
+    }
+    obsoletePaths.subtract(accountPaths.toSet());
+
+    Q_FOREACH (const QString &accountPath, obsoletePaths) {
+        debug() << "Discarding journaled changes for obsolete account" << accountPath;
+        discardAccount(accountPath);
+    }
+}
+
+void CDTpChangeJournal::load()
+{
+    if (!mFile.open(QIODevice::ReadOnly)) {
+        warning() << "Could not read change journal" << mFile.fileName() << ":" << mFile.errorString();
+        return;
+    }
+
+    QDataStream stream(&mFile);
+
+    quint32 magic;
+    qint32 version;
+    QDateTime sessionStart;
+    stream >> magic >> version >> sessionStart;
+
+    // Version 1 journals lack the stored and removed records, but are otherwise the same
+    if (stream.status() != QDataStream::Ok || magic != JournalMagic || version < 1 || version > JournalVersion) {
+        warning() << "Ignoring unreadable change journal" << mFile.fileName();
+        mFile.close();
+        return;
+    }
+
+    int records = 0;
+    while (!stream.atEnd()) {
+        quint8 type;
+        QString key;
+        uint changes;
+        quint64 sequence;
+        stream >> type >> key >> changes >> sequence;
+
+        // A record torn by the kill ends the journal
+        if (stream.status() != QDataStream::Ok) {
+            break;
+        }
+
+        QHash<QString, Entry> *entries = (type == ContactChange || type == ContactCommit) ? &mContacts : &mAccounts;
+        if (type == ContactStored) {
+            mStored[key] |= changes;
+        } else if (type == ContactRemoved) {
+            mRemoved.insert(key);
+        } else if (type == ContactChange || type == AccountChange) {
+            Entry &entry((*entries)[key]);
+            entry.changes |= changes;
+            entry.sequence = sequence;
+        } else {
+            QHash<QString, Entry>::iterator it = entries->find(key);
+            if (it != entries->end() && it->sequence <= sequence) {
+                it->changes &= ~changes;
+                if (it->changes == 0) {
+                    entries->erase(it);
+                }
+            }
+        }
+
+        mSequence = qMax(mSequence, sequence);
+        ++records;
+    }
+
+    mFile.close();
+
+    mRecovered = true;
+
+    QHash<QString, Entry>::const_iterator it = mContacts.constBegin(), end = mContacts.constEnd();
+    for ( ; it != end; ++it) {
+        mRecoveredContacts.insert(it.key(), it->changes);
+    }
+    for (it = mAccounts.constBegin(), end = mAccounts.constEnd(); it != end; ++it) {
+        mRecoveredAccounts.insert(it.key(), it->changes);
+    }
+
+    debug() << "Recovered" << mContacts.count() << "contact and" << mAccounts.count()
+            << "account changes from" << records << "journal records of the session started"
+            << sessionStart << "-" << mStored.count() << "contacts stored and"
+            << mRemoved.count() << "removed since the last clean shutdown";
+}
+
+/* Replaces the file with one holding only the pending entries, and the stored
+ * and removed records */
+void CDTpChangeJournal::rewrite()
+{
+    const bool wasOpen = mFile.isOpen();
+    if (wasOpen) {
+        mFile.close();
+    }
+
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream << JournalMagic << JournalVersion << mSessionStart;
+    mHeaderSize = data.size();
+
+    QHash<QString, Entry>::const_iterator it = mContacts.constBegin(), end = mContacts.constEnd();
+    for ( ; it != end; ++it) {
+        stream << quint8(ContactChange) << it.key() << it->changes << it->sequence;
+    }
+    for (it = mAccounts.constBegin(), end = mAccounts.constEnd(); it != end; ++it) {
+        stream << quint8(AccountChange) << it.key() << it->changes << it->sequence;
+    }
+    QHash<QString, uint>::const_iterator sit = mStored.constBegin(), send = mStored.constEnd();
+    for ( ; sit != send; ++sit) {
+        stream << quint8(ContactStored) << sit.key() << sit.value() << mSequence;
+    }
+    Q_FOREACH (const QString &contactId, mRemoved) {
+        stream << quint8(ContactRemoved) << contactId << uint(0) << mSequence;
+    }
+
+    mRecordCount = liveRecordCount();
+
+    QTemporaryFile tempFile(mFile.fileName());
+    tempFile.setAutoRemove(false);
+
+    if (!tempFile.open() || tempFile.write(data) != data.size() || !tempFile.flush()) {
+        warning() << "Could not write change journal" << tempFile.fileName() << ":" << tempFile.errorString();
+        tempFile.setAutoRemove(true);
+    } else {
+        tempFile.close();
+        if (::rename(tempFile.fileName().toLocal8Bit(), mFile.fileName().toLocal8Bit()) != 0) {
+            warning() << "Could not replace change journal" << mFile.fileName() << ":" << strerror(errno);
+            tempFile.setAutoRemove(true);
+        }
+    }
+
+    if (wasOpen && !mFile.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        warning() << "Could not reopen change journal" << mFile.fileName() << ":" << mFile.errorString();
+    }
+}
+
+void CDTpChangeJournal::append(RecordType type, const QString &key, uint changes, quint64 sequence)
+{
+    if (!mFile.isOpen()) {
+        return;
+    }
+
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream << quint8(type) << key << changes << sequence;
+
+    if (mFile.write(data) != data.size() || !mFile.flush()) {
+        warning() << "Could not append to change journal" << mFile.fileName() << ":" << mFile.errorString();
+    }
+
+    ++mRecordCount;
+}
+
+void CDTpChangeJournal::commit(RecordType type, QHash<QString, Entry> *entries, const QString &key, uint changes, quint64 sequence)
+{
+    QHash<QString, Entry>::iterator it = entries->find(key);
+    if (it == entries->end() || it->sequence > sequence) {
+        return;
+    }
+
+    it->changes &= ~changes;
+    if (it->changes != 0) {
+        append(type, key, changes, sequence);
+        return;
+    }
+
+    entries->erase(it);
+
+    if (liveRecordCount() == 0) {
+        // Everything is stored; drop all records but the header
+        if (mFile.isOpen() && !mFile.resize(mHeaderSize)) {
+            warning() << "Could not truncate change journal" << mFile.fileName() << ":" << mFile.errorString();
+        }
+        mRecordCount = 0;
+    } else {
+        append(type, key, changes, sequence);
+
+        // The stored records may be many, so compact in proportion to them
+        if (mRecordCount > 2 * liveRecordCount() + CompactionSlack) {
+            rewrite();
+        }
+    }
+}
+
+int CDTpChangeJournal::liveRecordCount() const
+{
+    return mContacts.count() + mAccounts.count() + mStored.count() + mRemoved.count();
+}
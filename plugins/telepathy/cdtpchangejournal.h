@@ -0,0 +1,102 @@
+/** This file is part of Contacts daemon
+ **
+ ** Copyright (c) 2010-2011 Nokia Corporation and/or its subsidiary(-ies).
+ **
+ ** Contact:  Nokia Corporation (info@qt.nokia.com)
+ **
+ ** GNU Lesser General Public License Usage
+ ** This file may be used under the terms of the GNU Lesser General Public License
+ ** version 2.1 as published by the Free Software Foundation and appearing in the
+ ** file LICENSE.LGPL included in the packaging of this file.  Please review the
+ ** following information to ensure the GNU Lesser General Public License version
+ ** 2.1 requirements will be met:
+ ** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+ **
+ ** In addition, as a special exception, Nokia gives you certain additional rights.
+ ** These rights are described in the Nokia Qt LGPL Exception version 1.1, included
+ ** in the file LGPL_EXCEPTION.txt in this package.
+ **
+ ** Other Usage
+ ** Alternatively, this file may be used in accordance with the terms and
+ ** conditions contained in a signed written agreement between you and Nokia.
+ **/
+
+#ifndef CDTPCHANGEJOURNAL_H
+#define CDTPCHANGEJOURNAL_H
+
+#include <QDateTime>
+#include <QFile>
+#include <QHash>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+
+/* Append-only record of the contact and account changes which are queued but
+ * not yet stored, so that they can be replayed if the daemon is killed. It also
+ * records which contacts were stored or removed since the last clean shutdown,
+ * so that the next run can tell its own writes from external changes. */
+class CDTpChangeJournal
+{
+public:
+    CDTpChangeJournal();
+    ~CDTpChangeJournal();
+
+    bool open(const QString &fileName);
+    void close();
+
+    bool recovered() const { return mRecovered; }
+    QHash<QString, uint> takeRecoveredContacts(const QString &accountPath);
+    uint takeRecoveredAccount(const QString &accountPath);
+    QHash<QString, uint> storedContacts(const QString &accountPath) const;
+    QSet<QString> removedContacts() const { return mRemoved; }
+
+    quint64 sequence() const { return mSequence; }
+
+    void appendContact(const QString &address, uint changes);
+    void appendAccount(const QString &accountPath, uint changes);
+    void commitContact(const QString &address, uint changes, quint64 sequence);
+    void commitAccount(const QString &accountPath);
+    void recordStored(const QString &address, uint changes);
+    void recordRemoved(const QString &contactId);
+    void discardAccount(const QString &accountPath);
+    void discardOtherAccounts(const QStringList &accountPaths);
+
+private:
+    enum RecordType {
+        ContactChange = 1,
+        AccountChange,
+        ContactCommit,
+        AccountCommit,
+        ContactStored,
+        ContactRemoved
+    };
+
+    struct Entry {
+        Entry() : changes(0), sequence(0) {}
+
+        uint changes;
+        quint64 sequence;
+    };
+
+    void load();
+    void rewrite();
+    void append(RecordType type, const QString &key, uint changes, quint64 sequence);
+    void commit(RecordType type, QHash<QString, Entry> *entries, const QString &key, uint changes, quint64 sequence);
+    int liveRecordCount() const;
+
+private:
+    QFile mFile;
+    QDateTime mSessionStart;
+    QHash<QString, Entry> mContacts;
+    QHash<QString, Entry> mAccounts;
+    QHash<QString, uint> mStored;
+    QSet<QString> mRemoved;
+    QHash<QString, uint> mRecoveredContacts;
+    QHash<QString, uint> mRecoveredAccounts;
+    quint64 mSequence;
+    qint64 mHeaderSize;
+    int mRecordCount;
+    bool mRecovered;
+};
+
+#endif // CDTPCHANGEJOURNAL_H
@@ -33,6 +33,7 @@
 
 #include "buddymanagementadaptor.h"
 #include "cdtpcontroller.h"
+#include "cdtpextrainfoscheduler.h"
 #include "debug.h"
 
 using namespace Contactsd;
@@ -51,6 +52,12 @@ CDTpController::CDTpController(QObject *parent) : QObject(parent)
     connect(mStorage,
             SIGNAL(error(int, const QString &)),
             SIGNAL(error(int, const QString &)));
+    connect(mStorage,
+            SIGNAL(writeProgress(const QString &, int, int)),
+            SLOT(onWriteProgress(const QString &, int, int)));
+
+    mExtraInfoScheduler = new CDTpExtraInfoScheduler(mStorage, this);
+    connect(mExtraInfoScheduler, SIGNAL(importAlive()), SIGNAL(importAlive()));
 
     debug() << "Creating account manager";
     const QDBusConnection &bus = QDBusConnection::sessionBus();
@@ -85,6 +92,9 @@ CDTpController::CDTpController(QObject *parent) : QObject(parent)
 
 CDTpController::~CDTpController()
 {
+    // Stored contacts must match the roster caches written by the accounts
+    mStorage->flushQueuedUpdates();
+
     QDBusConnection::sessionBus().unregisterObject(DBusObjectPath);
     if (mOfflineRosterBuffer) {
         delete mOfflineRosterBuffer;
@@ -184,7 +194,7 @@ CDTpAccountPtr CDTpController::insertAccount(const Tp::AccountPtr &account, bool
     QStringList idsToRemove = mOfflineRosterBuffer->value(account->objectPath()).toStringList();
     mOfflineRosterBuffer->endGroup();
 
-    CDTpAccountPtr accountWrapper = CDTpAccountPtr(new CDTpAccount(account, idsToRemove, newAccount, this));
+    CDTpAccountPtr accountWrapper = CDTpAccountPtr(new CDTpAccount(account, mExtraInfoScheduler, idsToRemove, newAccount, this));
     mAccounts.insert(account->objectPath(), accountWrapper);
 
     maybeStartOfflineOperations(accountWrapper);
@@ -221,15 +231,29 @@ CDTpAccountPtr CDTpController::insertAccount(const Tp::AccountPtr &account, bool
 
 void CDTpController::onSyncStarted(Tp::AccountPtr account)
 {
+    // Throughput is measured from the writes of this import only
+    mStorage->beginAccountImport(account->objectPath());
     Q_EMIT importStarted(account->serviceName(), account->objectPath());
 }
 
 void CDTpController::onSyncEnded(Tp::AccountPtr account, int contactsAdded, int contactsRemoved)
 {
+    mStorage->endAccountImport(account->objectPath());
     Q_EMIT importEnded(account->serviceName(), account->objectPath(),
         contactsAdded, contactsRemoved, 0);
 }
 
+void CDTpController::onWriteProgress(const QString &accountPath, int contactsWritten, int queueDepth)
+{
+    CDTpAccountPtr accountWrapper = mAccounts.value(accountPath);
+    if (!accountWrapper) {
+        return;
+    }
+
+    Q_EMIT importProgress(accountWrapper->account()->serviceName(), accountPath,
+        contactsWritten, queueDepth);
+}
+
 void CDTpController::onRosterChanged(CDTpAccountPtr accountWrapper)
 {
     mStorage->syncAccountContacts(accountWrapper);
@@ -34,6 +34,7 @@
 #include <QObject>
 #include <QSettings>
 
+class CDTpExtraInfoScheduler;
 class PendingOfflineRemoval;
 
 class CDTpController : public QObject
@@ -48,6 +49,8 @@ Q_SIGNALS:
     void importStarted(const QString &service, const QString &account);
     void importEnded(const QString &service, const QString &account, int contactsAdded, int contactsRemoved, int contactsMerged);
     void error(int code, const QString &message);
+    void importAlive();
+    void importProgress(const QString &service, const QString &account, int contactsProcessed, int queueDepth);
 
 public Q_SLOTS:
     void inviteBuddies(const QString &accountPath, const QStringList &imIds);
@@ -61,6 +64,7 @@ private Q_SLOTS:
     void onAccountRemoved(const Tp::AccountPtr &account);
     void onSyncStarted(Tp::AccountPtr account);
     void onSyncEnded(Tp::AccountPtr account, int contactsAdded, int contactsRemoved);
+    void onWriteProgress(const QString &accountPath, int contactsWritten, int queueDepth);
     void onInvitationFinished(Tp::PendingOperation *op);
     void onRemovalFinished(Tp::PendingOperation *op);
 
@@ -74,6 +78,7 @@ private:
 
 private:
     CDTpStorage *mStorage;
+    CDTpExtraInfoScheduler *mExtraInfoScheduler;
     Tp::AccountManagerPtr mAM;
     Tp::AccountSetPtr mAccountSet;
     QHash<QString, CDTpAccountPtr> mAccounts;
@@ -0,0 +1,203 @@
+/** This file is part of Contacts daemon
+ **
+ ** Copyright (c) 2010-2011 Nokia Corporation and/or its subsidiary(-ies).
+ **
+ ** Contact:  Nokia Corporation (info@qt.nokia.com)
+ **
+ ** GNU Lesser General Public License Usage
+ ** This file may be used under the terms of the GNU Lesser General Public License
+ ** version 2.1 as published by the Free Software Foundation and appearing in the
+ ** file LICENSE.LGPL included in the packaging of this file.  Please review the
+ ** following information to ensure the GNU Lesser General Public License version
+ ** 2.1 requirements will be met:
+ ** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+ **
+ ** In addition, as a special exception, Nokia gives you certain additional rights.
+ ** These rights are described in the Nokia Qt LGPL Exception version 1.1, included
+ ** in the file LGPL_EXCEPTION.txt in this package.
+ **
+ ** Other Usage
+ ** Alternatively, this file may be used in accordance with the terms and
+ ** conditions contained in a signed written agreement between you and Nokia.
+ **/
+
+#include <TelepathyQt/Connection>
+#include <TelepathyQt/ContactManager>
+
+#include "cdtpextrainfoscheduler.h"
+#include "debug.h"
+
+using namespace Contactsd;
+
+// Token bucket pacing the avatar/ContactInfo requests sent to connection managers
+static const int BucketSize = 10;
+static const int RefillInterval = 200; // ms per token
+// Stop requesting while storage still has this many contact updates to write
+static const int MaximumQueuedUpdates = 50;
+// Minimum interval between import keep-alive notifications
+static const int AliveInterval = 5 * 1000; // ms
+// Requests looked up in storage in each tick
+static const int ClassifyBatchSize = 50;
+
+CDTpExtraInfoScheduler::CDTpExtraInfoScheduler(Storage *storage, QObject *parent)
+    : QObject(parent)
+    , mStorage(storage)
+    , mTokens(BucketSize)
+    , mDispatched(0)
+{
+    mTimer.setInterval(RefillInterval);
+    connect(&mTimer, SIGNAL(timeout()), SLOT(onTimeout()));
+
+    mAliveTimer.invalidate();
+}
+
+CDTpExtraInfoScheduler::~CDTpExtraInfoScheduler()
+{
+}
+
+/* Contacts which already have an avatar or contact information in storage (for
+ * example after an account was disabled and enabled again) are served after
+ * contacts we know nothing about yet. Which ones those are is looked up a batch
+ * at a time, as the requests are paced. */
+void CDTpExtraInfoScheduler::enqueue(const QString &accountPath, const Tp::ContactPtr &contact)
+{
+    if (contact->isAvatarTokenKnown() && contact->isContactInfoKnown()) {
+        return;
+    }
+
+    enqueueRequest(accountPath, contact->id(), contact);
+}
+
+void CDTpExtraInfoScheduler::enqueueRequest(const QString &accountPath, const QString &contactId, const Tp::ContactPtr &contact)
+{
+    Request request;
+    request.accountPath = accountPath;
+    request.contactId = contactId;
+    request.contact = contact;
+    mUnclassifiedQueue.enqueue(request);
+
+    if (not mTimer.isActive()) {
+        mTimer.start();
+    }
+}
+
+void CDTpExtraInfoScheduler::cancel(const QString &accountPath)
+{
+    QQueue<Request> *queues[] = { &mUnclassifiedQueue, &mUrgentQueue, &mDeferredQueue };
+
+    for (int i = 0; i < 3; ++i) {
+        QQueue<Request>::iterator it = queues[i]->begin();
+        while (it != queues[i]->end()) {
+            if (it->accountPath == accountPath) {
+                it = queues[i]->erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+}
+
+int CDTpExtraInfoScheduler::pendingCount() const
+{
+    return mUnclassifiedQueue.count() + mUrgentQueue.count() + mDeferredQueue.count();
+}
+
+void CDTpExtraInfoScheduler::onTimeout()
+{
+    if (mTokens < BucketSize) {
+        ++mTokens;
+    }
+
+    if (pendingCount() == 0) {
+        // Keep ticking until the bucket is full again, so a new burst can't exceed it
+        if (mTokens == BucketSize) {
+            mTimer.stop();
+            if (mDispatched > 0) {
+                debug() << "Extra info requested for" << mDispatched << "contacts";
+                mDispatched = 0;
+            }
+        }
+        return;
+    }
+
+    const int queuedUpdates = mStorage->queuedUpdateCount();
+    if (queuedUpdates >= MaximumQueuedUpdates) {
+        debug() << "Delaying extra info requests, storage has" << queuedUpdates << "queued updates";
+        return;
+    }
+
+    classifyRequests();
+
+    while (mTokens > 0) {
+        QQueue<Request> *queue = &mUrgentQueue;
+        if (queue->isEmpty()) {
+            // Deferred requests wait until no urgent one can be left unclassified
+            if (not mUnclassifiedQueue.isEmpty()) {
+                break;
+            }
+            queue = &mDeferredQueue;
+        }
+        if (queue->isEmpty()) {
+            break;
+        }
+
+        // Requests for contacts whose connection has gone cost no token
+        if (dispatch(queue->dequeue())) {
+            --mTokens;
+        }
+    }
+
+    if (not mAliveTimer.isValid() || mAliveTimer.elapsed() >= AliveInterval) {
+        debug() << "Extra info requests:" << mDispatched << "sent," << pendingCount() << "pending";
+        mAliveTimer.start();
+        Q_EMIT importAlive();
+    }
+}
+
+void CDTpExtraInfoScheduler::classifyRequests()
+{
+    QList<Request> requests;
+    QHash<QString, QStringList> accountContactIds;
+    while (requests.count() < ClassifyBatchSize && not mUnclassifiedQueue.isEmpty()) {
+        const Request request(mUnclassifiedQueue.dequeue());
+        accountContactIds[request.accountPath].append(request.contactId);
+        requests.append(request);
+    }
+
+    QHash<QString, QSet<QString> > storedInfo;
+    QHash<QString, QStringList>::const_iterator it = accountContactIds.constBegin(), end = accountContactIds.constEnd();
+    for ( ; it != end; ++it) {
+        storedInfo.insert(it.key(), mStorage->contactsWithStoredInfo(it.key(), it.value()));
+    }
+
+    Q_FOREACH (const Request &request, requests) {
+        if (storedInfo[request.accountPath].contains(request.contactId)) {
+            mDeferredQueue.enqueue(request);
+        } else {
+            mUrgentQueue.enqueue(request);
+        }
+    }
+}
+
+bool CDTpExtraInfoScheduler::dispatch(const Request &request)
+{
+    const Tp::ContactPtr &contact = request.contact;
+
+    // The connection may have gone away while the request was queued
+    const Tp::ConnectionPtr connection = contact->manager() ? contact->manager()->connection() : Tp::ConnectionPtr();
+    if (connection.isNull() || not connection->isValid()) {
+        return false;
+    }
+
+    if (!contact->isAvatarTokenKnown()) {
+        debug() << contact->id() << "first seen: request avatar";
+        contact->requestAvatarData();
+    }
+    if (!contact->isContactInfoKnown()) {
+        debug() << contact->id() << "first seen: refresh ContactInfo";
+        contact->refreshInfo();
+    }
+
+    ++mDispatched;
+    return true;
+}
@@ -0,0 +1,91 @@
+/** This file is part of Contacts daemon
+ **
+ ** Copyright (c) 2010-2011 Nokia Corporation and/or its subsidiary(-ies).
+ **
+ ** Contact:  Nokia Corporation (info@qt.nokia.com)
+ **
+ ** GNU Lesser General Public License Usage
+ ** This file may be used under the terms of the GNU Lesser General Public License
+ ** version 2.1 as published by the Free Software Foundation and appearing in the
+ ** file LICENSE.LGPL included in the packaging of this file.  Please review the
+ ** following information to ensure the GNU Lesser General Public License version
+ ** 2.1 requirements will be met:
+ ** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+ **
+ ** In addition, as a special exception, Nokia gives you certain additional rights.
+ ** These rights are described in the Nokia Qt LGPL Exception version 1.1, included
+ ** in the file LGPL_EXCEPTION.txt in this package.
+ **
+ ** Other Usage
+ ** Alternatively, this file may be used in accordance with the terms and
+ ** conditions contained in a signed written agreement between you and Nokia.
+ **/
+
+#ifndef CDTPEXTRAINFOSCHEDULER_H
+#define CDTPEXTRAINFOSCHEDULER_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QObject>
+#include <QQueue>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QTimer>
+
+#include <TelepathyQt/Contact>
+#include <TelepathyQt/Types>
+
+class CDTpExtraInfoScheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    // The storage state requests are paced and ordered by
+    class Storage
+    {
+    public:
+        virtual ~Storage() {}
+
+        virtual int queuedUpdateCount() const = 0;
+        virtual QSet<QString> contactsWithStoredInfo(const QString &accountPath, const QStringList &contactIds) = 0;
+    };
+
+    CDTpExtraInfoScheduler(Storage *storage, QObject *parent = 0);
+    ~CDTpExtraInfoScheduler();
+
+    void enqueue(const QString &accountPath, const Tp::ContactPtr &contact);
+    void cancel(const QString &accountPath);
+    int pendingCount() const;
+
+Q_SIGNALS:
+    void importAlive();
+
+protected Q_SLOTS:
+    void onTimeout();
+
+protected:
+    struct Request {
+        QString accountPath;
+        QString contactId;
+        Tp::ContactPtr contact;
+    };
+
+    void enqueueRequest(const QString &accountPath, const QString &contactId, const Tp::ContactPtr &contact);
+    virtual bool dispatch(const Request &request);
+
+private:
+    void classifyRequests();
+
+private:
+    Storage *mStorage;
+    QQueue<Request> mUnclassifiedQueue;
+    QQueue<Request> mUrgentQueue;
+    QQueue<Request> mDeferredQueue;
+    QTimer mTimer;
+    QElapsedTimer mAliveTimer;
+    int mTokens;
+    int mDispatched;
+};
+
+#endif // CDTPEXTRAINFOSCHEDULER_H
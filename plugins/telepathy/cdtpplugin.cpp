@@ -61,6 +61,12 @@ void CDTpPlugin::init()
     connect(mController,
             SIGNAL(error(int, const QString &)),
             SIGNAL(error(int, const QString &)));
+    connect(mController,
+            SIGNAL(importAlive()),
+            SIGNAL(importAlive()));
+    connect(mController,
+            SIGNAL(importProgress(const QString &, const QString &, int, int)),
+            SIGNAL(importProgress(const QString &, const QString &, int, int)));
 }
 
 CDTpPlugin::MetaData CDTpPlugin::metaData()
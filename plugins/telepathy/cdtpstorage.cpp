@@ -31,6 +31,7 @@
 
 #include <QContact>
 #include <QContactManager>
+#include <QContactChangeLogFilter>
 #include <QContactDetail>
 #include <QContactDetailFilter>
 #include <QContactIntersectionFilter>
@@ -188,6 +189,14 @@ namespace {
 const int UPDATE_TIMEOUT = 250; // ms
 const int UPDATE_MAXIMUM_TIMEOUT = 2000; // ms
 
+// Contacts written in one slice. Slices stay within the direct match limit of
+// findExistingContacts().
+const int WRITE_SLICE_SIZE = 10;
+// Contacts each account earns in a round of the write scheduler. Being less than
+// a full slice, an account writing full slices gets a turn every other round,
+// while one writing a few contacts at a time gets a turn every round.
+const int WRITE_QUANTUM = WRITE_SLICE_SIZE / 2;
+
 QContactManager *manager()
 {
     QMap<QString, QString> parameters;
@@ -475,8 +484,11 @@ void appendContactChange(CDTpStorage::ContactChangeSet *saveSet, const QContact
     }
 }
 
-void updateContacts(const QString &location, CDTpStorage::ContactChangeSet *saveSet, QList<ContactIdType> *removeList)
+/* Returns false if any of the contacts could not be stored or removed */
+bool updateContacts(const QString &location, CDTpStorage::ContactChangeSet *saveSet, QList<ContactIdType> *removeList)
 {
+    bool rv = true;
+
     if (saveSet && !saveSet->isEmpty()) {
         // Each element of the save set is a list of contacts with the same set of changes
         CDTpStorage::ContactChangeSet::iterator sit = saveSet->begin(), send = saveSet->end();
@@ -510,8 +522,11 @@ void updateContacts(const QString &location, CDTpStorage::ContactChangeSet *save
                             break;
                         }
 
+                        rv = false;
+
                         const int errorCount = errorMap.count();
                         if (!errorCount) {
+                            warning() << "Failed storing contact batch from:" << location << "error:" << manager()->error();
                             break;
                         }
 
@@ -540,10 +555,13 @@ void updateContacts(const QString &location, CDTpStorage::ContactChangeSet *save
         for ( ; it != end; ++it) {
             if (!manager()->removeContact(*it)) {
                 warning() << "Unable to remove contact";
+                rv = false;
             }
         }
         debug() << "Removed" << removeList->count() << "individual contacts - elapsed:" << t.elapsed();
     }
+
+    return rv;
 }
 
 QList<ContactIdType> findContactIdsForAccount(const QString &accountPath)
@@ -559,7 +577,7 @@ QHash<QString, QContact> findExistingContacts(const QStringList &contactAddresse
     QHash<QString, QContact> rv;
 
     // If there is a large number of contacts, do a two-step fetch
-    const int maxDirectMatches = 10;
+    const int maxDirectMatches = WRITE_SLICE_SIZE;
     if (contactAddresses.count() > maxDirectMatches) {
         QList<ContactIdType> ids;
         QSet<QString> addressSet(contactAddresses.toSet());
@@ -1799,17 +1817,82 @@ void addIconPath(QContactOnlineAccount &qcoa, Tp::AccountPtr account)
     }
 }
 
+/* Reports whether the stored state of the account is still what it was when the
+ * stamp restored from its cache file was written: same account properties, and no
+ * contact of the account touched since then. If so, only the roster delta against
+ * the cache needs to be written. Contacts stored or removed since the last clean
+ * shutdown are journaled; if a run was killed, they are replayed rather than counted
+ * as external changes, so a crash alone does not force the full reconciliation. */
+bool reconciliationStampMatches(const CDTpAccount::ReconciliationStamp &stamp, CDTpAccountPtr accountWrapper,
+                                const QHash<QString, uint> &storedContacts, const QSet<QString> &removedContacts)
+{
+    if (!stamp.watermark.isValid()) {
+        return false;
+    }
+
+    const QString accountPath(imAccount(accountWrapper));
+
+    if (stamp.propertiesHash != accountWrapper->propertiesHash()) {
+        debug() << "Account properties changed since last run:" << accountPath;
+        return false;
+    }
+
+    QContactChangeLogFilter changedFilter(QContactChangeLogFilter::EventChanged);
+    changedFilter.setSince(stamp.watermark);
+
+    QContactIntersectionFilter filter;
+    filter << QContactOriginMetadata::matchGroupId(accountPath);
+    filter << matchTelepathyFilter();
+    filter << changedFilter;
+
+    const QList<ContactIdType> changedIds(manager()->contactIds(filter));
+    if (!changedIds.isEmpty()) {
+        QContactFetchHint hint(contactFetchHint(DetailList() << detailType<QContactOriginMetadata>()));
+        foreach (const QContact &contact, manager()->contacts(changedIds, hint)) {
+            const QString address(stringValue(contact.detail<QContactOriginMetadata>(), QContactOriginMetadata::FieldId));
+            if (!storedContacts.contains(address.mid(accountPath.length() + 1))) {
+                debug() << "Account contacts modified since last run:" << accountPath;
+                return false;
+            }
+        }
+    }
+
+    // Removed contacts carry no details to match the account against, so any removal
+    // invalidates the stamps of all accounts. That is conservative: a false match only
+    // costs the full reconciliation, and contacts are seldom removed while we are down
+    QContactChangeLogFilter removedFilter(QContactChangeLogFilter::EventRemoved);
+    removedFilter.setSince(stamp.watermark);
+
+    foreach (const ContactIdType &contactId, manager()->contactIds(removedFilter)) {
+        if (!removedContacts.contains(asString(contactId))) {
+            debug() << "Contacts removed since last run, not trusting stamp for:" << accountPath;
+            return false;
+        }
+    }
+
+    return true;
+}
+
 } // namespace
 
 
 CDTpStorage::CDTpStorage(QObject *parent)
     : QObject(parent)
+    , mWriteScheduler(WRITE_QUANTUM)
 {
     mUpdateTimer.setInterval(UPDATE_TIMEOUT);
     mUpdateTimer.setSingleShot(true);
     connect(&mUpdateTimer, SIGNAL(timeout()), SLOT(onUpdateQueueTimeout()));
 
     mWaitTimer.invalidate();
+
+    mWriteTimer.setInterval(0);
+    mWriteTimer.setSingleShot(true);
+    connect(&mWriteTimer, SIGNAL(timeout()), SLOT(onWriteQueueTimeout()));
+
+    mWriteClock.start();
+
+    mJournal.open(CDTpPlugin::cacheFileName(QString::fromLatin1("pending-changes")));
 }
 
 CDTpStorage::~CDTpStorage()
@@ -1906,7 +1989,9 @@ void CDTpStorage::removeExistingAccount(QContact &self, QContactOnlineAccount &e
     const QString accountPath(stringValue(existing, QContactOnlineAccount__FieldAccountPath));
 
     // Remove any contacts derived from this account
-    if (!manager()->removeContacts(findContactIdsForAccount(accountPath))) {
+    const QList<ContactIdType> removeIds(findContactIdsForAccount(accountPath));
+    journalContactWrites(ContactChangeSet(), removeIds);
+    if (!manager()->removeContacts(removeIds)) {
         warning() << SRC_LOC << "Unable to remove linked contacts for account:" << accountPath << "error:" << manager()->error();
     }
 
@@ -2027,9 +2112,27 @@ void CDTpStorage::updateContactChanges(CDTpContactPtr contactWrapper, CDTpContac
     QContact existing = findExistingContact(imAddress(contactWrapper));
     updateContactChanges(contactWrapper, changes, existing, &saveSet, &removeList);
 
+    journalContactWrites(saveSet, removeList);
     updateContacts(SRC_LOC, &saveSet, &removeList);
 }
 
+/* Journals which contacts are about to be stored or removed, so that a run
+ * started after a kill can tell these writes from external changes */
+void CDTpStorage::journalContactWrites(const ContactChangeSet &saveSet, const QList<ContactIdType> &removeList)
+{
+    ContactChangeSet::const_iterator it = saveSet.constBegin(), end = saveSet.constEnd();
+    for ( ; it != end; ++it) {
+        foreach (const QContact &contact, it.value()) {
+            const QString address(stringValue(contact.detail<QContactOriginMetadata>(), QContactOriginMetadata::FieldId));
+            mJournal.recordStored(address, it.key());
+        }
+    }
+
+    foreach (const ContactIdType &contactId, removeList) {
+        mJournal.recordRemoved(asString(contactId));
+    }
+}
+
 void CDTpStorage::updateContactChanges(CDTpContactPtr contactWrapper, CDTpContact::Changes changes, QContact &existing, ContactChangeSet *saveSet, QList<ContactIdType> *removeList)
 {
     const QString accountPath(imAccount(contactWrapper));
@@ -2110,9 +2213,23 @@ void CDTpStorage::updateAccountChanges(QContact &self, QContactOnlineAccount &qc
             m_accountPendingChanges.insert(accountPath, changes);
             connect(accountWrapper.data(), SIGNAL(readyChanged()), SLOT(updateAccount()));
         }
+        mJournal.appendAccount(accountPath, changes);
         return;
     }
 
+    // On the restart sync, account properties which match the stamp need no update.
+    // The presence is not part of the stamp, so it is always brought up to date.
+    const CDTpAccount::ReconciliationStamp stamp(accountWrapper->reconciliationStamp());
+    if (changes == CDTpAccount::All && stamp.watermark.isValid()
+            && stamp.propertiesHash == accountWrapper->propertiesHash()) {
+        debug() << "Account" << accountPath << "unchanged since last run, updating presence only";
+        changes = CDTpAccount::Presence;
+    }
+
+    // Changes left unstored by a killed run are replayed along with the delta
+    const CDTpAccount::Changes recoveredChanges(mJournal.takeRecoveredAccount(accountPath));
+    changes |= recoveredChanges;
+
     debug() << "Synchronizing self account - account:" << accountPath << "address:" << accountAddress;
 
     QContactPresence presence(findPresenceForAccount(self, qcoa));
@@ -2126,7 +2243,29 @@ void CDTpStorage::updateAccountChanges(QContact &self, QContactOnlineAccount &qc
         warning() << SRC_LOC << "Unable to save self contact - error:" << manager()->error();
     }
 
+    mJournal.commitAccount(accountPath);
+
     if (account->isEnabled() && accountWrapper->hasRoster()) {
+        // The stamp describes the roster cache, so it is consumed by the first update
+        // which has a roster to compare; rosterless updates before that leave it alone
+        const QHash<QString, uint> storedContacts(mJournal.storedContacts(accountPath));
+        const bool deltaOnly = reconciliationStampMatches(accountWrapper->takeReconciliationStamp(), accountWrapper,
+                                                          storedContacts, mJournal.removedContacts());
+        QHash<QString, uint> recoveredContacts(mJournal.takeRecoveredContacts(accountPath));
+        if (deltaOnly) {
+            // What a killed run stored may differ from both the cache and the roster
+            QHash<QString, uint>::ConstIterator sit = storedContacts.constBegin(), send = storedContacts.constEnd();
+            for ( ; sit != send; ++sit) {
+                uint changes = sit.value();
+                if (changes & CDTpContact::Deleted) {
+                    changes = CDTpContact::All;
+                }
+                recoveredContacts[sit.key()] |= changes;
+            }
+
+            debug() << "Account" << accountPath << "roster unchanged since last run, reconciling delta only";
+        }
+
         QHash<QString, CDTpContact::Changes> allChanges;
 
         // Update all contacts reported in the roster changes of this account
@@ -2134,8 +2273,15 @@ void CDTpStorage::updateAccountChanges(QContact &self, QContactOnlineAccount &qc
         QHash<QString, CDTpContact::Changes>::ConstIterator it = rosterChanges.constBegin(),
                                                             end = rosterChanges.constEnd();
         for ( ; it != end; ++it) {
+            if (deltaOnly && it.value() == 0) {
+                continue;
+            }
+
             const QString address = imAddress(accountPath, it.key());
-            CDTpContact::Changes flags = it.value() | CDTpContact::Presence;
+            CDTpContact::Changes flags = deltaOnly ? it.value() : (it.value() | CDTpContact::Presence);
+            if (recoveredContacts.contains(it.key())) {
+                flags |= CDTpContact::Changes(recoveredContacts.value(it.key())) | CDTpContact::Presence;
+            }
 
             // If account display name changes, update QCOA of all contacts
             if (changes & CDTpAccount::DisplayName)
@@ -2145,38 +2291,28 @@ void CDTpStorage::updateAccountChanges(QContact &self, QContactOnlineAccount &qc
             allChanges.insert(address, flags);
         }
 
-        QList<CDTpContactPtr> tpContacts(accountContacts(accountWrapper));
-
-        QStringList contactAddresses;
-        foreach (const CDTpContactPtr &contactWrapper, tpContacts) {
-            const QString address = imAddress(accountPath, contactWrapper->contact()->id());
-            contactAddresses.append(address);
+        QHash<QString, uint>::ConstIterator rit = recoveredContacts.constBegin(), rend = recoveredContacts.constEnd();
+        for ( ; rit != rend; ++rit) {
+            const QString address = imAddress(accountPath, rit.key());
+            if (!allChanges.contains(address)) {
+                allChanges.insert(address, CDTpContact::Changes(rit.value()) | CDTpContact::Presence);
+            }
         }
 
-        // Retrieve the existing contacts in a single batch
-        QHash<QString, QContact> existingContacts = findExistingContacts(contactAddresses);
-
-        ContactChangeSet saveSet;
-        QList<ContactIdType> removeList;
-
-        foreach (const CDTpContactPtr &contactWrapper, tpContacts) {
+        ContactUpdateList updates;
+        foreach (const CDTpContactPtr &contactWrapper, accountContacts(accountWrapper)) {
             const QString address = imAddress(accountPath, contactWrapper->contact()->id());
 
             QHash<QString, CDTpContact::Changes>::Iterator cit = allChanges.find(address);
             if (cit == allChanges.end()) {
-                warning() << SRC_LOC << "No changes found for contact:" << address;
+                if (!deltaOnly) {
+                    warning() << SRC_LOC << "No changes found for contact:" << address;
+                }
                 continue;
             }
 
             CDTpContact::Changes changes = *cit;
 
-            QHash<QString, QContact>::Iterator existing = existingContacts.find(address);
-            if (existing == existingContacts.end()) {
-                warning() << SRC_LOC << "No contact found for address:" << address;
-                existing = existingContacts.insert(address, QContact());
-                changes |= CDTpContact::All;
-            }
-
             // If we got a contact without avatar in the roster, and the original
             // had an avatar, then ignore the avatar update (some contact managers
             // send the initial roster with the avatar missing)
@@ -2188,71 +2324,27 @@ void CDTpStorage::updateAccountChanges(QContact &self, QContactOnlineAccount &qc
                 }
             }
 
-            updateContactChanges(contactWrapper, changes, *existing, &saveSet, &removeList);
+            updates.append(qMakePair(contactWrapper, changes));
         }
 
-        updateContacts(SRC_LOC, &saveSet, &removeList);
+        queueContactUpdates(accountPath, updates);
     } else {
-        ContactChangeSet saveSet;
-
-        const QContactPresence::PresenceState newState(qContactPresenceState(Tp::ConnectionPresenceTypeUnknown));
-        const QStringList newCapabilities(currentCapabilites(account->capabilities(), Tp::ConnectionPresenceTypeUnknown, account));
-
-        // Set presence to unknown for all contacts of this account
-        QContactFetchHint hint(contactFetchHint(DetailList() << detailType<QContactPresence>()
-                                                             << detailType<QContactOnlineAccount>()
-                                                             << detailType<QContactOriginMetadata>()));
-        foreach (QContact existing, manager()->contacts(findContactIdsForAccount(accountPath), hint)) {
-            const QContactId &contactId(existing.id());
-
-            CDTpContact::Changes changes;
-
-            QContactPresence presence = existing.detail<QContactPresence>();
-
-            if (presence.presenceState() != newState) {
-                presence.setPresenceState(newState);
-                presence.setTimestamp(QDateTime::currentDateTime());
-
-                if (!storeContactDetail(existing, presence, SRC_LOC)) {
-                    warning() << SRC_LOC << "Unable to save unknown presence to contact for:" << contactId;
-                }
-
-                changes |= CDTpContact::Presence;
-            }
-
-            // Also reset the capabilities
-            QContactOnlineAccount qcoa = existing.detail<QContactOnlineAccount>();
-
-            if (qcoa.capabilities() != newCapabilities || onlineAccountEnabled(qcoa)) {
-                qcoa.setCapabilities(newCapabilities);
-                qcoa.setValue(QContactOnlineAccount__FieldEnabled, asString(false));
-
-                if (!storeContactDetail(existing, qcoa, SRC_LOC)) {
-                    warning() << SRC_LOC << "Unable to save capabilities to contact for:" << contactId;
-                }
-
-                changes |= CDTpContact::Capabilities;
-            }
-
-            if (!account->isEnabled()) {
-                // Mark the contact as un-enabled also
-                QContactOriginMetadata metadata = existing.detail<QContactOriginMetadata>();
-
-                if (metadata.enabled()) {
-                    metadata.setEnabled(false);
-
-                    if (!storeContactDetail(existing, metadata, SRC_LOC)) {
-                        warning() << SRC_LOC << "Unable to un-enable contact for:" << contactId;
-                    }
+        const QHash<QString, uint> storedContacts(mJournal.storedContacts(accountPath));
+        const bool deltaOnly = reconciliationStampMatches(stamp, accountWrapper,
+                                                          storedContacts, mJournal.removedContacts());
+        const QHash<QString, uint> recoveredContacts(mJournal.takeRecoveredContacts(accountPath));
 
-                    changes |= CDTpContact::Capabilities;
-                }
-            }
-
-            appendContactChange(&saveSet, existing, changes);
+        // Without a roster, the recovered contact changes can't be applied
+        QHash<QString, uint>::ConstIterator rit = recoveredContacts.constBegin(), rend = recoveredContacts.constEnd();
+        for ( ; rit != rend; ++rit) {
+            mJournal.commitContact(imAddress(accountPath, rit.key()), rit.value(), mJournal.sequence());
         }
 
-        updateContacts(SRC_LOC, &saveSet, 0);
+        // A killed run may have stored presences which are not in the roster cache
+        if (!deltaOnly || !storedContacts.isEmpty()) {
+            // Set presence to unknown for all contacts of this account
+            queueOfflineContacts(accountWrapper);
+        }
     }
 }
 
@@ -2299,6 +2391,9 @@ void CDTpStorage::syncAccounts(const QList<CDTpAccountPtr> &accounts)
         }
     }
 
+    // Recovered changes for accounts which no longer exist can't be replayed
+    mJournal.discardOtherAccounts(accountPaths);
+
     // Add any previously unknown accounts
     for (int i = 0; i < accounts.length(); ++i) {
         if (!existingIndices.contains(i)) {
@@ -2333,34 +2428,13 @@ void CDTpStorage::createAccount(CDTpAccountPtr accountWrapper)
     // Add any previously unknown accounts
     addNewAccount(self, accountWrapper);
 
-    QList<CDTpContactPtr> tpContacts(accountContacts(accountWrapper));
-
-    QStringList contactAddresses;
-    foreach (const CDTpContactPtr &contactWrapper, tpContacts) {
-        const QString address = imAddress(accountPath, contactWrapper->contact()->id());
-        contactAddresses.append(address);
-    }
-
-    // Retrieve the existing contacts in a single batch
-    QHash<QString, QContact> existingContacts = findExistingContacts(contactAddresses);
-
-    ContactChangeSet saveSet;
-    QList<ContactIdType> removeList;
-
     // Add any contacts already present for this account
-    foreach (const CDTpContactPtr &contactWrapper, tpContacts) {
-        const QString address = imAddress(accountPath, contactWrapper->contact()->id());
-
-        QHash<QString, QContact>::Iterator existing = existingContacts.find(address);
-        if (existing == existingContacts.end()) {
-            warning() << SRC_LOC << "No contact found for address:" << address;
-            existing = existingContacts.insert(address, QContact());
-        }
-
-        updateContactChanges(contactWrapper, CDTpContact::All, *existing, &saveSet, &removeList);
+    ContactUpdateList updates;
+    foreach (const CDTpContactPtr &contactWrapper, accountContacts(accountWrapper)) {
+        updates.append(qMakePair(contactWrapper, CDTpContact::Changes(CDTpContact::All)));
     }
 
-    updateContacts(SRC_LOC, &saveSet, &removeList);
+    queueContactUpdates(accountPath, updates);
 }
 
 void CDTpStorage::updateAccount(CDTpAccountPtr accountWrapper, CDTpAccount::Changes changes)
@@ -2389,6 +2463,10 @@ void CDTpStorage::updateAccount(CDTpAccountPtr accountWrapper, CDTpAccount::Chan
 void CDTpStorage::removeAccount(CDTpAccountPtr accountWrapper)
 {
     cancelQueuedUpdates(accountContacts(accountWrapper));
+    cancelQueuedWrites(imAccount(accountWrapper));
+    mJournal.discardAccount(imAccount(accountWrapper));
+    mContactsWritten.remove(imAccount(accountWrapper));
+    mWriteStats.remove(imAccount(accountWrapper));
 
     QContact self(selfContact());
     if (self.isEmpty()) {
@@ -2447,7 +2525,7 @@ void CDTpStorage::syncAccountContacts(CDTpAccountPtr accountWrapper, const QList
     QList<CDTpContactPtr> addedContacts(contactsAdded.toSet().toList());
     QList<CDTpContactPtr> removedContacts(contactsRemoved.toSet().toList());
 
-    QSet<QString> contactAddresses;
+    ContactUpdateList updates;
     foreach (const CDTpContactPtr &contactWrapper, addedContacts) {
         // This contact must be for the specified account
         if (imAccount(contactWrapper) != accountPath) {
@@ -2455,8 +2533,7 @@ void CDTpStorage::syncAccountContacts(CDTpAccountPtr accountWrapper, const QList
             continue;
         }
 
-        const QString address = imAddress(accountPath, contactWrapper->contact()->id());
-        contactAddresses.insert(address);
+        updates.append(qMakePair(contactWrapper, CDTpContact::Changes(CDTpContact::Information)));
     }
     foreach (const CDTpContactPtr &contactWrapper, removedContacts) {
         if (imAccount(contactWrapper) != accountPath) {
@@ -2464,43 +2541,10 @@ void CDTpStorage::syncAccountContacts(CDTpAccountPtr accountWrapper, const QList
             continue;
         }
 
-        const QString address = imAddress(accountPath, contactWrapper->contact()->id());
-        contactAddresses.insert(address);
+        updates.append(qMakePair(contactWrapper, CDTpContact::Changes(CDTpContact::Deleted)));
     }
 
-    // Retrieve the existing contacts in a single batch
-    QHash<QString, QContact> existingContacts = findExistingContacts(contactAddresses);
-
-    ContactChangeSet saveSet;
-    QList<ContactIdType> removeList;
-
-    foreach (const CDTpContactPtr &contactWrapper, addedContacts) {
-        const QString address = imAddress(accountPath, contactWrapper->contact()->id());
-
-        CDTpContact::Changes changes = CDTpContact::Information;
-
-        QHash<QString, QContact>::Iterator existing = existingContacts.find(address);
-        if (existing == existingContacts.end()) {
-            warning() << SRC_LOC << "No contact found for address:" << address;
-            existing = existingContacts.insert(address, QContact());
-            changes |= CDTpContact::All;
-        }
-
-        updateContactChanges(contactWrapper, changes, *existing, &saveSet, &removeList);
-    }
-    foreach (const CDTpContactPtr &contactWrapper, removedContacts) {
-        const QString address = imAddress(accountPath, contactWrapper->contact()->id());
-
-        QHash<QString, QContact>::Iterator existing = existingContacts.find(address);
-        if (existing == existingContacts.end()) {
-            warning() << SRC_LOC << "No contact found for address:" << address;
-            continue;
-        }
-
-        updateContactChanges(contactWrapper, CDTpContact::Deleted, *existing, &saveSet, &removeList);
-    }
-
-    updateContacts(SRC_LOC, &saveSet, &removeList);
+    queueContactUpdates(accountPath, updates);
 }
 
 void CDTpStorage::createAccountContacts(CDTpAccountPtr accountWrapper, const QStringList &imIds, uint localId)
@@ -2522,6 +2566,7 @@ void CDTpStorage::createAccountContacts(CDTpAccountPtr accountWrapper, const QSt
         }
     }
 
+    journalContactWrites(saveSet, QList<ContactIdType>());
     updateContacts(SRC_LOC, &saveSet, 0);
 }
 
@@ -2532,6 +2577,9 @@ void CDTpStorage::removeAccountContacts(CDTpAccountPtr accountWrapper, const QSt
 
     qWarning() << "CDTpStorage: removeAccountContacts:" << accountPath << contactIds.count();
 
+    // Queued writes must not recreate the contacts after their removal
+    cancelQueuedWrites(accountPath, contactIds);
+
     QStringList imAddressList;
     foreach (const QString &id, contactIds) {
         imAddressList.append(imAddress(accountPath, id));
@@ -2548,14 +2596,74 @@ void CDTpStorage::removeAccountContacts(CDTpAccountPtr accountWrapper, const QSt
         }
     }
 
+    foreach (const QString &address, imAddressList) {
+        mJournal.recordStored(address, CDTpContact::Deleted);
+    }
+    journalContactWrites(ContactChangeSet(), removeIds);
     if (!manager()->removeContacts(removeIds)) {
         warning() << SRC_LOC << "Unable to remove contacts for account:" << accountPath << "error:" << manager()->error();
     }
+
+    foreach (const QString &address, imAddressList) {
+        mJournal.commitContact(address, ~0u, mJournal.sequence());
+    }
+}
+
+/* Returns which of the given contacts of the account already have an avatar or
+ * contact information stored */
+QSet<QString> CDTpStorage::contactsWithStoredInfo(const QString &accountPath, const QStringList &contactIds)
+{
+    QSet<QString> rv;
+
+    const QString addressPrefix(accountPath + QLatin1Char('!'));
+
+    QContactFetchHint hint(contactFetchHint(DetailList() << detailType<QContactOriginMetadata>()
+                                                         << detailType<QContactAvatar>()
+                                                         << detailType<QContactAddress>()
+                                                         << detailType<QContactBirthday>()
+                                                         << detailType<QContactEmailAddress>()
+                                                         << detailType<QContactNote>()
+                                                         << detailType<QContactOrganization>()
+                                                         << detailType<QContactPhoneNumber>()
+                                                         << detailType<QContactUrl>()));
+
+    // Only the requested contacts are fetched, a few at a time
+    for (int i = 0; i < contactIds.count(); i += WRITE_SLICE_SIZE) {
+        QContactUnionFilter addressFilter;
+        foreach (const QString &contactId, contactIds.mid(i, WRITE_SLICE_SIZE)) {
+            addressFilter << QContactOriginMetadata::matchId(imAddress(accountPath, contactId));
+        }
+
+        QContactIntersectionFilter filter;
+        filter << matchTelepathyFilter();
+        filter << addressFilter;
+
+        foreach (const QContact &existing, manager()->contacts(filter, QList<QContactSortOrder>(), hint)) {
+            if (existing.details<QContactAvatar>().isEmpty()
+             && existing.details<QContactAddress>().isEmpty()
+             && existing.details<QContactBirthday>().isEmpty()
+             && existing.details<QContactEmailAddress>().isEmpty()
+             && existing.details<QContactNote>().isEmpty()
+             && existing.details<QContactOrganization>().isEmpty()
+             && existing.details<QContactPhoneNumber>().isEmpty()
+             && existing.details<QContactUrl>().isEmpty()) {
+                continue;
+            }
+
+            const QString address(existing.detail<QContactOriginMetadata>().id());
+            if (address.startsWith(addressPrefix)) {
+                rv.insert(address.mid(addressPrefix.length()));
+            }
+        }
+    }
+
+    return rv;
 }
 
 void CDTpStorage::updateContact(CDTpContactPtr contactWrapper, CDTpContact::Changes changes)
 {
     mUpdateQueue[contactWrapper] |= changes;
+    mJournal.appendContact(imAddress(contactWrapper), changes);
 
     // Only update IM contacts after not receiving an update notification for the defined period
     // Also use an upper limit to keep latency within acceptable bounds.
@@ -2577,59 +2685,316 @@ void CDTpStorage::onUpdateQueueTimeout()
 
     debug() << "Update" << mUpdateQueue.count() << "contacts";
 
-    QHash<CDTpContactPtr, CDTpContact::Changes> updates;
-    QSet<QString> contactAddresses;
+    // Updates are written through the queue of their account, so that they
+    // are not held up by bulk writes of other accounts
+    QMap<QString, ContactUpdateList> accountUpdates;
 
     QHash<CDTpContactPtr, CDTpContact::Changes>::const_iterator it = mUpdateQueue.constBegin(), end = mUpdateQueue.constEnd();
     for ( ; it != end; ++it) {
         CDTpContactPtr contactWrapper = it.key();
 
-        // If there are multiple entries for a contact, coalesce the changes
-        updates[contactWrapper] |= it.value();
-        contactAddresses.insert(imAddress(contactWrapper));
+        // Skip the contact in case its account was deleted before this function
+        // was invoked
+        if (contactWrapper->accountWrapper().isNull()) {
+            continue;
+        }
+        if (!contactWrapper->isVisible()) {
+            mJournal.commitContact(imAddress(contactWrapper), it.value(), mJournal.sequence());
+            continue;
+        }
+
+        accountUpdates[imAccount(contactWrapper)].append(qMakePair(contactWrapper, it.value()));
     }
 
     mUpdateQueue.clear();
 
+    QMap<QString, ContactUpdateList>::const_iterator ait = accountUpdates.constBegin(), aend = accountUpdates.constEnd();
+    for ( ; ait != aend; ++ait) {
+        queueContactUpdates(ait.key(), ait.value());
+    }
+}
+
+void CDTpStorage::flushQueuedUpdates()
+{
+    if (!mUpdateQueue.isEmpty()) {
+        mUpdateTimer.stop();
+        onUpdateQueueTimeout();
+    }
+
+    while (!mWriteScheduler.isEmpty()) {
+        onWriteQueueTimeout();
+    }
+    mWriteTimer.stop();
+}
+
+/* Counts the contacts waiting to be written, whether coalescing in the update
+ * queue or already scheduled in an account's write queue */
+int CDTpStorage::queuedUpdateCount() const
+{
+    return mUpdateQueue.count() + mWriteScheduler.depth();
+}
+
+void CDTpStorage::cancelQueuedUpdates(const QList<CDTpContactPtr> &contacts)
+{
+    foreach (const CDTpContactPtr &contactWrapper, contacts) {
+        mUpdateQueue.remove(contactWrapper);
+    }
+}
+
+void CDTpStorage::queueContactUpdates(const QString &accountPath, const ContactUpdateList &updates)
+{
+    for (int i = 0; i < updates.count(); i += WRITE_SLICE_SIZE) {
+        WriteSlice slice;
+        slice.updates = updates.mid(i, WRITE_SLICE_SIZE);
+        enqueueWriteSlice(accountPath, slice);
+    }
+}
+
+void CDTpStorage::queueOfflineContacts(CDTpAccountPtr accountWrapper)
+{
+    const QString accountPath(imAccount(accountWrapper));
+    const QList<ContactIdType> contactIds(findContactIdsForAccount(accountPath));
+
+    for (int i = 0; i < contactIds.count(); i += WRITE_SLICE_SIZE) {
+        WriteSlice slice;
+        slice.offlineAccount = accountWrapper;
+        slice.offlineContactIds = contactIds.mid(i, WRITE_SLICE_SIZE);
+        enqueueWriteSlice(accountPath, slice);
+    }
+}
+
+void CDTpStorage::enqueueWriteSlice(const QString &accountPath, WriteSlice &slice)
+{
+    slice.queuedAt = mWriteClock.elapsed();
+    slice.journalSequence = mJournal.sequence();
+
+    mWriteScheduler.enqueue(accountPath, slice);
+
+    if (!mWriteTimer.isActive()) {
+        mWriteTimer.start();
+    }
+}
+
+void CDTpStorage::cancelQueuedWrites(const QString &accountPath, const QStringList &contactIds)
+{
+    if (contactIds.isEmpty()) {
+        mWriteScheduler.remove(accountPath);
+        return;
+    }
+
+    QQueue<WriteSlice> *slices = mWriteScheduler.slices(accountPath);
+    if (!slices) {
+        return;
+    }
+
+    QQueue<WriteSlice>::iterator sit = slices->begin(), send = slices->end();
+    for ( ; sit != send; ++sit) {
+        ContactUpdateList::iterator uit = sit->updates.begin();
+        while (uit != sit->updates.end()) {
+            if (contactIds.contains(uit->first->contact()->id())) {
+                uit = sit->updates.erase(uit);
+            } else {
+                ++uit;
+            }
+        }
+    }
+}
+
+/* Writes are scheduled by deficit round robin over the accounts' queues (see
+ * CDTpWriteScheduler). Returning to the event loop between rounds lets new
+ * updates from other accounts join the rotation, so a bulk import can't hold
+ * back the presence updates of a small account. */
+void CDTpStorage::onWriteQueueTimeout()
+{
+    typedef CDTpWriteScheduler<WriteSlice>::ScheduledSlice ScheduledSlice;
+
+    QStringList accountPaths;
+    foreach (const ScheduledSlice &scheduled, mWriteScheduler.takeRound()) {
+        writeSlice(scheduled.first, scheduled.second);
+        if (!accountPaths.contains(scheduled.first)) {
+            accountPaths.append(scheduled.first);
+        }
+    }
+
+    foreach (const QString &accountPath, accountPaths) {
+        if (mWriteScheduler.contains(accountPath)) {
+            continue;
+        }
+
+        const WriteQueueStats stats(mWriteStats.value(accountPath));
+        debug() << "Write queue drained for account" << accountPath << "-"
+                << stats.contactsWritten << "contacts in" << stats.slicesWritten << "slices,"
+                << "queue latency average:" << stats.averageLatency()
+                << "ms maximum:" << stats.maxLatency << "ms";
+    }
+
+    if (!mWriteScheduler.isEmpty()) {
+        mWriteTimer.start();
+    }
+}
+
+void CDTpStorage::writeSlice(const QString &accountPath, const WriteSlice &slice)
+{
+    const qint64 latency = mWriteClock.elapsed() - slice.queuedAt;
+    WriteQueueStats &stats(mWriteStats[accountPath]);
+    stats.slicesWritten += 1;
+    stats.contactsWritten += slice.cost();
+    stats.totalLatency += latency;
+    stats.maxLatency = qMax(stats.maxLatency, latency);
+
+#ifdef DEBUG_OVERLOAD
+    debug() << "Writing" << slice.cost() << "contacts for account" << accountPath << "queued for" << latency << "ms";
+#endif
+
+    if (slice.offlineAccount) {
+        writeOfflineContacts(slice);
+    } else {
+        writeContactUpdates(slice);
+    }
+
+    const int queueDepth = mWriteScheduler.depth(accountPath);
+
+    // Progress is only reported for the writes of an import
+    QHash<QString, int>::iterator wit = mContactsWritten.find(accountPath);
+    if (wit != mContactsWritten.end()) {
+        *wit += slice.cost();
+        Q_EMIT writeProgress(accountPath, *wit, queueDepth);
+    }
+}
+
+void CDTpStorage::beginAccountImport(const QString &accountPath)
+{
+    mContactsWritten.insert(accountPath, 0);
+}
+
+void CDTpStorage::endAccountImport(const QString &accountPath)
+{
+    mContactsWritten.remove(accountPath);
+}
+
+void CDTpStorage::writeContactUpdates(const WriteSlice &slice)
+{
+    QStringList contactAddresses;
+    foreach (const ContactUpdate &update, slice.updates) {
+        if (!update.first->accountWrapper().isNull()) {
+            contactAddresses.append(imAddress(update.first));
+        }
+    }
+
     // Retrieve the existing contacts in a single batch
     QHash<QString, QContact> existingContacts = findExistingContacts(contactAddresses);
 
     ContactChangeSet saveSet;
     QList<ContactIdType> removeList;
 
-    for (it = updates.constBegin(), end = updates.constEnd(); it != end; ++it) {
-        CDTpContactPtr contactWrapper = it.key();
+    foreach (const ContactUpdate &update, slice.updates) {
+        CDTpContactPtr contactWrapper = update.first;
 
-        // Skip the contact in case its account was deleted before this function
-        // was invoked
+        // Skip the contact in case its account was deleted since the update was queued
         if (contactWrapper->accountWrapper().isNull()) {
             continue;
         }
-        if (!contactWrapper->isVisible()) {
-            continue;
-        }
 
         const QString address(imAddress(contactWrapper));
-        CDTpContact::Changes changes = it.value();
+        CDTpContact::Changes changes = update.second;
 
         QHash<QString, QContact>::Iterator existing = existingContacts.find(address);
         if (existing == existingContacts.end()) {
             warning() << SRC_LOC << "No contact found for address:" << address;
+            if (changes & CDTpContact::Deleted) {
+                continue;
+            }
             existing = existingContacts.insert(address, QContact());
             changes |= CDTpContact::All;
         }
 
         updateContactChanges(contactWrapper, changes, *existing, &saveSet, &removeList);
+
+        // A removal carries no details to journal the address from
+        if (changes & CDTpContact::Deleted) {
+            mJournal.recordStored(address, CDTpContact::Deleted);
+        }
     }
 
-    updateContacts(SRC_LOC, &saveSet, &removeList);
+    journalContactWrites(saveSet, removeList);
+
+    // Leave the changes journaled on failure, so that they are replayed on the next start
+    if (!updateContacts(SRC_LOC, &saveSet, &removeList)) {
+        warning() << SRC_LOC << "Not all contact updates could be stored, keeping them journaled";
+        return;
+    }
+
+    foreach (const ContactUpdate &update, slice.updates) {
+        if (!update.first->accountWrapper().isNull()) {
+            mJournal.commitContact(imAddress(update.first), update.second, slice.journalSequence);
+        }
+    }
 }
 
-void CDTpStorage::cancelQueuedUpdates(const QList<CDTpContactPtr> &contacts)
+void CDTpStorage::writeOfflineContacts(const WriteSlice &slice)
 {
-    foreach (const CDTpContactPtr &contactWrapper, contacts) {
-        mUpdateQueue.remove(contactWrapper);
+    Tp::AccountPtr account = slice.offlineAccount->account();
+
+    ContactChangeSet saveSet;
+
+    const QContactPresence::PresenceState newState(qContactPresenceState(Tp::ConnectionPresenceTypeUnknown));
+    const QStringList newCapabilities(currentCapabilites(account->capabilities(), Tp::ConnectionPresenceTypeUnknown, account));
+
+    QContactFetchHint hint(contactFetchHint(DetailList() << detailType<QContactPresence>()
+                                                         << detailType<QContactOnlineAccount>()
+                                                         << detailType<QContactOriginMetadata>()));
+    foreach (QContact existing, manager()->contacts(slice.offlineContactIds, hint)) {
+        const QContactId &contactId(existing.id());
+
+        CDTpContact::Changes changes;
+
+        QContactPresence presence = existing.detail<QContactPresence>();
+
+        if (presence.presenceState() != newState) {
+            presence.setPresenceState(newState);
+            presence.setTimestamp(QDateTime::currentDateTime());
+
+            if (!storeContactDetail(existing, presence, SRC_LOC)) {
+                warning() << SRC_LOC << "Unable to save unknown presence to contact for:" << contactId;
+            }
+
+            changes |= CDTpContact::Presence;
+        }
+
+        // Also reset the capabilities
+        QContactOnlineAccount qcoa = existing.detail<QContactOnlineAccount>();
+
+        if (qcoa.capabilities() != newCapabilities || onlineAccountEnabled(qcoa)) {
+            qcoa.setCapabilities(newCapabilities);
+            qcoa.setValue(QContactOnlineAccount__FieldEnabled, asString(false));
+
+            if (!storeContactDetail(existing, qcoa, SRC_LOC)) {
+                warning() << SRC_LOC << "Unable to save capabilities to contact for:" << contactId;
+            }
+
+            changes |= CDTpContact::Capabilities;
+        }
+
+        if (!account->isEnabled()) {
+            // Mark the contact as un-enabled also
+            QContactOriginMetadata metadata = existing.detail<QContactOriginMetadata>();
+
+            if (metadata.enabled()) {
+                metadata.setEnabled(false);
+
+                if (!storeContactDetail(existing, metadata, SRC_LOC)) {
+                    warning() << SRC_LOC << "Unable to un-enable contact for:" << contactId;
+                }
+
+                changes |= CDTpContact::Capabilities;
+            }
+        }
+
+        appendContactChange(&saveSet, existing, changes);
     }
+
+    journalContactWrites(saveSet, QList<ContactIdType>());
+    updateContacts(SRC_LOC, &saveSet, 0);
 }
 
 // Instantiate the QContactOriginMetadata functions
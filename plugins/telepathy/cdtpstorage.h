@@ -30,13 +30,19 @@
 #include <QByteArray>
 #include <QElapsedTimer>
 #include <QObject>
+#include <QPair>
+#include <QQueue>
+#include <QSet>
 #include <QString>
 #include <QTimer>
 #include <QUrl>
 #include <QNetworkAccessManager>
 
 #include "cdtpaccount.h"
+#include "cdtpchangejournal.h"
 #include "cdtpcontact.h"
+#include "cdtpextrainfoscheduler.h"
+#include "cdtpwritescheduler.h"
 
 #ifdef USING_QTPIM
 QTCONTACTS_USE_NAMESPACE
@@ -44,7 +50,7 @@ QTCONTACTS_USE_NAMESPACE
 QTM_USE_NAMESPACE
 #endif
 
-class CDTpStorage : public QObject
+class CDTpStorage : public QObject, public CDTpExtraInfoScheduler::Storage
 {
     Q_OBJECT
 
@@ -56,6 +62,7 @@ public:
 
 Q_SIGNALS:
     void error(int code, const QString &message);
+    void writeProgress(const QString &accountPath, int contactsWritten, int queueDepth);
 
 public Q_SLOTS:
     void syncAccounts(const QList<CDTpAccountPtr> &accounts);
@@ -71,16 +78,63 @@ public Q_SLOTS:
 public:
     void createAccountContacts(CDTpAccountPtr accountWrapper, const QStringList &imIds, uint localId);
     void removeAccountContacts(CDTpAccountPtr accountWrapper, const QStringList &contactIds);
+    void flushQueuedUpdates();
+    int queuedUpdateCount() const;
+    QSet<QString> contactsWithStoredInfo(const QString &accountPath, const QStringList &contactIds);
+    void beginAccountImport(const QString &accountPath);
+    void endAccountImport(const QString &accountPath);
 
 private Q_SLOTS:
     void onUpdateQueueTimeout();
+    void onWriteQueueTimeout();
 
     void addNewAccount();
     void updateAccount();
 
 private:
+    typedef QPair<CDTpContactPtr, CDTpContact::Changes> ContactUpdate;
+    typedef QList<ContactUpdate> ContactUpdateList;
+
+    struct WriteSlice {
+        WriteSlice() : queuedAt(0), journalSequence(0) {}
+
+        ContactUpdateList updates;
+        // Stored contacts to mark offline, for an account without roster
+        CDTpAccountPtr offlineAccount;
+#ifdef USING_QTPIM
+        QList<QContactId> offlineContactIds;
+#else
+        QList<QContactLocalId> offlineContactIds;
+#endif
+        qint64 queuedAt;
+        // Journal entries appended up to here are covered by this slice
+        quint64 journalSequence;
+
+        int cost() const { return updates.count() + offlineContactIds.count(); }
+    };
+
+    // Write scheduling statistics of an account, since it was added
+    struct WriteQueueStats {
+        WriteQueueStats() : slicesWritten(0), contactsWritten(0), totalLatency(0), maxLatency(0) {}
+
+        int slicesWritten;
+        int contactsWritten;
+        qint64 totalLatency;
+        qint64 maxLatency;
+
+        qint64 averageLatency() const { return slicesWritten ? totalLatency / slicesWritten : 0; }
+    };
+
     void cancelQueuedUpdates(const QList<CDTpContactPtr> &contacts);
 
+    void queueContactUpdates(const QString &accountPath, const ContactUpdateList &updates);
+    void queueOfflineContacts(CDTpAccountPtr accountWrapper);
+    void enqueueWriteSlice(const QString &accountPath, WriteSlice &slice);
+    void cancelQueuedWrites(const QString &accountPath, const QStringList &contactIds = QStringList());
+    void writeSlice(const QString &accountPath, const WriteSlice &slice);
+    void writeContactUpdates(const WriteSlice &slice);
+    void writeOfflineContacts(const WriteSlice &slice);
+
     void addNewAccount(QContact &self, CDTpAccountPtr accountWrapper);
     void removeExistingAccount(QContact &self, QContactOnlineAccount &existing);
 
@@ -98,12 +152,27 @@ private:
                               );
     void updateContactChanges(CDTpContactPtr contactWrapper, CDTpContact::Changes changes);
 
+    void journalContactWrites(const ContactChangeSet &saveSet,
+#ifdef USING_QTPIM
+                              const QList<QContactId> &removeList
+#else
+                              const QList<QContactLocalId> &removeList
+#endif
+                              );
+
 private:
     QNetworkAccessManager mNetwork;
     QHash<CDTpContactPtr, CDTpContact::Changes> mUpdateQueue;
     QTimer mUpdateTimer;
     QElapsedTimer mWaitTimer;
     QMap<QString, CDTpAccount::Changes> m_accountPendingChanges;
+    CDTpWriteScheduler<WriteSlice> mWriteScheduler;
+    QHash<QString, WriteQueueStats> mWriteStats;
+    QTimer mWriteTimer;
+    QElapsedTimer mWriteClock;
+    CDTpChangeJournal mJournal;
+    // Contacts written during the current import of each importing account
+    QHash<QString, int> mContactsWritten;
 };
 
 #endif // CDTPSTORAGE_H
@@ -0,0 +1,137 @@
+/** This file is part of Contacts daemon
+ **
+ ** Copyright (c) 2010-2011 Nokia Corporation and/or its subsidiary(-ies).
+ **
+ ** Contact:  Nokia Corporation (info@qt.nokia.com)
+ **
+ ** GNU Lesser General Public License Usage
+ ** This file may be used under the terms of the GNU Lesser General Public License
+ ** version 2.1 as published by the Free Software Foundation and appearing in the
+ ** file LICENSE.LGPL included in the packaging of this file.  Please review the
+ ** following information to ensure the GNU Lesser General Public License version
+ ** 2.1 requirements will be met:
+ ** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+ **
+ ** In addition, as a special exception, Nokia gives you certain additional rights.
+ ** These rights are described in the Nokia Qt LGPL Exception version 1.1, included
+ ** in the file LGPL_EXCEPTION.txt in this package.
+ **
+ ** Other Usage
+ ** Alternatively, this file may be used in accordance with the terms and
+ ** conditions contained in a signed written agreement between you and Nokia.
+ **/
+
+#ifndef CDTPWRITESCHEDULER_H
+#define CDTPWRITESCHEDULER_H
+
+#include <QHash>
+#include <QList>
+#include <QPair>
+#include <QQueue>
+#include <QString>
+#include <QStringList>
+
+/* Deficit round robin over per-account queues of write slices: in each round,
+ * every account with queued slices earns a quantum of contacts, and writes slices
+ * while its deficit covers their cost; the deficit left over is kept for its next
+ * round, and dropped once its queue drains. Slices provide their cost in contacts
+ * through cost(). */
+template<typename Slice>
+class CDTpWriteScheduler
+{
+public:
+    typedef QPair<QString, Slice> ScheduledSlice;
+
+    explicit CDTpWriteScheduler(int quantum) : mQuantum(quantum) {}
+
+    bool isEmpty() const { return mOrder.isEmpty(); }
+    bool contains(const QString &accountPath) const { return mQueues.contains(accountPath); }
+
+    void enqueue(const QString &accountPath, const Slice &slice)
+    {
+        typename QHash<QString, Queue>::iterator it = mQueues.find(accountPath);
+        if (it == mQueues.end()) {
+            it = mQueues.insert(accountPath, Queue());
+            mOrder.append(accountPath);
+        }
+
+        it->slices.enqueue(slice);
+    }
+
+    void remove(const QString &accountPath)
+    {
+        mQueues.remove(accountPath);
+        mOrder.removeAll(accountPath);
+    }
+
+    // Queued slices of the account, to edit in place; null if there are none
+    QQueue<Slice> *slices(const QString &accountPath)
+    {
+        typename QHash<QString, Queue>::iterator it = mQueues.find(accountPath);
+        return it == mQueues.end() ? 0 : &it->slices;
+    }
+
+    // Contacts queued for the account
+    int depth(const QString &accountPath) const
+    {
+        typename QHash<QString, Queue>::const_iterator it = mQueues.constFind(accountPath);
+        return it == mQueues.constEnd() ? 0 : it->depth();
+    }
+
+    // Contacts queued for all accounts
+    int depth() const
+    {
+        int count = 0;
+        Q_FOREACH (const Queue &queue, mQueues) {
+            count += queue.depth();
+        }
+        return count;
+    }
+
+    /* Takes the slices written in the next round, in writing order. A round may
+     * be empty when no account has earned enough for its next slice yet. */
+    QList<ScheduledSlice> takeRound()
+    {
+        QList<ScheduledSlice> round;
+
+        const QStringList accountPaths(mOrder);
+        Q_FOREACH (const QString &accountPath, accountPaths) {
+            Queue &queue(mQueues[accountPath]);
+            queue.deficit += mQuantum;
+
+            while (!queue.slices.isEmpty() && queue.slices.head().cost() <= queue.deficit) {
+                queue.deficit -= queue.slices.head().cost();
+                round.append(qMakePair(accountPath, queue.slices.dequeue()));
+            }
+
+            if (queue.slices.isEmpty()) {
+                remove(accountPath);
+            }
+        }
+
+        return round;
+    }
+
+private:
+    struct Queue {
+        Queue() : deficit(0) {}
+
+        QQueue<Slice> slices;
+        int deficit;
+
+        int depth() const
+        {
+            int count = 0;
+            Q_FOREACH (const Slice &slice, slices) {
+                count += slice.cost();
+            }
+            return count;
+        }
+    };
+
+    int mQuantum;
+    QHash<QString, Queue> mQueues;
+    QStringList mOrder;
+};
+
+#endif // CDTPWRITESCHEDULER_H
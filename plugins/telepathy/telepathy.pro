@@ -47,19 +47,24 @@ HEADERS  = cdtpaccount.h \
     cdtpaccountcache.h \
     cdtpaccountcacheloader.h \
     cdtpaccountcachewriter.h \
+    cdtpchangejournal.h \
     types.h \
     cdtpcontact.h \
     cdtpcontroller.h \
+    cdtpextrainfoscheduler.h \
     cdtpplugin.h \
     cdtpstorage.h \
+    cdtpwritescheduler.h \
     buddymanagementadaptor.h \
     cdtpavatarupdate.h
 
 SOURCES  = cdtpaccount.cpp \
     cdtpaccountcacheloader.cpp \
     cdtpaccountcachewriter.cpp \
+    cdtpchangejournal.cpp \
     cdtpcontact.cpp \
     cdtpcontroller.cpp \
+    cdtpextrainfoscheduler.cpp \
     cdtpplugin.cpp \
     cdtpstorage.cpp \
     buddymanagementadaptor.cpp \
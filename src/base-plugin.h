@@ -61,6 +61,11 @@ Q_SIGNALS:
     void error(int code, const QString &message);
     // Emitted to inform that import timeout should be extended
     void importAlive();
+    // Emitted periodically while importing
+    // \param contactsProcessed - contacts of the account processed since its import started
+    // \param queueDepth - contacts of the account still waiting to be processed
+    void importProgress(const QString &service, const QString &account,
+                        int contactsProcessed, int queueDepth);
 };
 
 } // Contactsd
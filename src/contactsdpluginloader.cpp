@@ -27,6 +27,7 @@
 #include <QStringList>
 #include <QVariant>
 #include <QTimer>
+#include <QDateTime>
 
 #include "contactsdpluginloader.h"
 #include "contactsimportprogressadaptor.h"
@@ -38,6 +39,10 @@ using namespace Contactsd;
 const int IMPORT_TIMEOUT = 5 * 60 * 1000;
 // alive check timeout is 30 seconds
 const int ALIVE_TIMEOUT = 30 * 1000;
+// import progress is reported at most once a second
+const int PROGRESS_INTERVAL = 1000;
+// an import estimated to take longer may still time out after 30 minutes
+const int MAX_IMPORT_TIMEOUT = 30 * 60 * 1000;
 
 class MsgHandlerGuard
 {
@@ -67,6 +72,7 @@ public:
 ContactsdPluginLoader::ContactsdPluginLoader(QDBusConnection *connection)
     : mImportTimer(0)
     , mCheckAliveTimer(0)
+    , mProgressTimer(0)
     , mDBusConnection(connection)
     , mHaveRegisteredDBus(false)
 {
@@ -161,6 +167,8 @@ void ContactsdPluginLoader::loadPlugins(const QString &pluginsDir, const QString
                 this, SIGNAL(error(int, const QString &)));
         connect(basePlugin, SIGNAL(importAlive()),
                 this, SLOT(onImportAlive()));
+        connect(basePlugin, SIGNAL(importProgress(const QString &, const QString &, int, int)),
+                this, SLOT(onPluginImportProgress(const QString &, const QString &, int, int)));
 
         basePlugin->init();
 
@@ -200,6 +208,7 @@ void ContactsdPluginLoader::onPluginImportStarted(const QString &service, const
         // new import
         mImportState.reset();
         startImportTimer();
+        startProgressTimer();
         Q_EMIT importStarted(service);
     }
 
@@ -236,11 +245,26 @@ void ContactsdPluginLoader::onPluginImportEnded(const QString &service, const QS
     } else {
         stopImportTimer();
         stopCheckAliveTimer();
+        stopProgressTimer();
         Q_EMIT importEnded(mImportState.contactsAdded(), mImportState.contactsRemoved(),
                            mImportState.contactsMerged());
     }
 }
 
+void ContactsdPluginLoader::onPluginImportProgress(const QString &service, const QString &account,
+                                                   int contactsProcessed, int queueDepth)
+{
+    if (not mImportState.serviceHasActiveImports(service)) {
+        return;
+    }
+
+    mImportState.updateAccountProgress(service, account, contactsProcessed, queueDepth);
+    mProgressServices.insert(service);
+
+    // Progress shows the import is still alive
+    onImportAlive();
+}
+
 void ContactsdPluginLoader::onImportAlive()
 {
     if (0 != mCheckAliveTimer && mCheckAliveTimer->isActive()) {
@@ -280,12 +304,81 @@ void ContactsdPluginLoader::onCheckAliveTimeout()
     stopCheckAliveTimer();
 
     if (0 == mImportTimer) {
+        stopProgressTimer();
         Q_EMIT importEnded(mImportState.contactsAdded(), mImportState.contactsRemoved(),
                            mImportState.contactsMerged());
         mImportState.timeout();
     }
 }
 
+void ContactsdPluginLoader::onProgressTimeout()
+{
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+    Q_FOREACH (const QString &service, mProgressServices) {
+        if (not mImportState.serviceHasActiveImports(service)) {
+            continue;
+        }
+
+        const qint64 remaining = mImportState.serviceRemainingTime(service);
+        const qlonglong estimatedCompletion = remaining < 0 ? 0 : (now + remaining) / 1000;
+
+        Q_EMIT importProgress(service, mImportState.serviceContactsProcessed(service),
+                              mImportState.serviceThroughput(service),
+                              mImportState.serviceQueueDepth(service), estimatedCompletion);
+    }
+
+    mProgressServices.clear();
+
+    adaptImportTimeout();
+}
+
+void ContactsdPluginLoader::startProgressTimer()
+{
+    stopProgressTimer();
+
+    mProgressTimer = new QTimer(this);
+    connect(mProgressTimer, SIGNAL(timeout()),
+            this, SLOT(onProgressTimeout()));
+    mProgressTimer->start(PROGRESS_INTERVAL);
+}
+
+void ContactsdPluginLoader::stopProgressTimer()
+{
+    mProgressServices.clear();
+
+    if (0 == mProgressTimer)
+        return;
+
+    mProgressTimer->stop();
+    delete mProgressTimer;
+    mProgressTimer = 0;
+}
+
+// Extends the import timeout when the observed throughput says the import
+// needs longer than the timeout allows, with some headroom
+void ContactsdPluginLoader::adaptImportTimeout()
+{
+    if (0 == mImportTimer || not mImportTimer->isActive()) {
+        return;
+    }
+
+    qint64 remaining = -1;
+    Q_FOREACH (const QString &service, mImportState.activeImportingServices()) {
+        remaining = qMax(remaining, mImportState.serviceRemainingTime(service));
+    }
+
+    if (remaining < 0) {
+        return;
+    }
+
+    const int timeout = int(qMin<qint64>(remaining * 2, MAX_IMPORT_TIMEOUT));
+    if (timeout > mImportTimer->remainingTime()) {
+        debug() << Q_FUNC_INFO << "extending import timeout to" << timeout << "ms";
+        mImportTimer->start(timeout);
+    }
+}
+
 void ContactsdPluginLoader::startImportTimer()
 {
     if (mImportTimer) {
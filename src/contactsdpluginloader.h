@@ -26,6 +26,7 @@
 
 #include <QObject>
 #include <QMap>
+#include <QSet>
 
 #include "base-plugin.h"
 #include "importstate.h"
@@ -58,6 +59,9 @@ Q_SIGNALS:
                             const QString &newService);
     void importEnded(int contactsAdded, int contactsRemoved,
                      int contactsMerged);
+    void importProgress(const QString &service, int contactsProcessed,
+                        double contactsPerSecond, int queueDepth,
+                        qlonglong estimatedCompletion);
     void pluginsLoaded();
     void error(int code, const QString &message);
 
@@ -65,15 +69,21 @@ private Q_SLOTS:
     void onPluginImportStarted(const QString &service, const QString &account);
     void onPluginImportEnded(const QString &service, const QString &account,
                              int contactsAdded, int contactsRemoved, int contactsMerged);
+    void onPluginImportProgress(const QString &service, const QString &account,
+                                int contactsProcessed, int queueDepth);
     void onImportTimeout();
     void onImportAlive();
     void onCheckAliveTimeout();
+    void onProgressTimeout();
 
 private:
     void startImportTimer();
     void stopImportTimer();
     void startCheckAliveTimer();
     void stopCheckAliveTimer();
+    void startProgressTimer();
+    void stopProgressTimer();
+    void adaptImportTimeout();
     QString pluginName(Contactsd::BasePlugin *plugin);
 
     typedef QMap<QString, Contactsd::BasePlugin*> PluginStore;
@@ -82,6 +92,9 @@ private:
 
     QTimer *mImportTimer;
     QTimer *mCheckAliveTimer;
+    QTimer *mProgressTimer;
+    // services with progress not yet reported
+    QSet<QString> mProgressServices;
 
     QDBusConnection *mDBusConnection;
     bool mHaveRegisteredDBus;
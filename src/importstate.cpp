@@ -54,6 +54,8 @@ void ImportState::timeout()
 void ImportState::reset()
 {
     mService2Accounts.clear();
+    mAccountProgress.clear();
+    mServiceTimers.clear();
     mContactsAdded = 0;
     mContactsMerged = 0;
     mContactsRemoved = 0;
@@ -74,6 +76,9 @@ void ImportState::addImportingAccount(const QString &service, const QString &acc
     debug() << Q_FUNC_INFO << service << account;
 
     if (not mService2Accounts.contains(service, account)) {
+        if (not mService2Accounts.contains(service)) {
+            mServiceTimers[service].start();
+        }
         mService2Accounts.insert(service, account);
         mStateStore.setValue(account, Contactsd::Importing);
         mStateStore.sync();
@@ -88,6 +93,10 @@ bool ImportState::removeImportingAccount(const QString &service, const QString &
     int numRemoved = mService2Accounts.remove(service, account);
 
     if (numRemoved) {
+        mAccountProgress.remove(account);
+        if (not mService2Accounts.contains(service)) {
+            mServiceTimers.remove(service);
+        }
         mContactsAdded += added;
         mContactsRemoved += removed;
         mContactsMerged += merged;
@@ -113,3 +122,55 @@ int ImportState::contactsRemoved()
 {
     return mContactsRemoved;
 }
+
+void ImportState::updateAccountProgress(const QString &service, const QString &account,
+                                        int contactsProcessed, int queueDepth)
+{
+    if (not mService2Accounts.contains(service, account)) {
+        return;
+    }
+
+    Progress &progress = mAccountProgress[account];
+    progress.contactsProcessed = contactsProcessed;
+    progress.queueDepth = queueDepth;
+}
+
+int ImportState::serviceContactsProcessed(const QString &service)
+{
+    int processed = 0;
+    foreach (const QString &account, mService2Accounts.values(service)) {
+        processed += mAccountProgress.value(account).contactsProcessed;
+    }
+    return processed;
+}
+
+int ImportState::serviceQueueDepth(const QString &service)
+{
+    int depth = 0;
+    foreach (const QString &account, mService2Accounts.values(service)) {
+        depth += mAccountProgress.value(account).queueDepth;
+    }
+    return depth;
+}
+
+double ImportState::serviceThroughput(const QString &service)
+{
+    QHash<QString, QElapsedTimer>::const_iterator it = mServiceTimers.constFind(service);
+    if (it == mServiceTimers.constEnd()) {
+        return 0.0;
+    }
+
+    // Avoid wild rates from the first few contacts
+    const qint64 elapsed = qMax<qint64>(it->elapsed(), 1000);
+    return serviceContactsProcessed(service) * 1000.0 / elapsed;
+}
+
+qint64 ImportState::serviceRemainingTime(const QString &service)
+{
+    const double throughput = serviceThroughput(service);
+    if (throughput <= 0.0) {
+        return -1;
+    }
+
+    return qint64(serviceQueueDepth(service) * 1000.0 / throughput);
+}
@@ -24,6 +24,8 @@
 #ifndef IMPORTSTATE_H_
 #define IMPORTSTATE_H_
 
+#include <QElapsedTimer>
+#include <QHash>
 #include <QMultiHash>
 #include <QString>
 #include <QStringList>
@@ -56,13 +58,33 @@ public:
     int contactsMerged();
     int contactsRemoved();
 
+    // record the progress reported by an importing account
+    void updateAccountProgress(const QString &service, const QString &account,
+                               int contactsProcessed, int queueDepth);
+    int serviceContactsProcessed(const QString &service);
+    int serviceQueueDepth(const QString &service);
+    // contacts processed per second since the service started importing
+    double serviceThroughput(const QString &service);
+    // estimated milliseconds until the service has processed its queue,
+    // or -1 if there is not enough progress to estimate it
+    qint64 serviceRemainingTime(const QString &service);
+
 private:
+    struct Progress {
+        Progress() : contactsProcessed(0), queueDepth(0) {}
+        int contactsProcessed;
+        int queueDepth;
+    };
+
     // each service may have multiple active importing accounts
     QMultiHash<QString, QString> mService2Accounts;
     // accumlated amount of contacts being added, merged, removed
     int mContactsAdded;
     int mContactsMerged;
     int mContactsRemoved;
+    // progress of each importing account, and when each service started
+    QHash<QString, Progress> mAccountProgress;
+    QHash<QString, QElapsedTimer> mServiceTimers;
     // store each account's import state
     QSettings mStateStore;
 };
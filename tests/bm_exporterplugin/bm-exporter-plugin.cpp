@@ -0,0 +1,256 @@
+/** This file is part of Contacts daemon
+ **
+ ** Copyright (c) 2014 Jolla Ltd.
+ **
+ ** Contact: Matt Vogt <matthew.vogt@jollamobile.com>
+ **
+ ** GNU Lesser General Public License Usage
+ ** This file may be used under the terms of the GNU Lesser General Public License
+ ** version 2.1 as published by the Free Software Foundation and appearing in the
+ ** file LICENSE.LGPL included in the packaging of this file.  Please review the
+ ** following information to ensure the GNU Lesser General Public License version
+ ** 2.1 requirements will be met:
+ ** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+ **/
+
+#include "bm-exporter-plugin.h"
+
+#include <test-benchmark.h>
+#include <test-common.h>
+
+#include <QContactDetailFilter>
+#include <QContactEmailAddress>
+#include <QContactName>
+#include <QContactOnlineAccount>
+#include <QContactPhoneNumber>
+#include <QContactPresence>
+#include <QContactSyncTarget>
+
+#include <QDir>
+
+#include <qtcontacts-extensions.h>
+
+// In this benchmark, we bypass the contacts daemon and the controller's scheduling
+// entirely, and drive the exporter's worker directly against databases created in a
+// temporary directory. Set CONTACTSD_EXPORTER_BENCHMARK_CONTACTS to change the size
+// of the synthetic data set.
+
+namespace {
+
+const QString benchSyncTarget(QStringLiteral("exporter-bench"));
+const QString benchAccountPath(QStringLiteral("/org/freedesktop/Telepathy/Account/gabble/jabber/bench0"));
+const int defaultContactCount = 500;
+
+QString managerName()
+{
+    return QStringLiteral("org.nemomobile.contacts.sqlite");
+}
+
+QMap<QString, QString> managerParameters(bool nonprivileged)
+{
+    QMap<QString, QString> rv;
+    rv.insert(QStringLiteral("mergePresenceChanges"), QStringLiteral("false"));
+    if (nonprivileged) {
+        rv.insert(QStringLiteral("nonprivileged"), QStringLiteral("true"));
+    }
+    return rv;
+}
+
+QContact syntheticContact(int index)
+{
+    QContact contact;
+
+    QContactSyncTarget st;
+    st.setSyncTarget(benchSyncTarget);
+    contact.saveDetail(&st);
+
+    QContactName name;
+    name.setFirstName(QStringLiteral("First%1").arg(index));
+    name.setLastName(QStringLiteral("Last%1").arg(index));
+    contact.saveDetail(&name);
+
+    QContactPhoneNumber phone;
+    phone.setNumber(QStringLiteral("+1555%1").arg(index, 7, 10, QLatin1Char('0')));
+    contact.saveDetail(&phone);
+
+    QContactEmailAddress email;
+    email.setEmailAddress(QStringLiteral("user%1@example.com").arg(index));
+    contact.saveDetail(&email);
+
+    QContactOnlineAccount account;
+    account.setAccountUri(QStringLiteral("user%1@example.com").arg(index));
+    account.setValue(QContactOnlineAccount__FieldAccountPath, benchAccountPath);
+    contact.saveDetail(&account);
+
+    QContactPresence presence;
+    presence.setPresenceState(QContactPresence::PresenceOffline);
+    contact.saveDetail(&presence);
+
+    return contact;
+}
+}
+
+BenchmarkExporterPlugin::BenchmarkExporterPlugin(QObject *parent) :
+    QObject(parent),
+    m_contactCount(defaultContactCount),
+    m_privilegedManager(0),
+    m_nonprivilegedManager(0),
+    m_worker(0)
+{
+}
+
+void BenchmarkExporterPlugin::initTestCase()
+{
+    bool ok = false;
+    const int count = qgetenv("CONTACTSD_EXPORTER_BENCHMARK_CONTACTS").toInt(&ok);
+    if (ok && count > 0) {
+        m_contactCount = count;
+    }
+
+    QVERIFY(m_dataDir.activate());
+
+    // The privileged database is only used where its directory exists
+    QVERIFY(QDir::root().mkpath(m_dataDir.path() + QStringLiteral("/system/privileged/Contacts")));
+
+    m_privilegedManager = new QContactManager(managerName(), managerParameters(false));
+    m_nonprivilegedManager = new QContactManager(managerName(), managerParameters(true));
+
+    qRegisterMetaType<QList<QContactId> >();
+
+    m_worker = new CDExporterWorker(&m_preemptRequest);
+    m_worker->initialize();
+}
+
+QList<QContact> BenchmarkExporterPlugin::benchContacts(QContactManager &manager) const
+{
+    QContactDetailFilter stFilter;
+    stFilter.setDetailType(QContactSyncTarget::Type, QContactSyncTarget::FieldSyncTarget);
+    stFilter.setValue(benchSyncTarget);
+
+    return manager.contacts(stFilter);
+}
+
+QList<QContact> BenchmarkExporterPlugin::exportedContacts() const
+{
+    QContactDetailFilter stFilter;
+    stFilter.setDetailType(QContactSyncTarget::Type, QContactSyncTarget::FieldSyncTarget);
+    stFilter.setValue(QStringLiteral("aggregate"));
+
+    return m_nonprivilegedManager->contacts(stFilter);
+}
+
+void BenchmarkExporterPlugin::runSync(const char *name, bool importChanges, int expectedCount)
+{
+    QSignalSpy finishedSpy(m_worker, SIGNAL(syncFinished(bool,bool,bool,QList<QContactId>,QList<QContactId>,qint64)));
+
+    resetPeakRss();
+
+    QBENCHMARK_ONCE {
+        m_worker->sync(true, QList<QContactId>(), QList<QContactId>(), importChanges, false);
+    }
+
+    const qint64 peakRss(peakRssKb());
+
+    QCOMPARE(finishedSpy.count(), 1);
+    const QList<QVariant> arguments(finishedSpy.takeFirst());
+    QCOMPARE(arguments.at(0).toBool(), true);
+    const qint64 elapsed(arguments.at(5).value<qint64>());
+
+    const QVariantMap phaseTimes(m_worker->lastPhaseTimes());
+    QVERIFY(!phaseTimes.isEmpty());
+
+    QStringList phases;
+    QVariantMap::const_iterator it = phaseTimes.constBegin(), end = phaseTimes.constEnd();
+    for ( ; it != end; ++it) {
+        phases.append(QStringLiteral("%1=%2ms").arg(it.key()).arg(it.value().toLongLong()));
+    }
+
+    benchmarkResult(name) << "contacts:" << m_contactCount << "elapsed:" << elapsed << "ms"
+                          << "phases:" << phases.join(QStringLiteral(" ")) << "peak RSS:" << peakRss << "kB";
+
+    QCOMPARE(exportedContacts().count(), expectedCount);
+}
+
+void BenchmarkExporterPlugin::benchmarkInitialExport()
+{
+    QList<QContact> contacts;
+    for (int i = 0; i < m_contactCount; ++i) {
+        contacts.append(syntheticContact(i));
+    }
+    QVERIFY(m_privilegedManager->saveContacts(&contacts));
+
+    runSync("initialExport", false, m_contactCount);
+}
+
+void BenchmarkExporterPlugin::benchmarkPresenceChurn()
+{
+    QList<QContact> contacts(benchContacts(*m_privilegedManager));
+    QCOMPARE(contacts.count(), m_contactCount);
+
+    for (int i = 0; i < contacts.count(); ++i) {
+        QContactPresence presence(contacts.at(i).detail<QContactPresence>());
+        presence.setPresenceState(i % 2 ? QContactPresence::PresenceAvailable : QContactPresence::PresenceAway);
+        presence.setCustomMessage(QStringLiteral("Status %1").arg(i));
+        contacts[i].saveDetail(&presence);
+    }
+
+    QList<QContactDetail::DetailType> mask;
+    mask << QContactPresence::Type;
+    QVERIFY(m_privilegedManager->saveContacts(&contacts, mask));
+
+    runSync("presenceChurn", false, m_contactCount);
+}
+
+void BenchmarkExporterPlugin::benchmarkDetailEdits()
+{
+    QList<QContact> contacts(benchContacts(*m_privilegedManager));
+    QList<QContact> edited;
+    for (int i = 0; i < contacts.count(); i += 10) {
+        QContact contact(contacts.at(i));
+        QContactPhoneNumber phone(contact.detail<QContactPhoneNumber>());
+        phone.setNumber(QStringLiteral("+1666%1").arg(i, 7, 10, QLatin1Char('0')));
+        contact.saveDetail(&phone);
+        edited.append(contact);
+    }
+    QVERIFY(m_privilegedManager->saveContacts(&edited));
+
+    runSync("detailEdits", false, m_contactCount);
+}
+
+void BenchmarkExporterPlugin::benchmarkDeletions()
+{
+    QList<QContactId> removedIds;
+    QList<QContact> contacts(benchContacts(*m_privilegedManager));
+    for (int i = 0; i < contacts.count(); i += 10) {
+        removedIds.append(contacts.at(i).id());
+    }
+    QVERIFY(m_privilegedManager->removeContacts(removedIds));
+
+    m_contactCount -= removedIds.count();
+    runSync("deletions", false, m_contactCount);
+}
+
+void BenchmarkExporterPlugin::benchmarkReimport()
+{
+    QList<QContact> contacts(exportedContacts());
+    QList<QContact> edited;
+    for (int i = 0; i < contacts.count(); i += 10) {
+        QContact contact(contacts.at(i));
+        QContactEmailAddress email(contact.detail<QContactEmailAddress>());
+        email.setEmailAddress(QStringLiteral("edited%1@example.com").arg(i));
+        contact.saveDetail(&email);
+        edited.append(contact);
+    }
+    QVERIFY(m_nonprivilegedManager->saveContacts(&edited));
+
+    runSync("reimport", true, m_contactCount);
+}
+
+void BenchmarkExporterPlugin::cleanupTestCase()
+{
+    delete m_worker;
+    delete m_nonprivilegedManager;
+    delete m_privilegedManager;
+}
+
+CONTACTSD_TEST_MAIN(BenchmarkExporterPlugin)
@@ -0,0 +1,62 @@
+/** This file is part of Contacts daemon
+ **
+ ** Copyright (c) 2014 Jolla Ltd.
+ **
+ ** Contact: Matt Vogt <matthew.vogt@jollamobile.com>
+ **
+ ** GNU Lesser General Public License Usage
+ ** This file may be used under the terms of the GNU Lesser General Public License
+ ** version 2.1 as published by the Free Software Foundation and appearing in the
+ ** file LICENSE.LGPL included in the packaging of this file.  Please review the
+ ** following information to ensure the GNU Lesser General Public License version
+ ** 2.1 requirements will be met:
+ ** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+ **/
+
+#ifndef BM_EXPORTER_PLUGIN_H
+#define BM_EXPORTER_PLUGIN_H
+
+#include <QObject>
+#include <QtTest/QtTest>
+
+#include <test-benchmark.h>
+
+#include <QContactManager>
+
+#include "../../plugins/exporter/cdexportercontroller.h"
+
+QTCONTACTS_USE_NAMESPACE
+
+class BenchmarkExporterPlugin : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit BenchmarkExporterPlugin(QObject *parent = 0);
+
+private Q_SLOTS:
+    void initTestCase();
+
+    // These benchmarks run in order, each operating on the state left by the last
+    void benchmarkInitialExport();
+    void benchmarkPresenceChurn();
+    void benchmarkDetailEdits();
+    void benchmarkDeletions();
+    void benchmarkReimport();
+
+    void cleanupTestCase();
+
+private:
+    QList<QContact> benchContacts(QContactManager &manager) const;
+    QList<QContact> exportedContacts() const;
+    void runSync(const char *name, bool importChanges, int expectedCount);
+
+    BenchmarkDataDir m_dataDir;
+    int m_contactCount;
+    QAtomicInt m_preemptRequest;
+    QContactManager *m_privilegedManager;
+    QContactManager *m_nonprivilegedManager;
+    CDExporterWorker *m_worker;
+};
+
+#endif // BM_EXPORTER_PLUGIN_H
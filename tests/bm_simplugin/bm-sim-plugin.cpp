@@ -0,0 +1,271 @@
+/** This file is part of Contacts daemon
+ **
+ ** Copyright (c) 2013 Jolla Ltd.
+ **
+ ** Contact: Matt Vogt <matthew.vogt@jollamobile.com>
+ **
+ ** GNU Lesser General Public License Usage
+ ** This file may be used under the terms of the GNU Lesser General Public License
+ ** version 2.1 as published by the Free Software Foundation and appearing in the
+ ** file LICENSE.LGPL included in the packaging of this file.  Please review the
+ ** following information to ensure the GNU Lesser General Public License version
+ ** 2.1 requirements will be met:
+ ** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+ **/
+
+#include "bm-sim-plugin.h"
+#include "../../plugins/sim/cdsimcontactwriter.h"
+
+#include <test-benchmark.h>
+#include <test-common.h>
+
+#include <MGConfItem>
+
+#include <QContactDetailFilter>
+#include <QContactPhoneNumber>
+#include <QContactSyncTarget>
+
+#include <QElapsedTimer>
+
+#ifdef USING_QTPIM
+QTCONTACTS_USE_NAMESPACE
+#endif
+
+// In this benchmark, the controller reads phonebooks generated by a fake oFono
+// phonebook, importing them into a database created in a temporary directory.
+
+namespace {
+
+const QString benchSyncTarget(QStringLiteral("sim-bench"));
+
+QList<QContact> getAllSimContacts(const QContactManager &m)
+{
+    QContactDetailFilter stFilter;
+    stFilter.setDetailType(QContactSyncTarget::Type, QContactSyncTarget::FieldSyncTarget);
+    stFilter.setValue(benchSyncTarget);
+
+    return m.contacts(stFilter);
+}
+}
+
+FakeSimPhonebook::FakeSimPhonebook(QObject *parent) :
+    QObject(parent)
+{
+}
+
+// Generates a phonebook where the given proportion of entries repeat an earlier name, with
+// one number shared with that name and one of their own. Returns the number of distinct names.
+int FakeSimPhonebook::setEntries(int entryCount, int duplicatePercent, bool modified)
+{
+    const int uniqueCount(qMax(1, entryCount - (entryCount * duplicatePercent / 100)));
+
+    m_vcardData.clear();
+    for (int i = 0; i < entryCount; ++i) {
+        const int index(i < uniqueCount ? i : (i - uniqueCount) % uniqueCount);
+
+        // A modified phonebook changes the number of every tenth name
+        const QString prefix((modified && index % 10 == 0) ? QStringLiteral("(404) 777-") : QStringLiteral("(404) 555-"));
+
+        m_vcardData.append(QStringLiteral(
+"BEGIN:VCARD\n"
+"VERSION:3.0\n"
+"FN:Contact %1\n"
+"TEL;TYPE=HOME,VOICE:%2%3\n").arg(index).arg(prefix).arg(index, 5, 10, QLatin1Char('0')));
+        if (i >= uniqueCount) {
+            m_vcardData.append(QStringLiteral(
+"TEL;TYPE=CELL:(404) 666-%1\n").arg(i, 5, 10, QLatin1Char('0')));
+        }
+        m_vcardData.append(QStringLiteral("END:VCARD\n"));
+    }
+
+    return uniqueCount;
+}
+
+void FakeSimPhonebook::beginImport()
+{
+    emit importReady(m_vcardData);
+}
+
+BenchmarkSimPlugin::BenchmarkSimPlugin(QObject *parent) :
+    QObject(parent),
+    m_phonebook(0),
+    m_controller(0)
+{
+}
+
+void BenchmarkSimPlugin::initTestCase()
+{
+    QVERIFY(m_dataDir.activate());
+
+    m_controller = new CDSimController(this, benchSyncTarget);
+    m_controller->simPresenceChanged(true);
+
+    m_phonebook = new FakeSimPhonebook(this);
+    connect(m_phonebook, SIGNAL(importReady(const QString &)),
+            m_controller, SLOT(vcardDataAvailable(const QString &)));
+}
+
+void BenchmarkSimPlugin::populateData()
+{
+    QTest::addColumn<int>("entryCount");
+    QTest::addColumn<int>("duplicatePercent");
+
+    const int entryCounts[] = { 10, 250, 1000, 5000 };
+    const int duplicatePercents[] = { 0, 10, 50 };
+    for (unsigned i = 0; i < sizeof(entryCounts) / sizeof(entryCounts[0]); ++i) {
+        for (unsigned j = 0; j < sizeof(duplicatePercents) / sizeof(duplicatePercents[0]); ++j) {
+            const QByteArray tag(QStringLiteral("%1 entries, %2% duplicates").arg(entryCounts[i]).arg(duplicatePercents[j]).toUtf8());
+            QTest::newRow(tag.constData()) << entryCounts[i] << duplicatePercents[j];
+        }
+    }
+}
+
+void BenchmarkSimPlugin::runImport(const char *name, int entryCount, int duplicatePercent, int expectedCount)
+{
+    QSignalSpy timedSpy(m_controller, SIGNAL(importPhasesTimed(QVariantMap)));
+
+    resetPeakRss();
+
+    QBENCHMARK_ONCE {
+        m_phonebook->beginImport();
+        QTRY_VERIFY_WITH_TIMEOUT(m_controller->busy() == false, 300000);
+    }
+
+    const qint64 peakRss(peakRssKb());
+
+    QCOMPARE(timedSpy.count(), 1);
+    const QVariantMap phaseTimes(timedSpy.takeFirst().at(0).toMap());
+
+    QCOMPARE(getAllSimContacts(m_controller->contactManager()).count(), expectedCount);
+
+    benchmarkResult(name) << "entries:" << entryCount << "duplicates:" << duplicatePercent << "%"
+                          << "parse:" << phaseTimes.value(QStringLiteral("parse")).toLongLong() << "ms"
+                          << "diff:" << phaseTimes.value(QStringLiteral("diff")).toLongLong() << "ms"
+                          << "write:" << phaseTimes.value(QStringLiteral("write")).toLongLong() << "ms"
+                          << "total:" << phaseTimes.value(QStringLiteral("total")).toLongLong() << "ms"
+                          << "peak RSS:" << peakRss << "kB";
+}
+
+void BenchmarkSimPlugin::benchmarkImport_data()
+{
+    populateData();
+}
+
+void BenchmarkSimPlugin::benchmarkImport()
+{
+    QFETCH(int, entryCount);
+    QFETCH(int, duplicatePercent);
+
+    QCOMPARE(getAllSimContacts(m_controller->contactManager()).count(), 0);
+
+    const int uniqueCount(m_phonebook->setEntries(entryCount, duplicatePercent));
+    runImport("Import", entryCount, duplicatePercent, uniqueCount);
+}
+
+void BenchmarkSimPlugin::benchmarkUpdate_data()
+{
+    populateData();
+}
+
+void BenchmarkSimPlugin::benchmarkUpdate()
+{
+    QFETCH(int, entryCount);
+    QFETCH(int, duplicatePercent);
+
+    // Import the original phonebook, then measure importing a modified version of it
+    const int uniqueCount(m_phonebook->setEntries(entryCount, duplicatePercent));
+    m_phonebook->beginImport();
+    QTRY_VERIFY_WITH_TIMEOUT(m_controller->busy() == false, 300000);
+    QCOMPARE(getAllSimContacts(m_controller->contactManager()).count(), uniqueCount);
+
+    m_phonebook->setEntries(entryCount, duplicatePercent, true);
+    runImport("Update", entryCount, duplicatePercent, uniqueCount);
+}
+
+void BenchmarkSimPlugin::benchmarkCoalescing_data()
+{
+    QTest::addColumn<int>("entryCount");
+
+    QTest::newRow("250") << 250;
+    QTest::newRow("500") << 500;
+    QTest::newRow("1000") << 1000;
+}
+
+void BenchmarkSimPlugin::benchmarkCoalescing()
+{
+    QFETCH(int, entryCount);
+
+    QCOMPARE(getAllSimContacts(m_controller->contactManager()).count(), 0);
+
+    // Each name appears twice, the second time with a number of its own to be coalesced
+    const int uniqueCount(m_phonebook->setEntries(entryCount, 50));
+    QCOMPARE(uniqueCount, entryCount / 2);
+    runImport("Coalescing", entryCount, 50, uniqueCount);
+
+    foreach (const QContact &contact, getAllSimContacts(m_controller->contactManager())) {
+        QCOMPARE(contact.details<QContactPhoneNumber>().count(), 2);
+    }
+}
+
+void BenchmarkSimPlugin::benchmarkDeactivation_data()
+{
+    QTest::addColumn<int>("entryCount");
+
+    QTest::newRow("250") << 250;
+    QTest::newRow("1000") << 1000;
+    QTest::newRow("5000") << 5000;
+}
+
+void BenchmarkSimPlugin::benchmarkDeactivation()
+{
+    QFETCH(int, entryCount);
+
+    QContactManager &m(m_controller->contactManager());
+
+    m_phonebook->setEntries(entryCount, 0);
+    m_phonebook->beginImport();
+    QTRY_VERIFY_WITH_TIMEOUT(m_controller->busy() == false, 300000);
+
+    QList<QContactId> ids;
+    foreach (const QContact &contact, getAllSimContacts(m)) {
+        ids.append(contact.id());
+    }
+    QCOMPARE(ids.count(), entryCount);
+
+    // Measure the writes made when the SIM is removed and when it returns
+    CDSimContactWriter writer;
+    QElapsedTimer timer;
+
+    timer.start();
+    QVERIFY(writer.setDeactivated(ids, true));
+    const qint64 deactivateTime(timer.restart());
+    QCOMPARE(getAllSimContacts(m).count(), 0);
+
+    QVERIFY(writer.setDeactivated(ids, false));
+    const qint64 reactivateTime(timer.elapsed());
+    QCOMPARE(getAllSimContacts(m).count(), entryCount);
+
+    benchmarkResult("Deactivation") << "entries:" << entryCount
+                                    << "deactivate:" << deactivateTime << "ms"
+                                    << "reactivate:" << reactivateTime << "ms";
+}
+
+void BenchmarkSimPlugin::cleanupTestCase()
+{
+}
+
+void BenchmarkSimPlugin::cleanup()
+{
+    QContactManager &m(m_controller->contactManager());
+
+    QList<QContactId> ids;
+    foreach (const QContact &contact, getAllSimContacts(m)) {
+        ids.append(contact.id());
+    }
+    QVERIFY(ids.isEmpty() || m.removeContacts(ids));
+
+    // Don't leave the fingerprint of the imported phonebook in the user's settings
+    MGConfItem(m_controller->phonebookFingerprintKey()).unset();
+}
+
+CONTACTSD_TEST_MAIN(BenchmarkSimPlugin)
@@ -0,0 +1,75 @@
+/** This file is part of Contacts daemon
+ **
+ ** Copyright (c) 2013 Jolla Ltd.
+ **
+ ** Contact: Matt Vogt <matthew.vogt@jollamobile.com>
+ **
+ ** GNU Lesser General Public License Usage
+ ** This file may be used under the terms of the GNU Lesser General Public License
+ ** version 2.1 as published by the Free Software Foundation and appearing in the
+ ** file LICENSE.LGPL included in the packaging of this file.  Please review the
+ ** following information to ensure the GNU Lesser General Public License version
+ ** 2.1 requirements will be met:
+ ** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+ **/
+
+#ifndef BM_SIM_PLUGIN_H
+#define BM_SIM_PLUGIN_H
+
+#include <QObject>
+#include <QtTest/QtTest>
+
+#include <test-benchmark.h>
+
+#include "../../plugins/sim/cdsimcontroller.h"
+
+// Stands in for the oFono phonebook, delivering generated VCard data
+class FakeSimPhonebook : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit FakeSimPhonebook(QObject *parent = 0);
+
+    int setEntries(int entryCount, int duplicatePercent, bool modified = false);
+    void beginImport();
+
+Q_SIGNALS:
+    void importReady(const QString &vcardData);
+
+private:
+    QString m_vcardData;
+};
+
+class BenchmarkSimPlugin : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit BenchmarkSimPlugin(QObject *parent = 0);
+
+private Q_SLOTS:
+    void initTestCase();
+
+    void benchmarkImport_data();
+    void benchmarkImport();
+    void benchmarkUpdate_data();
+    void benchmarkUpdate();
+    void benchmarkCoalescing_data();
+    void benchmarkCoalescing();
+    void benchmarkDeactivation_data();
+    void benchmarkDeactivation();
+
+    void cleanupTestCase();
+    void cleanup();
+
+private:
+    void populateData();
+    void runImport(const char *name, int entryCount, int duplicatePercent, int expectedCount);
+
+    BenchmarkDataDir m_dataDir;
+    FakeSimPhonebook *m_phonebook;
+    CDSimController *m_controller;
+};
+
+#endif // BM_SIM_PLUGIN_H
@@ -0,0 +1,30 @@
+include(../common/test-common.pri)
+
+TARGET = bm_simplugin
+target.path = /opt/tests/$${PACKAGENAME}/$$TARGET
+
+CONFIG += test link_pkgconfig
+
+QT -= gui
+QT += dbus testlib
+DEFINES += ENABLE_DEBUG
+
+PKGCONFIG += mlite5 Qt5Contacts Qt5Versit qofono-qt5
+PKGCONFIG += qtcontacts-sqlite-qt5-extensions
+DEFINES *= USING_QTPIM
+
+INCLUDEPATH += \
+    ../../plugins/sim \
+    ../../src
+
+HEADERS += \
+    bm-sim-plugin.h \
+    ../../plugins/sim/cdsimcontactwriter.h \
+    ../../plugins/sim/cdsimcontroller.h
+
+SOURCES += \
+    bm-sim-plugin.cpp \
+    ../../plugins/sim/cdsimcontactwriter.cpp \
+    ../../plugins/sim/cdsimcontroller.cpp
+
+INSTALLS += target
@@ -0,0 +1,79 @@
+/** This file is part of Contacts daemon
+ **
+ ** Copyright (c) 2013 Jolla Ltd.
+ **
+ ** Contact: Matt Vogt <matthew.vogt@jollamobile.com>
+ **
+ ** GNU Lesser General Public License Usage
+ ** This file may be used under the terms of the GNU Lesser General Public License
+ ** version 2.1 as published by the Free Software Foundation and appearing in the
+ ** file LICENSE.LGPL included in the packaging of this file.  Please review the
+ ** following information to ensure the GNU Lesser General Public License version
+ ** 2.1 requirements will be met:
+ ** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+ **/
+
+#ifndef TEST_BENCHMARK_H
+#define TEST_BENCHMARK_H
+
+#include <QFile>
+#include <QTemporaryDir>
+#include <QtDebug>
+
+#include <sys/resource.h>
+
+// Keeps the databases created by a benchmark out of the user's data, by using a
+// temporary directory as the generic data location
+class BenchmarkDataDir
+{
+public:
+    bool activate()
+    {
+        if (!m_dir.isValid())
+            return false;
+
+        qputenv("XDG_DATA_HOME", m_dir.path().toUtf8());
+        return true;
+    }
+
+    QString path() const
+    {
+        return m_dir.path();
+    }
+
+private:
+    QTemporaryDir m_dir;
+};
+
+// Resets the peak RSS measurement, where the kernel supports it
+inline void resetPeakRss()
+{
+    QFile file(QStringLiteral("/proc/self/clear_refs"));
+    if (file.open(QIODevice::WriteOnly)) {
+        file.write("5");
+    }
+}
+
+inline qint64 peakRssKb()
+{
+    QFile file(QStringLiteral("/proc/self/status"));
+    if (file.open(QIODevice::ReadOnly)) {
+        foreach (const QByteArray &line, file.readAll().split('\n')) {
+            if (line.startsWith("VmHWM:")) {
+                return line.mid(6).trimmed().split(' ').first().toLongLong();
+            }
+        }
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// Begins a line of benchmark output; these lines are collected from the test logs
+inline QDebug benchmarkResult(const char *name)
+{
+    return qDebug() << "RESULT" << name;
+}
+
+#endif // TEST_BENCHMARK_H
@@ -23,11 +23,11 @@
 PACKAGENAME = contactsd
 
 TEMPLATE = subdirs
-SUBDIRS += libtelepathy ut_birthdayplugin ut_telepathyplugin ut_simplugin
+SUBDIRS += libtelepathy ut_birthdayplugin ut_telepathyplugin ut_simplugin bm_simplugin ut_exporterplugin bm_exporterplugin
 
 ut_telepathyplugin.depends = libtelepathy
 
-UNIT_TESTS += ut_birthdayplugin ut_telepathyplugin ut_simplugin
+UNIT_TESTS += ut_birthdayplugin ut_telepathyplugin ut_simplugin ut_exporterplugin
 
 testxml.target = tests.xml
 testxml.commands = sh $$PWD/mktests.sh $$UNIT_TESTS >$@ || rm -f $@
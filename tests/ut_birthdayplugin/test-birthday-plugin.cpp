@@ -25,6 +25,9 @@
 
 #include <test-common.h>
 
+#include "../../plugins/birthday/cdbirthdaycalendar.h"
+#include "../../plugins/birthday/cdbirthdayupcoming.h"
+
 #include <extendedstorage.h>
 #include <extendedcalendar.h>
 
@@ -32,14 +35,26 @@
 #include <MLocale>
 
 #include <QContactBirthday>
+#include <QContactDisplayLabel>
 #include <QContactName>
 
+#include <QDBusConnection>
+#include <QDBusConnectionInterface>
+#include <QDBusMessage>
+#include <QProcess>
+#include <QSignalSpy>
+
+#include <signal.h>
+
 using namespace ML10N;
 
 // A random ID, from plugins/birthday/cdbirthdaycalendar.cpp.
 const QLatin1String calNotebookId("b1376da7-5555-1111-2222-227549c4e570");
 
 static const int calendarTimeout = 12000; // ms
+static const int daemonTimeout = 10000; // ms
+
+static const QLatin1String daemonService("com.nokia.contactsd");
 
 static void loopWait(int ms)
 {
@@ -60,6 +75,53 @@ QContactId apiId(const QContact &contact) { return contact.id(); }
 QContactLocalId apiId(const QContact &contact) { return contact.localId(); }
 #endif
 
+// Birthday events written directly through a calendar are given contact IDs far above those in use
+static const quint32 calendarTestIdBase = 4000000;
+
+static QContactId calendarTestId(quint32 index)
+{
+    return QContactId::fromString(QStringLiteral("qtcontacts:org.nemomobile.contacts.sqlite::sql-%1")
+                                  .arg(calendarTestIdBase + index));
+}
+
+static QContact calendarTestContact(quint32 index, const QDate &date)
+{
+    QContact contact;
+    contact.setId(calendarTestId(index));
+
+    QContactDisplayLabel displayLabel;
+    displayLabel.setLabel(QStringLiteral("Calendar Test %1").arg(index));
+    contact.saveDetail(&displayLabel);
+
+    QContactBirthday birthday;
+    birthday.setDate(date);
+    contact.saveDetail(&birthday);
+
+    return contact;
+}
+
+// Counts the stored birthday events of the calendar test contacts below \a count
+static int countCalendarTestEvents(quint32 count)
+{
+    mKCal::ExtendedCalendar::Ptr calendar =
+        mKCal::ExtendedCalendar::Ptr(new mKCal::ExtendedCalendar(KDateTime::Spec::LocalZone()));
+    mKCal::ExtendedStorage::Ptr storage =
+        mKCal::ExtendedCalendar::defaultStorage(calendar);
+    storage->open();
+    storage->loadNotebookIncidences(calNotebookId);
+
+    int events = 0;
+    for (quint32 i = 0; i < count; ++i) {
+        const QString uid(QStringLiteral("com.nokia.birthday/%1").arg(calendarTestIdBase + i));
+        if (not calendar->event(uid).isNull()) {
+            ++events;
+        }
+    }
+
+    storage->close();
+    return events;
+}
+
 
 TestBirthdayPlugin::TestBirthdayPlugin(QObject *parent) :
     QObject(parent),
@@ -328,6 +390,243 @@ void TestBirthdayPlugin::testLeapYears()
     }
 }
 
+void TestBirthdayPlugin::testNextOccurrence_data()
+{
+    QTest::addColumn<QDate>("birthDate");
+    QTest::addColumn<QDate>("today");
+    QTest::addColumn<QDate>("expected");
+
+    QTest::newRow("later-this-year") << QDate(1980, 6, 15) << QDate(2014, 3, 1) << QDate(2014, 6, 15);
+    QTest::newRow("today") << QDate(1980, 6, 15) << QDate(2014, 6, 15) << QDate(2014, 6, 15);
+    QTest::newRow("yesterday") << QDate(1980, 6, 15) << QDate(2014, 6, 16) << QDate(2015, 6, 15);
+    QTest::newRow("new-year") << QDate(1980, 1, 1) << QDate(2014, 12, 31) << QDate(2015, 1, 1);
+    QTest::newRow("future-date") << QDate(2020, 5, 1) << QDate(2014, 1, 1) << QDate(2020, 5, 1);
+    QTest::newRow("leap-day-in-leap-year") << QDate(1980, 2, 29) << QDate(2016, 2, 1) << QDate(2016, 2, 29);
+    QTest::newRow("leap-day-in-regular-year") << QDate(1980, 2, 29) << QDate(2014, 2, 1) << QDate(2014, 2, 28);
+    QTest::newRow("leap-day-on-feb-28") << QDate(1980, 2, 29) << QDate(2014, 2, 28) << QDate(2014, 2, 28);
+    QTest::newRow("leap-day-passed") << QDate(1980, 2, 29) << QDate(2014, 3, 1) << QDate(2015, 2, 28);
+    QTest::newRow("leap-day-before-leap-year") << QDate(1980, 2, 29) << QDate(2015, 3, 1) << QDate(2016, 2, 29);
+}
+
+void TestBirthdayPlugin::testNextOccurrence()
+{
+    QFETCH(QDate, birthDate);
+    QFETCH(QDate, today);
+    QFETCH(QDate, expected);
+
+    QCOMPARE(CDBirthdayUpcoming::nextOccurrence(birthDate, today), expected);
+}
+
+void TestBirthdayPlugin::testUpcomingBirthdays()
+{
+    const QDate today = QDate::currentDate();
+    const QString laterID = QUuid::createUuid().toString();
+    const QString soonerID = QUuid::createUuid().toString();
+
+    // Add contacts whose birthdays are the day after tomorrow, and tomorrow.
+    QContactName contactName;
+    contactName.setFirstName(laterID);
+    QContactBirthday contactBirthday;
+    contactBirthday.setDate(today.addDays(2).addYears(-30));
+    QContact later;
+    QVERIFY(later.saveDetail(&contactName));
+    QVERIFY(later.saveDetail(&contactBirthday));
+    QVERIFY(saveContact(later));
+
+    contactName.setFirstName(soonerID);
+    contactBirthday.setDate(today.addDays(1).addYears(-20));
+    QContact sooner;
+    QVERIFY(sooner.saveDetail(&contactName));
+    QVERIFY(sooner.saveDetail(&contactBirthday));
+    QVERIFY(saveContact(sooner));
+
+    // Wait until calendar event gets to calendar.
+    loopWait(calendarTimeout);
+
+    QDBusMessage message = QDBusMessage::createMethodCall(QStringLiteral("com.nokia.contactsd"),
+                                                          QStringLiteral("/birthdays"),
+                                                          QStringLiteral("com.nokia.contactsd.birthdays"),
+                                                          QStringLiteral("upcomingBirthdays"));
+    message.setArguments(QVariantList() << 0u << 500u);
+
+    const QDBusMessage reply = QDBusConnection::sessionBus().call(message);
+    QCOMPARE(reply.type(), QDBusMessage::ReplyMessage);
+    QCOMPARE(reply.arguments().count(), 3);
+
+    const QStringList summaries = reply.arguments().at(1).toStringList();
+    const QStringList dates = reply.arguments().at(2).toStringList();
+    QCOMPARE(summaries.count(), dates.count());
+
+    // The birthdays are ordered by their next occurrence.
+    const int soonerIndex = summaries.indexOf(soonerID);
+    const int laterIndex = summaries.indexOf(laterID);
+    QVERIFY(soonerIndex != -1);
+    QVERIFY(laterIndex > soonerIndex);
+    QCOMPARE(dates.at(soonerIndex), today.addDays(1).toString(Qt::ISODate));
+    QCOMPARE(dates.at(laterIndex), today.addDays(2).toString(Qt::ISODate));
+
+    // Removed contacts are no longer listed.
+    QVERIFY(mManager->removeContact(apiId(sooner)));
+    loopWait(calendarTimeout);
+
+    const QDBusMessage removedReply = QDBusConnection::sessionBus().call(message);
+    QCOMPARE(removedReply.type(), QDBusMessage::ReplyMessage);
+    QVERIFY(not removedReply.arguments().at(1).toStringList().contains(soonerID));
+    QVERIFY(removedReply.arguments().at(1).toStringList().contains(laterID));
+}
+
+void TestBirthdayPlugin::testChangesWhileStopped()
+{
+    if (qgetenv("CONTACTSD_PIDFILE").isEmpty()) {
+        QSKIP("The daemon was not started by with-daemon.sh");
+    }
+
+    const QDate today = QDate::currentDate();
+
+    // Add contacts with birthdays, to be changed and removed while the daemon is stopped.
+    QContactName contactName;
+    contactName.setFirstName(QUuid::createUuid().toString());
+    QContactBirthday changedBirthday;
+    changedBirthday.setDate(today.addYears(-25));
+    QContact changed;
+    QVERIFY(changed.saveDetail(&contactName));
+    QVERIFY(changed.saveDetail(&changedBirthday));
+    QVERIFY(saveContact(changed));
+
+    contactName.setFirstName(QUuid::createUuid().toString());
+    QContactBirthday removedBirthday;
+    removedBirthday.setDate(today.addDays(5).addYears(-40));
+    QContact removed;
+    QVERIFY(removed.saveDetail(&contactName));
+    QVERIFY(removed.saveDetail(&removedBirthday));
+    QVERIFY(saveContact(removed));
+
+    // Wait until calendar event gets to calendar.
+    loopWait(calendarTimeout);
+
+    mKCal::ExtendedCalendar::Ptr calendar =
+        mKCal::ExtendedCalendar::Ptr(new mKCal::ExtendedCalendar(KDateTime::Spec::LocalZone()));
+    mKCal::ExtendedStorage::Ptr storage =
+        mKCal::ExtendedCalendar::defaultStorage(calendar);
+    storage->open();
+    QVERIFY2(not storage->notebook(calNotebookId).isNull(), "No calendar database found");
+
+    QVERIFY2(storage->loadNotebookIncidences(calNotebookId), "Unable to load events from notebook");
+    KCalCore::Event::List eventList = calendar->events();
+    QCOMPARE(countCalendarEvents(eventList, changed), 1);
+    QCOMPARE(countCalendarEvents(eventList, removed), 1);
+    QVERIFY2(storage->close(), "Error closing the calendar");
+
+    QVERIFY2(stopDaemon(), "Unable to stop the daemon");
+
+    // Add, change and remove birthday contacts while no change is notified.
+    changedBirthday.setDate(today.addDays(-3).addYears(-25));
+    QVERIFY(changed.saveDetail(&changedBirthday));
+    QVERIFY(saveContact(changed));
+
+    QVERIFY(mManager->removeContact(apiId(removed)));
+
+    contactName.setFirstName(QUuid::createUuid().toString());
+    QContactBirthday addedBirthday;
+    addedBirthday.setDate(today.addDays(10).addYears(-35));
+    QContact added;
+    QVERIFY(added.saveDetail(&contactName));
+    QVERIFY(added.saveDetail(&addedBirthday));
+    QVERIFY(saveContact(added));
+
+    QVERIFY2(startDaemon(), "Unable to restart the daemon");
+
+    // Wait until the changes made while stopped get to calendar.
+    loopWait(calendarTimeout);
+
+    calendar = mKCal::ExtendedCalendar::Ptr(new mKCal::ExtendedCalendar(KDateTime::Spec::LocalZone()));
+    storage = mKCal::ExtendedCalendar::defaultStorage(calendar);
+    storage->open();
+
+    QVERIFY2(storage->loadNotebookIncidences(calNotebookId), "Unable to load events from notebook");
+    eventList = calendar->events();
+    QCOMPARE(countCalendarEvents(eventList, changed), 1);
+    QCOMPARE(countCalendarEvents(eventList, removed), 0);
+    QCOMPARE(countCalendarEvents(eventList, added), 1);
+
+    // Close the calendar.
+    QVERIFY2(storage->close(), "Error closing the calendar");
+}
+
+void TestBirthdayPlugin::testIndexedBirthday()
+{
+    CDBirthdayCalendar birthdayCalendar(CDBirthdayCalendar::KeepOldDB);
+
+    const QDate date(QDate::currentDate().addYears(-30));
+    birthdayCalendar.beginBatch();
+    birthdayCalendar.updateBirthday(calendarTestContact(0, date));
+    birthdayCalendar.commitBatch();
+    QCOMPARE(countCalendarTestEvents(1), 1);
+
+    // Remove the stored event behind the calendar's back
+    mKCal::ExtendedCalendar::Ptr calendar =
+        mKCal::ExtendedCalendar::Ptr(new mKCal::ExtendedCalendar(KDateTime::Spec::LocalZone()));
+    mKCal::ExtendedStorage::Ptr storage =
+        mKCal::ExtendedCalendar::defaultStorage(calendar);
+    storage->open();
+    QVERIFY2(storage->loadNotebookIncidences(calNotebookId), "Unable to load events from notebook");
+    KCalCore::Event::Ptr event = calendar->event(QStringLiteral("com.nokia.birthday/%1").arg(calendarTestIdBase));
+    QVERIFY(not event.isNull());
+    storage->notebook(calNotebookId)->setIsReadOnly(false);
+    QVERIFY(calendar->deleteEvent(event));
+    QVERIFY(storage->save());
+    QVERIFY2(storage->close(), "Error closing the calendar");
+    QCOMPARE(countCalendarTestEvents(1), 0);
+
+    // The birthday is still served from the index, without loading the events again
+    QCOMPARE(birthdayCalendar.birthday(calendarTestId(0)).date(), date);
+    QCOMPARE(birthdayCalendar.birthdays().value(calendarTestId(0)).date(), date);
+
+    // The upcoming birthdays are filled from the index as well
+    CDBirthdayUpcoming upcoming;
+    birthdayCalendar.setUpcoming(&upcoming);
+    QStringList summaries;
+    QStringList dates;
+    const QList<uint> ids = upcoming.upcomingBirthdays(0, upcoming.upcomingBirthdayCount(), summaries, dates);
+    QVERIFY(ids.contains(calendarTestIdBase));
+}
+
+void TestBirthdayPlugin::testCoalescedRemovals()
+{
+    const quint32 count = 50;
+
+    CDBirthdayCalendar birthdayCalendar(CDBirthdayCalendar::KeepOldDB);
+    QSignalSpy savedSpy(&birthdayCalendar, SIGNAL(batchSaved()));
+
+    const QDate date(QDate::currentDate().addYears(-20));
+    birthdayCalendar.beginBatch();
+    for (quint32 i = 0; i < count; ++i) {
+        birthdayCalendar.updateBirthday(calendarTestContact(i, date));
+    }
+    birthdayCalendar.commitBatch();
+    QCOMPARE(savedSpy.count(), 1);
+    QCOMPARE(countCalendarTestEvents(count), int(count));
+
+    // All removals in a batch are saved together
+    birthdayCalendar.beginBatch();
+    for (quint32 i = 0; i < count; ++i) {
+        birthdayCalendar.deleteBirthday(calendarTestId(i));
+    }
+    QCOMPARE(savedSpy.count(), 1);
+    birthdayCalendar.commitBatch();
+    QCOMPARE(savedSpy.count(), 2);
+    QCOMPARE(countCalendarTestEvents(count), 0);
+
+    // Outside a batch, each change is saved on its own
+    birthdayCalendar.updateBirthday(calendarTestContact(0, date));
+    QCOMPARE(savedSpy.count(), 3);
+    QCOMPARE(countCalendarTestEvents(1), 1);
+
+    birthdayCalendar.deleteBirthday(calendarTestId(0));
+    QCOMPARE(savedSpy.count(), 4);
+    QCOMPARE(countCalendarTestEvents(1), 0);
+}
+
 void TestBirthdayPlugin::cleanupTestCase()
 {
 }
@@ -382,4 +681,49 @@ bool TestBirthdayPlugin::saveContact(QContact &contact)
     return success;
 }
 
+bool TestBirthdayPlugin::stopDaemon()
+{
+    QFile pidFile(QString::fromLocal8Bit(qgetenv("CONTACTSD_PIDFILE")));
+    if (not pidFile.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    const pid_t pid = pidFile.readAll().trimmed().toInt();
+    if (pid <= 0 || ::kill(pid, SIGTERM) != 0) {
+        return false;
+    }
+
+    // The daemon has stopped once it released its service name
+    QDBusConnectionInterface *bus = QDBusConnection::sessionBus().interface();
+    for (int waited = 0; bus->isServiceRegistered(daemonService) && waited < daemonTimeout; waited += 100) {
+        QTest::qWait(100);
+    }
+    return not bus->isServiceRegistered(daemonService);
+}
+
+bool TestBirthdayPlugin::startDaemon()
+{
+    // Started as with-daemon.sh does, which kills it from the PID file when done
+    qint64 pid = 0;
+    if (not QProcess::startDetached(QStringLiteral("/bin/sh"),
+                                    QStringList() << QStringLiteral("-c")
+                                                  << QStringLiteral("exec $CONTACTSD_COMMAND >>contactsd.log 2>&1"),
+                                    QString(), &pid)) {
+        return false;
+    }
+
+    QFile pidFile(QString::fromLocal8Bit(qgetenv("CONTACTSD_PIDFILE")));
+    if (not pidFile.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        return false;
+    }
+    pidFile.write(QByteArray::number(pid));
+    pidFile.close();
+
+    QDBusConnectionInterface *bus = QDBusConnection::sessionBus().interface();
+    for (int waited = 0; not bus->isServiceRegistered(daemonService) && waited < daemonTimeout; waited += 100) {
+        QTest::qWait(100);
+    }
+    return bus->isServiceRegistered(daemonService);
+}
+
 CONTACTSD_TEST_MAIN(TestBirthdayPlugin)
@@ -58,6 +58,13 @@ private Q_SLOTS:
     void testLeapYears_data();
     void testLeapYears();
 
+    void testNextOccurrence_data();
+    void testNextOccurrence();
+    void testUpcomingBirthdays();
+    void testChangesWhileStopped();
+    void testIndexedBirthday();
+    void testCoalescedRemovals();
+
     void cleanupTestCase();
     void cleanup();
 
@@ -67,6 +74,8 @@ private:
     KCalCore::Event::List findCalendarEvents(const KCalCore::Event::List &eventList,
                                              const QContact &contact) const;
     bool saveContact(QContact &contact);
+    bool stopDaemon();
+    bool startDaemon();
 
 private:
     QContactManager *mManager;
@@ -31,7 +31,7 @@ include(tests.pri)
 CONFIG += test link_pkgconfig
 
 QT -= gui
-QT += testlib
+QT += dbus testlib
 DEFINES += ENABLE_DEBUG
 
 PKGCONFIG += Qt5Contacts
@@ -43,19 +43,26 @@ QMAKE_CXXFLAGS +=  -ftest-coverage -fprofile-arcs
 LIBS += -lgcov
 }
 
-HEADERS += test-birthday-plugin.h
+INCLUDEPATH += \
+    ../../plugins/birthday \
+    ../../src
 
-SOURCES += test-birthday-plugin.cpp
+HEADERS += test-birthday-plugin.h \
+    ../../plugins/birthday/cdbirthdaycalendar.h \
+    ../../plugins/birthday/cdbirthdayupcoming.h
+
+SOURCES += test-birthday-plugin.cpp \
+    ../../plugins/birthday/cdbirthdaycalendar.cpp \
+    ../../plugins/birthday/cdbirthdayupcoming.cpp \
+    ../../src/debug.cpp
 
 #gcov stuff
 CONFIG(coverage):{
 INCLUDEPATH += $$TOP_SOURCEDIR/src
-HEADERS += $$TOP_SOURCEDIR/plugins/birthday/cdbirthdaycalendar.h \
-    $$TOP_SOURCEDIR/plugins/birthday/cdbirthdaycontroller.h \
+HEADERS += $$TOP_SOURCEDIR/plugins/birthday/cdbirthdaycontroller.h \
     $$TOP_SOURCEDIR/plugins/birthday/cdbirthdayplugin.h
 
-SOURCES += $$TOP_SOURCEDIRplugins/birthday/cdbirthdaycalendar.cpp \
-    $$TOP_SOURCEDIR/plugins/birthday/cdbirthdaycontroller.cpp \
+SOURCES += $$TOP_SOURCEDIR/plugins/birthday/cdbirthdaycontroller.cpp \
     $$TOP_SOURCEDIR/plugins/birthday/cdbirthdayplugin.cpp
 
 DEFINES += CONTACTSD_PLUGINS_DIR=\\\"$$TOP_SOURCEDIR/plugins/telepathy/\\\"
@@ -180,6 +180,47 @@ void TestContactsd::testImportState()
     QCOMPARE(state.contactsMerged(), 0);
 }
 
+void TestContactsd::testImportProgress()
+{
+    ImportState state;
+
+    // progress of accounts which are not importing is ignored
+    state.updateAccountProgress("gtalk", "gtalk-account1", 10, 90);
+    QCOMPARE(state.serviceContactsProcessed("gtalk"), 0);
+    QCOMPARE(state.serviceRemainingTime("gtalk"), qint64(-1));
+
+    state.addImportingAccount("gtalk", "gtalk-account1");
+    state.addImportingAccount("gtalk", "gtalk-account2");
+    state.addImportingAccount("msn", "msn-account1");
+    QCOMPARE(state.serviceThroughput("gtalk"), 0.0);
+    QCOMPARE(state.serviceRemainingTime("gtalk"), qint64(-1));
+
+    state.updateAccountProgress("gtalk", "gtalk-account1", 10, 90);
+    state.updateAccountProgress("gtalk", "gtalk-account2", 5, 20);
+    state.updateAccountProgress("msn", "msn-account1", 3, 0);
+    QCOMPARE(state.serviceContactsProcessed("gtalk"), 15);
+    QCOMPARE(state.serviceQueueDepth("gtalk"), 110);
+    QCOMPARE(state.serviceContactsProcessed("msn"), 3);
+    QCOMPARE(state.serviceQueueDepth("msn"), 0);
+
+    QVERIFY(state.serviceThroughput("gtalk") > 0.0);
+    QVERIFY(state.serviceRemainingTime("gtalk") > 0);
+    QCOMPARE(state.serviceRemainingTime("msn"), qint64(0));
+
+    // a later report replaces the earlier one
+    state.updateAccountProgress("gtalk", "gtalk-account1", 100, 0);
+    QCOMPARE(state.serviceContactsProcessed("gtalk"), 105);
+    QCOMPARE(state.serviceQueueDepth("gtalk"), 20);
+
+    state.removeImportingAccount("gtalk", "gtalk-account2", 25, 0, 0);
+    QCOMPARE(state.serviceContactsProcessed("gtalk"), 100);
+    QCOMPARE(state.serviceQueueDepth("gtalk"), 0);
+
+    state.reset();
+    QCOMPARE(state.serviceContactsProcessed("gtalk"), 0);
+    QCOMPARE(state.serviceThroughput("msn"), 0.0);
+}
+
 void TestContactsd::testDbusRegister()
 {
     QVERIFY2(not mLoader->registerNotificationService(),
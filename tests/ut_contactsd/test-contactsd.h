@@ -45,6 +45,7 @@ private Q_SLOTS:
     void testLoadPlugins();
     void testInvalid();
     void testImportState();
+    void testImportProgress();
     void testDbusRegister();
 
     void cleanup();
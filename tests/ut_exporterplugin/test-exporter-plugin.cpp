@@ -0,0 +1,860 @@
+/** This file is part of Contacts daemon
+ **
+ ** Copyright (c) 2014 Jolla Ltd.
+ **
+ ** Contact: Matt Vogt <matthew.vogt@jollamobile.com>
+ **
+ ** GNU Lesser General Public License Usage
+ ** This file may be used under the terms of the GNU Lesser General Public License
+ ** version 2.1 as published by the Free Software Foundation and appearing in the
+ ** file LICENSE.LGPL included in the packaging of this file.  Please review the
+ ** following information to ensure the GNU Lesser General Public License version
+ ** 2.1 requirements will be met:
+ ** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+ **/
+
+#include "test-exporter-plugin.h"
+#include "cdexporteravatarmanifest.h"
+#include "cdexporterfingerprint.h"
+#include "cdexporteridmap.h"
+
+#include <test-common.h>
+
+#include <qtcontacts-extensions.h>
+
+#include <QContactAvatar>
+#include <QContactDetailFilter>
+#include <QContactEmailAddress>
+#include <QContactName>
+#include <QContactOnlineAccount>
+#include <QContactPhoneNumber>
+#include <QContactPresence>
+#include <QContactSyncTarget>
+#include <QContactTimestamp>
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QThread>
+
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// As in bm_exporterplugin, the worker is driven directly against databases created
+// in a temporary directory.
+
+namespace {
+
+const QString testSyncTarget(QStringLiteral("exporter-test"));
+const int testContactCount = 5;
+const int resumeContactCount = 2000;
+
+QString managerName()
+{
+    return QStringLiteral("org.nemomobile.contacts.sqlite");
+}
+
+QMap<QString, QString> managerParameters(bool nonprivileged)
+{
+    QMap<QString, QString> rv;
+    rv.insert(QStringLiteral("mergePresenceChanges"), QStringLiteral("false"));
+    if (nonprivileged) {
+        rv.insert(QStringLiteral("nonprivileged"), QStringLiteral("true"));
+    }
+    return rv;
+}
+
+bool writeFile(const QString &path, const QByteArray &data)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    return file.write(data) == data.size();
+}
+
+quint64 fileInode(const QString &path)
+{
+    struct stat info;
+    return ::stat(path.toUtf8().constData(), &info) == 0 ? static_cast<quint64>(info.st_ino) : 0;
+}
+
+QContact createTestContact(int index)
+{
+    QContact contact;
+
+    QContactSyncTarget st;
+    st.setSyncTarget(testSyncTarget);
+    contact.saveDetail(&st);
+
+    QContactName name;
+    name.setFirstName(QStringLiteral("First%1").arg(index));
+    name.setLastName(QStringLiteral("Last%1").arg(index));
+    contact.saveDetail(&name);
+
+    QContactPhoneNumber phone;
+    phone.setNumber(QStringLiteral("+1555%1").arg(index, 7, 10, QLatin1Char('0')));
+    contact.saveDetail(&phone);
+
+    return contact;
+}
+
+}
+
+TestExporterPlugin::TestExporterPlugin(QObject *parent) :
+    QObject(parent),
+    m_privilegedManager(0),
+    m_nonprivilegedManager(0),
+    m_worker(0)
+{
+}
+
+void TestExporterPlugin::initTestCase()
+{
+    QVERIFY(m_dataDir.isValid());
+
+    // The databases are located under the generic data location, and the privileged
+    // database is only used where its directory exists
+    qputenv("XDG_DATA_HOME", m_dataDir.path().toUtf8());
+    QVERIFY(QDir::root().mkpath(m_dataDir.path() + QStringLiteral("/system/privileged/Contacts/avatars")));
+    QVERIFY(QDir::root().mkpath(m_dataDir.path() + QStringLiteral("/system/Contacts/avatars")));
+
+    // An avatar stored where only privileged apps can read it
+    m_avatarPath = m_dataDir.path() + QStringLiteral("/system/privileged/Contacts/avatars/avatar0.jpg");
+    QFile avatar(m_avatarPath);
+    QVERIFY(avatar.open(QIODevice::WriteOnly));
+    avatar.write("avatar");
+    avatar.close();
+
+    m_privilegedManager = new QContactManager(managerName(), managerParameters(false));
+    m_nonprivilegedManager = new QContactManager(managerName(), managerParameters(true));
+
+    qRegisterMetaType<QList<QContactId> >();
+
+    m_worker = new CDExporterWorker(&m_preemptRequest);
+    m_worker->initialize();
+}
+
+QList<QContact> TestExporterPlugin::testContacts(QContactManager &manager) const
+{
+    QContactDetailFilter stFilter;
+    stFilter.setDetailType(QContactSyncTarget::Type, QContactSyncTarget::FieldSyncTarget);
+    stFilter.setValue(testSyncTarget);
+
+    return manager.contacts(stFilter);
+}
+
+QList<QContact> TestExporterPlugin::exportedContacts() const
+{
+    QContactDetailFilter stFilter;
+    stFilter.setDetailType(QContactSyncTarget::Type, QContactSyncTarget::FieldSyncTarget);
+    stFilter.setValue(QStringLiteral("aggregate"));
+
+    return m_nonprivilegedManager->contacts(stFilter);
+}
+
+QContact TestExporterPlugin::exportedContact(const QString &firstName) const
+{
+    return aggregateContact(*m_nonprivilegedManager, firstName);
+}
+
+QContact TestExporterPlugin::aggregateContact(QContactManager &manager, const QString &firstName) const
+{
+    QContactDetailFilter stFilter;
+    stFilter.setDetailType(QContactSyncTarget::Type, QContactSyncTarget::FieldSyncTarget);
+    stFilter.setValue(QStringLiteral("aggregate"));
+
+    foreach (const QContact &contact, manager.contacts(stFilter)) {
+        if (contact.detail<QContactName>().firstName() == firstName) {
+            return contact;
+        }
+    }
+    return QContact();
+}
+
+QContact TestExporterPlugin::testContact(QContactManager &manager, const QString &firstName) const
+{
+    foreach (const QContact &contact, testContacts(manager)) {
+        if (contact.detail<QContactName>().firstName() == firstName) {
+            return contact;
+        }
+    }
+    return QContact();
+}
+
+// Runs a complete verification cycle, reporting the totals found
+bool TestExporterPlugin::runVerify(CDExporterWorker *worker, int *drifted, int *repaired)
+{
+    QSignalSpy verifiedSpy(worker, SIGNAL(verified(bool,int,int,int,bool)));
+
+    *drifted = 0;
+    *repaired = 0;
+
+    bool cycleComplete = false;
+    while (!cycleComplete) {
+        worker->verify();
+        if (verifiedSpy.count() != 1) {
+            return false;
+        }
+
+        const QList<QVariant> arguments(verifiedSpy.takeFirst());
+        if (!arguments.at(0).toBool()) {
+            return false;
+        }
+        *drifted += arguments.at(2).toInt();
+        *repaired += arguments.at(3).toInt();
+        cycleComplete = arguments.at(4).toBool();
+    }
+
+    return true;
+}
+
+void TestExporterPlugin::testIdMapRoundTrip()
+{
+    CDExporterIdMap idMap;
+    idMap.load(QByteArray(), QList<QByteArray>());
+    QVERIFY(idMap.isLoaded());
+    QVERIFY(idMap.isEmpty());
+
+    idMap.registerPair(1, 101);
+    idMap.registerPair(2, 102);
+    idMap.registerPair(3, 103);
+    QVERIFY(idMap.hasPendingChanges());
+
+    // Store a snapshot, then only the changes made since
+    const QByteArray snapshot(idMap.snapshotData());
+    idMap.committed(true);
+    QVERIFY(!idMap.hasPendingChanges());
+
+    idMap.deregisterPair(2, 102);
+    idMap.registerPair(4, 104);
+    idMap.registerPair(4, 104);     // Already registered; not recorded again
+    const QByteArray deltas(idMap.deltaSegmentData());
+    idMap.committed(false);
+
+    CDExporterIdMap reloaded;
+    reloaded.load(snapshot, QList<QByteArray>() << deltas);
+    QVERIFY(reloaded.isLoaded());
+    QVERIFY(!reloaded.hasPendingChanges());
+
+    QList<quint32> privilegedIds(reloaded.privilegedIds());
+    qSort(privilegedIds);
+    QCOMPARE(privilegedIds, QList<quint32>() << 1 << 3 << 4);
+    QCOMPARE(reloaded.nonprivilegedId(1), 101u);
+    QCOMPARE(reloaded.nonprivilegedId(2), 0u);
+    QCOMPARE(reloaded.nonprivilegedId(4), 104u);
+    QCOMPARE(reloaded.privilegedId(103), 3u);
+    QCOMPARE(reloaded.privilegedId(102), 0u);
+
+    // Further deltas are appended to those already stored
+    reloaded.registerPair(5, 105);
+    const QByteArray moreDeltas(reloaded.deltaSegmentData());
+    QVERIFY(moreDeltas.startsWith(deltas));
+
+    CDExporterIdMap extended;
+    extended.load(snapshot, QList<QByteArray>() << moreDeltas);
+    QCOMPARE(extended.nonprivilegedId(5), 105u);
+    QCOMPARE(extended.privilegedIds().count(), 4);
+}
+
+void TestExporterPlugin::testIdMapTruncatedDeltas()
+{
+    CDExporterIdMap idMap;
+    idMap.load(QByteArray(), QList<QByteArray>());
+    idMap.registerPair(1, 101);
+    idMap.registerPair(2, 102);
+    const QByteArray deltas(idMap.deltaSegmentData());
+
+    // An interrupted store leaves a partial delta record, which is discarded
+    CDExporterIdMap reloaded;
+    reloaded.load(QByteArray(), QList<QByteArray>() << deltas.left(deltas.size() - 3));
+    QVERIFY(reloaded.isLoaded());
+    QCOMPARE(reloaded.nonprivilegedId(1), 101u);
+    QCOMPARE(reloaded.nonprivilegedId(2), 0u);
+
+    // The valid mapping must be rewritten in full
+    QVERIFY(reloaded.needsCompaction());
+
+    CDExporterIdMap compacted;
+    compacted.load(reloaded.snapshotData(), QList<QByteArray>());
+    QCOMPARE(compacted.privilegedIds(), QList<quint32>() << 1);
+}
+
+void TestExporterPlugin::testIdMapDeltaSegments()
+{
+    CDExporterIdMap idMap;
+    idMap.load(QByteArray(), QList<QByteArray>());
+
+    // Store the deltas as an export does, after each chunk
+    QMap<int, QByteArray> storedSegments;
+    int largestStore = 0;
+    for (quint32 chunk = 0; chunk < 20; ++chunk) {
+        for (quint32 i = 1; i <= 100; ++i) {
+            idMap.registerPair(chunk * 100 + i, 10000 + chunk * 100 + i);
+        }
+
+        const QByteArray data(idMap.deltaSegmentData());
+        storedSegments.insert(idMap.deltaSegmentIndex(), data);
+        largestStore = qMax(largestStore, data.size());
+        idMap.committed(false);
+    }
+
+    // Each store rewrites only a bounded segment, rather than all the deltas
+    QVERIFY(storedSegments.count() > 1);
+    QCOMPARE(idMap.storedSegmentCount(), storedSegments.count());
+    QVERIFY(largestStore < storedSegments.value(0).size() * 2);
+
+    CDExporterIdMap reloaded;
+    reloaded.load(QByteArray(), storedSegments.values());
+    QCOMPARE(reloaded.privilegedIds().count(), 2000);
+    QCOMPARE(reloaded.nonprivilegedId(1), 10001u);
+    QCOMPARE(reloaded.nonprivilegedId(2000), 12000u);
+    QCOMPARE(reloaded.storedSegmentCount(), storedSegments.count());
+
+    // Once compacted, the segments are no longer needed
+    QVERIFY(reloaded.needsCompaction());
+    reloaded.committed(true);
+    QCOMPARE(reloaded.storedSegmentCount(), 0);
+    QCOMPARE(reloaded.deltaSegmentIndex(), 0);
+}
+
+void TestExporterPlugin::testIdMapLegacyMigration()
+{
+    // Earlier versions stored the mapping as ID strings, keyed by the nonprivileged ID
+    QMap<QString, QString> legacyIds;
+    legacyIds.insert(QtContactsSqliteExtensions::apiContactId(101).toString(),
+                     QtContactsSqliteExtensions::apiContactId(1).toString());
+    legacyIds.insert(QtContactsSqliteExtensions::apiContactId(102).toString(),
+                     QtContactsSqliteExtensions::apiContactId(2).toString());
+    legacyIds.insert(QStringLiteral("invalid"), QtContactsSqliteExtensions::apiContactId(3).toString());
+
+    CDExporterIdMap idMap;
+    idMap.loadLegacy(legacyIds);
+    QVERIFY(idMap.isLoaded());
+    QCOMPARE(idMap.nonprivilegedId(1), 101u);
+    QCOMPARE(idMap.privilegedId(102), 2u);
+    QCOMPARE(idMap.nonprivilegedId(3), 0u);
+
+    // The converted mapping is stored as a snapshot
+    QVERIFY(idMap.needsCompaction());
+
+    CDExporterIdMap converted;
+    converted.load(idMap.snapshotData(), QList<QByteArray>());
+    QList<quint32> privilegedIds(converted.privilegedIds());
+    qSort(privilegedIds);
+    QCOMPARE(privilegedIds, QList<quint32>() << 1 << 2);
+    QCOMPARE(converted.nonprivilegedId(2), 102u);
+}
+
+void TestExporterPlugin::testFingerprintIgnoresOrder()
+{
+    QContactPhoneNumber mobile;
+    mobile.setNumber(QStringLiteral("+15550000001"));
+    QContactPhoneNumber home;
+    home.setNumber(QStringLiteral("+15550000002"));
+    QContactEmailAddress email;
+    email.setEmailAddress(QStringLiteral("first@example.com"));
+
+    QContact first;
+    first.saveDetail(&mobile);
+    first.saveDetail(&home);
+    first.saveDetail(&email);
+
+    QContact second;
+    second.saveDetail(&email);
+    second.saveDetail(&home);
+    second.saveDetail(&mobile);
+
+    const QSet<QContactDetail::DetailType> excluded;
+    QCOMPARE(CDExporterFingerprint::typeHashes(first, excluded), CDExporterFingerprint::typeHashes(second, excluded));
+    QCOMPARE(CDExporterFingerprint::contactHash(first, excluded), CDExporterFingerprint::contactHash(second, excluded));
+
+    // A different value of the same type is detected
+    QContactPhoneNumber work;
+    work.setNumber(QStringLiteral("+15550000003"));
+    second.removeDetail(&home);
+    second.saveDetail(&work);
+    QVERIFY(CDExporterFingerprint::contactHash(first, excluded) != CDExporterFingerprint::contactHash(second, excluded));
+}
+
+void TestExporterPlugin::testFingerprintIgnoresUris()
+{
+    // Detail URIs are mangled differently in each database, and provenance is not exported
+    QContactPhoneNumber privilegedPhone;
+    privilegedPhone.setNumber(QStringLiteral("+15550000001"));
+    privilegedPhone.setDetailUri(QStringLiteral("aggregate-5:phone"));
+    privilegedPhone.setLinkedDetailUris(QStringLiteral("aggregate-5:account"));
+    privilegedPhone.setValue(QContactDetail__FieldProvenance, QStringLiteral("3:1:0"));
+
+    QContactPhoneNumber exportedPhone;
+    exportedPhone.setNumber(QStringLiteral("+15550000001"));
+    exportedPhone.setDetailUri(QStringLiteral("phone"));
+
+    QCOMPARE(CDExporterFingerprint::detailHash(privilegedPhone), CDExporterFingerprint::detailHash(exportedPhone));
+
+    exportedPhone.setSubTypes(QList<int>() << QContactPhoneNumber::SubTypeMobile);
+    QVERIFY(CDExporterFingerprint::detailHash(privilegedPhone) != CDExporterFingerprint::detailHash(exportedPhone));
+}
+
+void TestExporterPlugin::testFingerprintChangedTypes()
+{
+    QContactName name;
+    name.setFirstName(QStringLiteral("First"));
+    QContactPhoneNumber phone;
+    phone.setNumber(QStringLiteral("+15550000001"));
+    QContactPresence presence;
+    presence.setPresenceState(QContactPresence::PresenceAvailable);
+
+    QContact oldContact;
+    oldContact.saveDetail(&name);
+    oldContact.saveDetail(&phone);
+    oldContact.saveDetail(&presence);
+
+    QContact newContact(oldContact);
+    presence.setPresenceState(QContactPresence::PresenceAway);
+    newContact.saveDetail(&presence);
+
+    QSet<QContactDetail::DetailType> excluded;
+    QCOMPARE(CDExporterFingerprint::changedTypes(CDExporterFingerprint::typeHashes(oldContact, excluded),
+                                                 CDExporterFingerprint::typeHashes(newContact, excluded)),
+             QSet<QContactDetail::DetailType>() << QContactDetail::TypePresence);
+
+    // Added and removed types are reported, and excluded types are not
+    QContactEmailAddress email;
+    email.setEmailAddress(QStringLiteral("first@example.com"));
+    newContact.saveDetail(&email);
+    newContact.removeDetail(&phone);
+
+    QCOMPARE(CDExporterFingerprint::changedTypes(CDExporterFingerprint::typeHashes(oldContact, excluded),
+                                                 CDExporterFingerprint::typeHashes(newContact, excluded)),
+             QSet<QContactDetail::DetailType>() << QContactDetail::TypePresence << QContactDetail::TypeEmailAddress
+                                                << QContactDetail::TypePhoneNumber);
+
+    excluded.insert(QContactDetail::TypePresence);
+    excluded.insert(QContactDetail::TypeEmailAddress);
+    excluded.insert(QContactDetail::TypePhoneNumber);
+    QVERIFY(CDExporterFingerprint::changedTypes(CDExporterFingerprint::typeHashes(oldContact, excluded),
+                                                CDExporterFingerprint::typeHashes(newContact, excluded)).isEmpty());
+}
+
+void TestExporterPlugin::setTestPhoneNumber(const QString &firstName, const QString &number)
+{
+    QContact constituent(testContact(*m_privilegedManager, firstName));
+    QVERIFY(!constituent.id().isNull());
+
+    QContactPhoneNumber phone(constituent.detail<QContactPhoneNumber>());
+    phone.setNumber(number);
+    constituent.saveDetail(&phone);
+    QVERIFY(m_privilegedManager->saveContact(&constituent));
+}
+
+void TestExporterPlugin::testAvatarManifestLink()
+{
+    const QString privilegedPath(m_dataDir.path() + QStringLiteral("/manifest/privileged/Contacts/avatars/link.jpg"));
+    const QString linkPath(m_dataDir.path() + QStringLiteral("/manifest/Contacts/avatars/link.jpg"));
+    QVERIFY(QDir::root().mkpath(QFileInfo(privilegedPath).path()));
+    QVERIFY(writeFile(privilegedPath, "link"));
+
+    CDExporterAvatarManifest manifest;
+    manifest.load(QByteArray());
+
+    // The link and its directory are created for a new file
+    QString nonprivilegedPath;
+    QVERIFY(manifest.link(privilegedPath, &nonprivilegedPath));
+    QCOMPARE(nonprivilegedPath, linkPath);
+    QCOMPARE(fileInode(linkPath), fileInode(privilegedPath));
+    QVERIFY(manifest.isModified());
+    manifest.committed();
+
+    // An unchanged file reuses the recorded link
+    nonprivilegedPath.clear();
+    QVERIFY(manifest.link(privilegedPath, &nonprivilegedPath));
+    QCOMPARE(nonprivilegedPath, linkPath);
+    QVERIFY(!manifest.isModified());
+
+    // The record is reused after reloading, even if the link itself has been removed
+    CDExporterAvatarManifest reloaded;
+    reloaded.load(manifest.data());
+    QVERIFY(QFile::remove(linkPath));
+    nonprivilegedPath.clear();
+    QVERIFY(reloaded.linkedPath(privilegedPath, &nonprivilegedPath));
+    QCOMPARE(nonprivilegedPath, linkPath);
+    QVERIFY(reloaded.link(privilegedPath, &nonprivilegedPath));
+    QCOMPARE(nonprivilegedPath, linkPath);
+    QVERIFY(!reloaded.isModified());
+    QVERIFY(!QFile::exists(linkPath));
+}
+
+void TestExporterPlugin::testAvatarManifestReplace()
+{
+    const QString privilegedPath(m_dataDir.path() + QStringLiteral("/manifest/privileged/Contacts/avatars/replace.jpg"));
+    const QString replacementPath(m_dataDir.path() + QStringLiteral("/manifest/privileged/Contacts/avatars/replace.tmp"));
+    const QString linkPath(m_dataDir.path() + QStringLiteral("/manifest/Contacts/avatars/replace.jpg"));
+    QVERIFY(QDir::root().mkpath(QFileInfo(privilegedPath).path()));
+    QVERIFY(writeFile(privilegedPath, "original"));
+
+    CDExporterAvatarManifest manifest;
+    manifest.load(QByteArray());
+
+    QString nonprivilegedPath;
+    QVERIFY(manifest.link(privilegedPath, &nonprivilegedPath));
+    const quint64 originalInode(fileInode(linkPath));
+    QCOMPARE(originalInode, fileInode(privilegedPath));
+    manifest.committed();
+
+    // Replace the file; the existing link keeps the original from being reused
+    QVERIFY(writeFile(replacementPath, "replacement"));
+    QCOMPARE(::rename(replacementPath.toUtf8().constData(), privilegedPath.toUtf8().constData()), 0);
+    QVERIFY(fileInode(privilegedPath) != originalInode);
+
+    // The stale link is replaced by one to the new file
+    QVERIFY(manifest.link(privilegedPath, &nonprivilegedPath));
+    QCOMPARE(nonprivilegedPath, linkPath);
+    QCOMPARE(fileInode(linkPath), fileInode(privilegedPath));
+    QVERIFY(manifest.isModified());
+
+    QFile link(linkPath);
+    QVERIFY(link.open(QIODevice::ReadOnly));
+    QCOMPARE(link.readAll(), QByteArray("replacement"));
+}
+
+void TestExporterPlugin::testAvatarManifestRelease()
+{
+    const QString privilegedPath(m_dataDir.path() + QStringLiteral("/manifest/privileged/Contacts/avatars/release.jpg"));
+    const QString linkPath(m_dataDir.path() + QStringLiteral("/manifest/Contacts/avatars/release.jpg"));
+    QVERIFY(QDir::root().mkpath(QFileInfo(privilegedPath).path()));
+    QVERIFY(writeFile(privilegedPath, "release"));
+
+    CDExporterAvatarManifest manifest;
+    manifest.load(QByteArray());
+
+    QString nonprivilegedPath;
+    QVERIFY(manifest.link(privilegedPath, &nonprivilegedPath));
+    manifest.committed();
+
+    // Other contacts may still refer to an existing file
+    manifest.release(privilegedPath);
+    QVERIFY(QFile::exists(linkPath));
+    QVERIFY(!manifest.isModified());
+
+    // Once the file is removed, so is its link
+    QVERIFY(QFile::remove(privilegedPath));
+    manifest.release(privilegedPath);
+    QVERIFY(!QFile::exists(linkPath));
+    QVERIFY(manifest.isModified());
+
+    QVERIFY(!manifest.link(privilegedPath, &nonprivilegedPath));
+    QVERIFY(!manifest.linkedPath(privilegedPath, &nonprivilegedPath));
+
+    // A removed file found when linking is released too
+    QVERIFY(writeFile(privilegedPath, "release"));
+    QVERIFY(manifest.link(privilegedPath, &nonprivilegedPath));
+    QVERIFY(QFile::exists(linkPath));
+    manifest.committed();
+
+    QVERIFY(QFile::remove(privilegedPath));
+    QVERIFY(!manifest.link(privilegedPath, &nonprivilegedPath));
+    QVERIFY(!QFile::exists(linkPath));
+    QVERIFY(manifest.isModified());
+    QVERIFY(manifest.data().isEmpty());
+}
+
+void TestExporterPlugin::testExport()
+{
+    QList<QContact> contacts;
+    for (int i = 0; i < testContactCount; ++i) {
+        contacts.append(createTestContact(i));
+    }
+
+    QContactAvatar avatar;
+    avatar.setImageUrl(QUrl::fromLocalFile(m_avatarPath));
+    contacts[0].saveDetail(&avatar);
+
+    QVERIFY(m_privilegedManager->saveContacts(&contacts));
+
+    QSignalSpy finishedSpy(m_worker, SIGNAL(syncFinished(bool,bool,bool,QList<QContactId>,QList<QContactId>,qint64)));
+    m_worker->sync(true, QList<QContactId>(), QList<QContactId>(), false, false);
+    QCOMPARE(finishedSpy.count(), 1);
+    QCOMPARE(finishedSpy.takeFirst().at(0).toBool(), true);
+
+    QCOMPARE(exportedContacts().count(), testContactCount);
+
+    // The exported avatar refers to a link accessible to non-privileged apps
+    const QString linkPath(m_dataDir.path() + QStringLiteral("/system/Contacts/avatars/avatar0.jpg"));
+    const QContact exported(exportedContact(QStringLiteral("First0")));
+    QCOMPARE(exported.detail<QContactAvatar>().imageUrl(), QUrl::fromLocalFile(linkPath));
+    QVERIFY(QFile::exists(linkPath));
+}
+
+void TestExporterPlugin::testVerifyUnchanged()
+{
+    int drifted = -1;
+    int repaired = -1;
+    QVERIFY(runVerify(m_worker, &drifted, &repaired));
+    QCOMPARE(drifted, 0);
+    QCOMPARE(repaired, 0);
+}
+
+void TestExporterPlugin::testVerifyAfterRestart()
+{
+    // A new worker has no record of the forms it exported, and must derive them
+    QAtomicInt preemptRequest;
+    CDExporterWorker worker(&preemptRequest);
+    worker.initialize();
+
+    // Load the export state; nothing has changed, so nothing is exported
+    QSignalSpy finishedSpy(&worker, SIGNAL(syncFinished(bool,bool,bool,QList<QContactId>,QList<QContactId>,qint64)));
+    worker.sync(true, QList<QContactId>(), QList<QContactId>(), false, false);
+    QCOMPARE(finishedSpy.count(), 1);
+    QCOMPARE(finishedSpy.takeFirst().at(0).toBool(), true);
+
+    // Remove the avatar link; verification must neither report it nor recreate it
+    const QString linkPath(m_dataDir.path() + QStringLiteral("/system/Contacts/avatars/avatar0.jpg"));
+    QVERIFY(QFile::remove(linkPath));
+
+    int drifted = -1;
+    int repaired = -1;
+    QVERIFY(runVerify(&worker, &drifted, &repaired));
+    QCOMPARE(drifted, 0);
+    QCOMPARE(repaired, 0);
+
+    QVERIFY(!QFile::exists(linkPath));
+
+    // Restore the link for the remaining tests
+    QCOMPARE(::link(m_avatarPath.toUtf8().constData(), linkPath.toUtf8().constData()), 0);
+}
+
+void TestExporterPlugin::testVerifyRepairsDrift()
+{
+    // Modify an exported contact behind the exporter's back
+    QContact exported(exportedContact(QStringLiteral("First2")));
+    QVERIFY(!exported.id().isNull());
+
+    QContactPhoneNumber phone(exported.detail<QContactPhoneNumber>());
+    phone.setNumber(QStringLiteral("+19990000000"));
+    exported.saveDetail(&phone);
+
+    QList<QContact> drifted;
+    drifted.append(exported);
+    QList<QContactDetail::DetailType> mask;
+    mask << QContactPhoneNumber::Type;
+    QVERIFY(m_nonprivilegedManager->saveContacts(&drifted, mask));
+
+    int driftedCount = -1;
+    int repairedCount = -1;
+    QVERIFY(runVerify(m_worker, &driftedCount, &repairedCount));
+    QCOMPARE(driftedCount, 1);
+    QCOMPARE(repairedCount, 1);
+
+    // The exported form is restored from the privileged DB
+    const QContact repaired(exportedContact(QStringLiteral("First2")));
+    QCOMPARE(repaired.id(), exported.id());
+    QCOMPARE(repaired.detail<QContactPhoneNumber>().number(), QStringLiteral("+15550000002"));
+
+    // Once repaired, no further drift is found
+    QVERIFY(runVerify(m_worker, &driftedCount, &repairedCount));
+    QCOMPARE(driftedCount, 0);
+    QCOMPARE(repairedCount, 0);
+
+    QCOMPARE(testContacts(*m_privilegedManager).count(), testContactCount);
+}
+
+void TestExporterPlugin::testPreemptedSync()
+{
+    setTestPhoneNumber(QStringLiteral("First4"), QStringLiteral("+19990000004"));
+
+    // A full pass preempted before it exports anything leaves the export DB unchanged
+    QSignalSpy finishedSpy(m_worker, SIGNAL(syncFinished(bool,bool,bool,QList<QContactId>,QList<QContactId>,qint64)));
+    m_preemptRequest.store(1);
+    m_worker->sync(true, QList<QContactId>(), QList<QContactId>(), false, false);
+    QCOMPARE(finishedSpy.count(), 1);
+    QList<QVariant> arguments(finishedSpy.takeFirst());
+    QCOMPARE(arguments.at(0).toBool(), false);
+    QCOMPARE(arguments.at(1).toBool(), true);
+    QCOMPARE(exportedContact(QStringLiteral("First4")).detail<QContactPhoneNumber>().number(), QStringLiteral("+15550000004"));
+
+    // The repeated pass exports the change
+    m_preemptRequest.store(0);
+    m_worker->sync(true, QList<QContactId>(), QList<QContactId>(), false, false);
+    QCOMPARE(finishedSpy.count(), 1);
+    arguments = finishedSpy.takeFirst();
+    QCOMPARE(arguments.at(0).toBool(), true);
+    QCOMPARE(arguments.at(1).toBool(), false);
+    QCOMPARE(exportedContact(QStringLiteral("First4")).detail<QContactPhoneNumber>().number(), QStringLiteral("+19990000004"));
+
+    // Notified passes are not preemptable
+    setTestPhoneNumber(QStringLiteral("First4"), QStringLiteral("+15550000004"));
+    const QContact aggregate(aggregateContact(*m_privilegedManager, QStringLiteral("First4")));
+    QVERIFY(!aggregate.id().isNull());
+
+    m_preemptRequest.store(1);
+    m_worker->sync(false, QList<QContactId>() << aggregate.id(), QList<QContactId>(), false, false);
+    m_preemptRequest.store(0);
+    QCOMPARE(finishedSpy.count(), 1);
+    arguments = finishedSpy.takeFirst();
+    QCOMPARE(arguments.at(0).toBool(), true);
+    QCOMPARE(arguments.at(1).toBool(), false);
+    QCOMPARE(exportedContact(QStringLiteral("First4")).detail<QContactPhoneNumber>().number(), QStringLiteral("+15550000004"));
+}
+
+void TestExporterPlugin::testMirrorPresence()
+{
+    QContact constituent(testContact(*m_privilegedManager, QStringLiteral("First1")));
+    QVERIFY(!constituent.id().isNull());
+
+    QContactOnlineAccount account;
+    account.setAccountUri(QStringLiteral("first1@example.com"));
+    constituent.saveDetail(&account);
+
+    QContactPresence presence;
+    presence.setPresenceState(QContactPresence::PresenceAvailable);
+    presence.setNickname(QStringLiteral("firstie"));
+    presence.setLinkedDetailUris(account.detailUri());
+    constituent.saveDetail(&presence);
+    QVERIFY(m_privilegedManager->saveContact(&constituent));
+
+    // A contact not yet exported cannot be mirrored
+    QContact unexported(createTestContact(9));
+    QVERIFY(m_privilegedManager->saveContact(&unexported));
+
+    const QContact aggregate(aggregateContact(*m_privilegedManager, QStringLiteral("First1")));
+    const QContact unexportedAggregate(aggregateContact(*m_privilegedManager, QStringLiteral("First9")));
+    QVERIFY(!aggregate.id().isNull());
+    QVERIFY(!unexportedAggregate.id().isNull());
+
+    const QContact before(exportedContact(QStringLiteral("First1")));
+    QVERIFY(before.details<QContactPresence>().isEmpty());
+
+    QSignalSpy mirroredSpy(m_worker, SIGNAL(presenceMirrored(QList<QContactId>)));
+    m_worker->mirrorPresence(QList<QContactId>() << aggregate.id() << unexportedAggregate.id());
+    QCOMPARE(mirroredSpy.count(), 1);
+    QCOMPARE(mirroredSpy.takeFirst().at(0).value<QList<QContactId> >(), QList<QContactId>() << unexportedAggregate.id());
+
+    // Only the presence details of the exported copy are updated
+    const QContact after(exportedContact(QStringLiteral("First1")));
+    QCOMPARE(after.id(), before.id());
+    QCOMPARE(after.details<QContactPresence>().count(), 1);
+    QCOMPARE(after.detail<QContactPresence>().presenceState(), QContactPresence::PresenceAvailable);
+    QCOMPARE(after.detail<QContactPresence>().nickname(), QStringLiteral("firstie"));
+    QCOMPARE(after.detail<QContactOnlineAccount>().accountUri(), QStringLiteral("first1@example.com"));
+    QCOMPARE(after.detail<QContactName>(), before.detail<QContactName>());
+    QCOMPARE(after.detail<QContactPhoneNumber>().number(), before.detail<QContactPhoneNumber>().number());
+    QVERIFY(exportedContact(QStringLiteral("First9")).id().isNull());
+
+    QVERIFY(m_privilegedManager->removeContact(unexported.id()));
+}
+
+void TestExporterPlugin::testResumeInterruptedExport()
+{
+    QList<QContact> contacts;
+    for (int i = 0; i < resumeContactCount; ++i) {
+        contacts.append(createTestContact(100 + i));
+    }
+    QVERIFY(m_privilegedManager->saveContacts(&contacts));
+
+    QContactDetailFilter stFilter;
+    stFilter.setDetailType(QContactSyncTarget::Type, QContactSyncTarget::FieldSyncTarget);
+    stFilter.setValue(QStringLiteral("aggregate"));
+    const int initialCount(m_nonprivilegedManager->contactIds(stFilter).count());
+
+    // Run the export on a thread of its own, and interrupt it once some chunks are committed
+    QAtomicInt preemptRequest;
+    QThread thread;
+    CDExporterWorker *worker = new CDExporterWorker(&preemptRequest);
+    worker->moveToThread(&thread);
+    connect(&thread, SIGNAL(finished()), worker, SLOT(deleteLater()));
+    QSignalSpy finishedSpy(worker, SIGNAL(syncFinished(bool,bool,bool,QList<QContactId>,QList<QContactId>,qint64)));
+    thread.start();
+
+    QMetaObject::invokeMethod(worker, "initialize", Qt::QueuedConnection);
+    QMetaObject::invokeMethod(worker, "sync", Qt::QueuedConnection,
+                              Q_ARG(bool, true),
+                              Q_ARG(QList<QContactId>, QList<QContactId>()),
+                              Q_ARG(QList<QContactId>, QList<QContactId>()),
+                              Q_ARG(bool, false),
+                              Q_ARG(bool, false));
+
+    while (finishedSpy.count() == 0 && m_nonprivilegedManager->contactIds(stFilter).count() == initialCount) {
+        QTest::qWait(5);
+    }
+    preemptRequest.store(1);
+    QTRY_COMPARE_WITH_TIMEOUT(finishedSpy.count(), 1, 60000);
+
+    thread.quit();
+    thread.wait();
+
+    // The mapping of the replaced worker is out of date; a new one reads the stored state
+    delete m_worker;
+    m_worker = new CDExporterWorker(&m_preemptRequest);
+    m_worker->initialize();
+
+    const QList<QVariant> arguments(finishedSpy.takeFirst());
+    if (!arguments.at(1).toBool()) {
+        QSKIP("Export completed before it could be interrupted");
+    }
+
+    // The contacts committed before the interruption remain exported
+    QHash<QContactId, QDateTime> interruptedTimestamps;
+    foreach (const QContact &contact, exportedContacts()) {
+        interruptedTimestamps.insert(contact.id(), contact.detail<QContactTimestamp>().lastModified());
+    }
+    QVERIFY(interruptedTimestamps.count() > initialCount);
+    QVERIFY(interruptedTimestamps.count() < initialCount + resumeContactCount);
+
+    QSignalSpy resumedSpy(m_worker, SIGNAL(syncFinished(bool,bool,bool,QList<QContactId>,QList<QContactId>,qint64)));
+    m_worker->sync(true, QList<QContactId>(), QList<QContactId>(), false, false);
+    QCOMPARE(resumedSpy.count(), 1);
+    QCOMPARE(resumedSpy.takeFirst().at(0).toBool(), true);
+
+    // The remaining contacts are exported, without exporting again those already done
+    const QList<QContact> exported(exportedContacts());
+    QCOMPARE(exported.count(), initialCount + resumeContactCount);
+    foreach (const QContact &contact, exported) {
+        QHash<QContactId, QDateTime>::const_iterator it = interruptedTimestamps.constFind(contact.id());
+        if (it != interruptedTimestamps.constEnd()) {
+            QCOMPARE(contact.detail<QContactTimestamp>().lastModified(), *it);
+        }
+    }
+}
+
+void TestExporterPlugin::testNotifiedSyncKeepsExportDeletion()
+{
+    const int exportedCount(exportedContacts().count());
+
+    const QContact exported(exportedContact(QStringLiteral("First3")));
+    QVERIFY(!exported.id().isNull());
+    const QContact aggregate(aggregateContact(*m_privilegedManager, QStringLiteral("First3")));
+    QVERIFY(!aggregate.id().isNull());
+
+    // Delete the exported contact, then change it in the privileged DB before the deletion is imported
+    QVERIFY(m_nonprivilegedManager->removeContact(exported.id()));
+
+    setTestPhoneNumber(QStringLiteral("First3"), QStringLiteral("+19990000003"));
+
+    // A notified pass must not recreate the deleted contact
+    QSignalSpy finishedSpy(m_worker, SIGNAL(syncFinished(bool,bool,bool,QList<QContactId>,QList<QContactId>,qint64)));
+    m_worker->sync(false, QList<QContactId>() << aggregate.id(), QList<QContactId>(), true, false);
+    QCOMPARE(finishedSpy.count(), 1);
+    QCOMPARE(finishedSpy.takeFirst().at(0).toBool(), true);
+
+    QVERIFY(exportedContact(QStringLiteral("First3")).id().isNull());
+    QCOMPARE(exportedContacts().count(), exportedCount - 1);
+
+    // The full sync imports the deletion, rather than exporting the contact again
+    m_worker->sync(true, QList<QContactId>(), QList<QContactId>(), true, false);
+    QCOMPARE(finishedSpy.count(), 1);
+    QCOMPARE(finishedSpy.takeFirst().at(0).toBool(), true);
+
+    QVERIFY(exportedContact(QStringLiteral("First3")).id().isNull());
+    QVERIFY(aggregateContact(*m_privilegedManager, QStringLiteral("First3")).id().isNull());
+}
+
+void TestExporterPlugin::cleanupTestCase()
+{
+    delete m_worker;
+    delete m_nonprivilegedManager;
+    delete m_privilegedManager;
+}
+
+CONTACTSD_TEST_MAIN(TestExporterPlugin)
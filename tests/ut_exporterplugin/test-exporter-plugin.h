@@ -0,0 +1,79 @@
+/** This file is part of Contacts daemon
+ **
+ ** Copyright (c) 2014 Jolla Ltd.
+ **
+ ** Contact: Matt Vogt <matthew.vogt@jollamobile.com>
+ **
+ ** GNU Lesser General Public License Usage
+ ** This file may be used under the terms of the GNU Lesser General Public License
+ ** version 2.1 as published by the Free Software Foundation and appearing in the
+ ** file LICENSE.LGPL included in the packaging of this file.  Please review the
+ ** following information to ensure the GNU Lesser General Public License version
+ ** 2.1 requirements will be met:
+ ** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+ **/
+
+#ifndef TEST_EXPORTER_PLUGIN_H
+#define TEST_EXPORTER_PLUGIN_H
+
+#include <QObject>
+#include <QTemporaryDir>
+#include <QtTest/QtTest>
+
+#include <QContactManager>
+
+#include "../../plugins/exporter/cdexportercontroller.h"
+
+QTCONTACTS_USE_NAMESPACE
+
+class TestExporterPlugin : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit TestExporterPlugin(QObject *parent = 0);
+
+private Q_SLOTS:
+    void initTestCase();
+
+    void testIdMapRoundTrip();
+    void testIdMapTruncatedDeltas();
+    void testIdMapDeltaSegments();
+    void testIdMapLegacyMigration();
+    void testFingerprintIgnoresOrder();
+    void testFingerprintIgnoresUris();
+    void testFingerprintChangedTypes();
+    void testAvatarManifestLink();
+    void testAvatarManifestReplace();
+    void testAvatarManifestRelease();
+
+    // These tests run in order, each operating on the state left by the last
+    void testExport();
+    void testVerifyUnchanged();
+    void testVerifyAfterRestart();
+    void testVerifyRepairsDrift();
+    void testPreemptedSync();
+    void testMirrorPresence();
+    void testResumeInterruptedExport();
+    void testNotifiedSyncKeepsExportDeletion();
+
+    void cleanupTestCase();
+
+private:
+    QList<QContact> testContacts(QContactManager &manager) const;
+    QList<QContact> exportedContacts() const;
+    QContact exportedContact(const QString &firstName) const;
+    QContact aggregateContact(QContactManager &manager, const QString &firstName) const;
+    QContact testContact(QContactManager &manager, const QString &firstName) const;
+    bool runVerify(CDExporterWorker *worker, int *drifted, int *repaired);
+    void setTestPhoneNumber(const QString &firstName, const QString &number);
+
+    QTemporaryDir m_dataDir;
+    QString m_avatarPath;
+    QAtomicInt m_preemptRequest;
+    QContactManager *m_privilegedManager;
+    QContactManager *m_nonprivilegedManager;
+    CDExporterWorker *m_worker;
+};
+
+#endif // TEST_EXPORTER_PLUGIN_H
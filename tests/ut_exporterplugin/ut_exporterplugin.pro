@@ -0,0 +1,38 @@
+include(../common/test-common.pri)
+
+TARGET = ut_exporterplugin
+target.path = /opt/tests/$${PACKAGENAME}/$$TARGET
+
+CONFIG += test link_pkgconfig
+
+QT -= gui
+QT += dbus testlib
+QT += contacts-private
+DEFINES += ENABLE_DEBUG
+
+PKGCONFIG += mlite5 Qt5Contacts buteosyncfw5
+PKGCONFIG += qtcontacts-sqlite-qt5-extensions
+DEFINES *= USING_QTPIM QTCONTACTS_SQLITE_PERFORM_AGGREGATION
+
+DEFINES -= QT_NO_CAST_TO_ASCII
+DEFINES -= QT_NO_CAST_FROM_ASCII
+
+INCLUDEPATH += \
+    ../../plugins/exporter \
+    ../../src
+
+HEADERS += \
+    test-exporter-plugin.h \
+    ../../plugins/exporter/cdexporteravatarmanifest.h \
+    ../../plugins/exporter/cdexportercontroller.h \
+    ../../plugins/exporter/cdexporterfingerprint.h \
+    ../../plugins/exporter/cdexporteridmap.h
+
+SOURCES += \
+    test-exporter-plugin.cpp \
+    ../../plugins/exporter/cdexporteravatarmanifest.cpp \
+    ../../plugins/exporter/cdexportercontroller.cpp \
+    ../../plugins/exporter/cdexporterfingerprint.cpp \
+    ../../plugins/exporter/cdexporteridmap.cpp
+
+INSTALLS += target
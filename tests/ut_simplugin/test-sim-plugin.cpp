@@ -15,12 +15,19 @@
 
 #include "test-sim-plugin.h"
 
+#include "../../plugins/sim/cdsimcontactwriter.h"
+
 #include <test-common.h>
 
+#include <MGConfItem>
+
+#include <QContactDeactivated>
 #include <QContactDetailFilter>
 #include <QContactNickname>
 #include <QContactPhoneNumber>
+#include <QContactStatusFlags>
 #include <QContactSyncTarget>
+#include <QSignalSpy>
 
 #ifdef USING_QTPIM
 QTCONTACTS_USE_NAMESPACE
@@ -28,17 +35,28 @@ QTCONTACTS_USE_NAMESPACE
 
 namespace {
 
-QList<QContact> getAllSimContacts(const QContactManager &m)
+QList<QContact> getAllSimContacts(const QContactManager &m, const QString &syncTarget = QStringLiteral("sim-test"))
 {
     QContactDetailFilter stFilter;
     stFilter.setDetailType(QContactSyncTarget::Type, QContactSyncTarget::FieldSyncTarget);
-    stFilter.setValue(QStringLiteral("sim-test"));
+    stFilter.setValue(syncTarget);
 
     return m.contacts(stFilter);
 }
 
 }
 
+TestSimController::TestSimController(QObject *parent)
+    : CDSimController(parent, QStringLiteral("sim-test"))
+    , requestCount(0)
+{
+}
+
+void TestSimController::requestPhonebookData()
+{
+    ++requestCount;
+}
+
 // In this test, we bypass the contacts daemon entirely, and test the controller
 // class which contains all the logic, without involving the real SIM at all.
 
@@ -53,6 +71,8 @@ void TestSimPlugin::init()
 
 void TestSimPlugin::initTestCase()
 {
+    qRegisterMetaType<QList<QContactId> >();
+
     m_controller = new CDSimController(this, QStringLiteral("sim-test"));
 }
 
@@ -544,6 +564,250 @@ void TestSimPlugin::testCoalescing()
     }
 }
 
+void TestSimPlugin::testUnchangedPhonebook()
+{
+    // Requests for phonebook data are answered here, rather than by oFono
+    TestSimController controller;
+    controller.setModemPath(QStringLiteral("/test"));
+
+    QContactManager &m(m_controller->contactManager());
+
+    QCOMPARE(getAllSimContacts(m).count(), 0);
+
+    const QString vcardData(QStringLiteral(
+"BEGIN:VCARD\n"
+"VERSION:3.0\n"
+"FN:Forrest Gump\n"
+"TEL;TYPE=HOME,VOICE:(404) 555-1212\n"
+"END:VCARD\n"));
+
+    // The phonebook becomes available, and is read
+    controller.interfacesChanged(QStringList() << QStringLiteral("org.ofono.Phonebook"));
+    QCOMPARE(controller.requestCount, 1);
+    QCOMPARE(controller.busy(), true);
+    controller.vcardDataAvailable(vcardData);
+    QTRY_VERIFY(controller.busy() == false);
+
+    QList<QContact> simContacts(getAllSimContacts(m));
+    QCOMPARE(simContacts.count(), 1);
+    const QContactId contactId(simContacts.at(0).id());
+
+    // The contacts are deactivated while the phonebook is unavailable
+    controller.interfacesChanged(QStringList());
+    QCOMPARE(getAllSimContacts(m).count(), 0);
+
+    // The same phonebook is not imported again, but its contacts are reactivated
+    controller.interfacesChanged(QStringList() << QStringLiteral("org.ofono.Phonebook"));
+    QCOMPARE(controller.requestCount, 2);
+    QCOMPARE(controller.busy(), true);
+    controller.vcardDataAvailable(vcardData);
+    QCOMPARE(controller.busy(), false);
+
+    simContacts = getAllSimContacts(m);
+    QCOMPARE(simContacts.count(), 1);
+    QCOMPARE(simContacts.at(0).id(), contactId);
+    QCOMPARE(simContacts.at(0).detail<QContactNickname>().nickname(), QStringLiteral("Forrest Gump"));
+
+    // Once the stored contacts have been modified, the phonebook must be imported again
+    QContact contact(simContacts.at(0));
+    QContactPhoneNumber number(contact.detail<QContactPhoneNumber>());
+    number.setNumber(QStringLiteral("(404) 555-9999"));
+    contact.saveDetail(&number);
+    QVERIFY(m.saveContact(&contact));
+
+    controller.interfacesChanged(QStringList());
+    controller.interfacesChanged(QStringList() << QStringLiteral("org.ofono.Phonebook"));
+    QCOMPARE(controller.requestCount, 3);
+    controller.vcardDataAvailable(vcardData);
+    QCOMPARE(controller.busy(), true);
+    QTRY_VERIFY(controller.busy() == false);
+
+    simContacts = getAllSimContacts(m);
+    QCOMPARE(simContacts.count(), 1);
+    QCOMPARE(simContacts.at(0).id(), contactId);
+    QCOMPARE(simContacts.at(0).details<QContactPhoneNumber>().count(), 1);
+    QCOMPARE(simContacts.at(0).detail<QContactPhoneNumber>().number(), QStringLiteral("(404) 555-1212"));
+
+    MGConfItem(controller.phonebookFingerprintKey()).unset();
+}
+
+void TestSimPlugin::testDeactivation()
+{
+    TestSimController controller;
+    controller.setModemPath(QStringLiteral("/test"));
+
+    QContactManager &m(m_controller->contactManager());
+
+    QCOMPARE(getAllSimContacts(m).count(), 0);
+
+    const QString vcardData(QStringLiteral(
+"BEGIN:VCARD\n"
+"VERSION:3.0\n"
+"FN:Forrest Gump\n"
+"TEL;TYPE=HOME,VOICE:(404) 555-1212\n"
+"TEL;TYPE=CELL:(404) 555-3434\n"
+"END:VCARD\n"));
+
+    controller.interfacesChanged(QStringList() << QStringLiteral("org.ofono.Phonebook"));
+    controller.vcardDataAvailable(vcardData);
+    QTRY_VERIFY(controller.busy() == false);
+
+    QList<QContact> simContacts(getAllSimContacts(m));
+    QCOMPARE(simContacts.count(), 1);
+    const QContact imported(simContacts.at(0));
+    QCOMPARE(imported.details<QContactPhoneNumber>().count(), 2);
+    QVERIFY(!imported.detail<QContactStatusFlags>().testFlag(QContactStatusFlags::IsDeactivated));
+
+    // Only the deactivated state changes when the phonebook becomes unavailable
+    controller.interfacesChanged(QStringList());
+    QCOMPARE(getAllSimContacts(m).count(), 0);
+
+    QContact deactivated(m.contact(imported.id()));
+    QCOMPARE(deactivated.id(), imported.id());
+    QVERIFY(deactivated.detail<QContactStatusFlags>().testFlag(QContactStatusFlags::IsDeactivated));
+    QCOMPARE(deactivated.detail<QContactNickname>().nickname(), imported.detail<QContactNickname>().nickname());
+    QCOMPARE(deactivated.details<QContactPhoneNumber>(), imported.details<QContactPhoneNumber>());
+
+    // ...and again when it returns
+    controller.interfacesChanged(QStringList() << QStringLiteral("org.ofono.Phonebook"));
+    controller.vcardDataAvailable(vcardData);
+    QCOMPARE(controller.busy(), false);
+
+    simContacts = getAllSimContacts(m);
+    QCOMPARE(simContacts.count(), 1);
+    const QContact reactivated(simContacts.at(0));
+    QCOMPARE(reactivated.id(), imported.id());
+    QVERIFY(!reactivated.detail<QContactStatusFlags>().testFlag(QContactStatusFlags::IsDeactivated));
+    QCOMPARE(reactivated.detail<QContactNickname>().nickname(), imported.detail<QContactNickname>().nickname());
+    QCOMPARE(reactivated.details<QContactPhoneNumber>(), imported.details<QContactPhoneNumber>());
+
+    MGConfItem(controller.phonebookFingerprintKey()).unset();
+}
+
+void TestSimPlugin::testChunkedImport()
+{
+    QContactManager &m(m_controller->contactManager());
+
+    QCOMPARE(getAllSimContacts(m).count(), 0);
+
+    m_controller->simPresenceChanged(true);
+
+    // Each name appears at the start and the end of the phonebook, so it is read in separate chunks
+    const int contactCount(60);
+    QString vcardData;
+    for (int i = 0; i < contactCount * 2; ++i) {
+        vcardData.append(QStringLiteral(
+"BEGIN:VCARD\n"
+"VERSION:3.0\n"
+"FN:Contact %1\n"
+"TEL;TYPE=HOME,VOICE:(404) 555-%2\n"
+"END:VCARD\n").arg(i % contactCount).arg(i, 4, 10, QLatin1Char('0')));
+    }
+
+    m_controller->vcardDataAvailable(vcardData);
+    QCOMPARE(m_controller->busy(), true);
+    QTRY_VERIFY(m_controller->busy() == false);
+
+    QList<QContact> simContacts(getAllSimContacts(m));
+    QCOMPARE(simContacts.count(), contactCount);
+    foreach (const QContact &contact, simContacts) {
+        QCOMPARE(contact.details<QContactPhoneNumber>().count(), 2);
+    }
+
+    // Change the second number of one name; only that contact should be written
+    QSignalSpy changedSpy(&m, SIGNAL(contactsChanged(QList<QContactId>)));
+    vcardData.replace(QStringLiteral("(404) 555-0060"), QStringLiteral("(404) 555-9060"));
+
+    m_controller->vcardDataAvailable(vcardData);
+    QCOMPARE(m_controller->busy(), true);
+    QTRY_VERIFY(m_controller->busy() == false);
+
+    QSet<QContactId> changedIds;
+    for (int i = 0; i < changedSpy.count(); ++i) {
+        foreach (const QContactId &id, changedSpy.at(i).at(0).value<QList<QContactId> >()) {
+            changedIds.insert(id);
+        }
+    }
+    QCOMPARE(changedIds.count(), 1);
+
+    simContacts = getAllSimContacts(m);
+    QCOMPARE(simContacts.count(), contactCount);
+    foreach (const QContact &contact, simContacts) {
+        QCOMPARE(contact.details<QContactPhoneNumber>().count(), 2);
+        if (contact.detail<QContactNickname>().nickname() == QStringLiteral("Contact 0")) {
+            QCOMPARE(changedIds.contains(contact.id()), true);
+        }
+    }
+
+    // Remove the second occurrence of each name; the numbers read from the first chunks should remain
+    vcardData.truncate(vcardData.indexOf(QStringLiteral("BEGIN:VCARD\nVERSION:3.0\nFN:Contact 0\n"), 1));
+
+    m_controller->vcardDataAvailable(vcardData);
+    QCOMPARE(m_controller->busy(), true);
+    QTRY_VERIFY(m_controller->busy() == false);
+
+    simContacts = getAllSimContacts(m);
+    QCOMPARE(simContacts.count(), contactCount);
+    foreach (const QContact &contact, simContacts) {
+        QCOMPARE(contact.details<QContactPhoneNumber>().count(), 1);
+    }
+}
+
+void TestSimPlugin::testMultipleModems()
+{
+    // Two controllers sharing one writer, as for a dual-SIM device
+    CDSimContactWriter writer;
+    CDSimController first(0, QStringLiteral("sim-test"), &writer);
+    CDSimController second(0, QStringLiteral("sim-test-2"), &writer);
+
+    QContactManager &m(writer.contactManager());
+
+    QCOMPARE(getAllSimContacts(m).count(), 0);
+    QCOMPARE(getAllSimContacts(m, QStringLiteral("sim-test-2")).count(), 0);
+
+    first.simPresenceChanged(true);
+    second.simPresenceChanged(true);
+
+    QString firstData;
+    QString secondData;
+    for (int i = 0; i < 75; ++i) {
+        firstData.append(QStringLiteral(
+"BEGIN:VCARD\n"
+"VERSION:3.0\n"
+"FN:First %1\n"
+"TEL;TYPE=HOME,VOICE:(404) 555-%2\n"
+"END:VCARD\n").arg(i).arg(i, 4, 10, QLatin1Char('0')));
+        secondData.append(QStringLiteral(
+"BEGIN:VCARD\n"
+"VERSION:3.0\n"
+"FN:Second %1\n"
+"TEL;TYPE=CELL:(404) 666-%2\n"
+"END:VCARD\n").arg(i).arg(i, 4, 10, QLatin1Char('0')));
+    }
+
+    // Both phonebooks are imported at the same time
+    first.vcardDataAvailable(firstData);
+    second.vcardDataAvailable(secondData);
+    QCOMPARE(first.busy(), true);
+    QCOMPARE(second.busy(), true);
+    QTRY_VERIFY(first.busy() == false && second.busy() == false);
+
+    const QList<QContact> firstContacts(getAllSimContacts(m));
+    const QList<QContact> secondContacts(getAllSimContacts(m, QStringLiteral("sim-test-2")));
+    QCOMPARE(firstContacts.count(), 75);
+    QCOMPARE(secondContacts.count(), 75);
+    foreach (const QContact &contact, secondContacts) {
+        QVERIFY(contact.detail<QContactNickname>().nickname().startsWith(QStringLiteral("Second ")));
+    }
+
+    foreach (const QContact &contact, secondContacts) {
+        QVERIFY(m.removeContact(contact.id()));
+    }
+
+    MGConfItem(first.phonebookFingerprintKey()).unset();
+    MGConfItem(second.phonebookFingerprintKey()).unset();
+}
+
 void TestSimPlugin::testEmpty()
 {
     QContactManager &m(m_controller->contactManager());
@@ -628,6 +892,9 @@ void TestSimPlugin::cleanup()
     foreach (const QContact &contact, getAllSimContacts(m)) {
         QVERIFY(m.removeContact(contact.id()));
     }
+
+    // Don't leave the fingerprint of the imported phonebook in the user's settings
+    MGConfItem(m_controller->phonebookFingerprintKey()).unset();
 }
 
 CONTACTSD_TEST_MAIN(TestSimPlugin)
@@ -21,6 +21,20 @@
 
 #include "../../plugins/sim/cdsimcontroller.h"
 
+// A controller whose phonebook data is supplied by the test
+class TestSimController : public CDSimController
+{
+    Q_OBJECT
+
+public:
+    explicit TestSimController(QObject *parent = 0);
+
+    int requestCount;
+
+protected:
+    void requestPhonebookData();
+};
+
 class TestSimPlugin : public QObject
 {
     Q_OBJECT
@@ -42,6 +56,10 @@ private Q_SLOTS:
     void testMultipleIdenticalNumbers();
     void testTrimWhitespace();
     void testCoalescing();
+    void testUnchangedPhonebook();
+    void testDeactivation();
+    void testChunkedImport();
+    void testMultipleModems();
     void testEmpty();
     void testClear();
 
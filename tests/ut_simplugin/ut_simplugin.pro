@@ -19,10 +19,12 @@ INCLUDEPATH += \
 
 HEADERS += \
     test-sim-plugin.h \
+    ../../plugins/sim/cdsimcontactwriter.h \
     ../../plugins/sim/cdsimcontroller.h
 
 SOURCES += \
     test-sim-plugin.cpp \
+    ../../plugins/sim/cdsimcontactwriter.cpp \
     ../../plugins/sim/cdsimcontroller.cpp
 
 INSTALLS += target
@@ -39,6 +39,8 @@
 #include "test-expectation.h"
 #include "debug.h"
 
+using namespace Contactsd;
+
 #ifdef USING_QTPIM
 const int QContactOnlineAccount__FieldAccountPath = (QContactOnlineAccount::FieldSubTypes+1);
 
@@ -21,6 +21,9 @@
  ** conditions contained in a signed written agreement between you and Nokia.
  **/
 
+#include <QDataStream>
+#include <QTemporaryDir>
+
 #include <QContact>
 #include <QContactFetchByIdRequest>
 #include <QContactFetchRequest>
@@ -47,6 +50,12 @@
 #include "buddymanagementinterface.h"
 #include "debug.h"
 
+#include "../../plugins/telepathy/cdtpchangejournal.h"
+#include "../../plugins/telepathy/cdtpextrainfoscheduler.h"
+#include "../../plugins/telepathy/cdtpwritescheduler.h"
+
+using namespace Contactsd;
+
 #ifdef USING_QTPIM
 const int QContactOnlineAccount__FieldAccountPath = (QContactOnlineAccount::FieldSubTypes+1);
 #endif
@@ -906,6 +915,325 @@ void TestTelepathyPlugin::contactsChanged(const QList<ContactIdType>& contactIds
     verify(EventChanged, contactIds);
 }
 
+class TestExtraInfoStorage : public CDTpExtraInfoScheduler::Storage
+{
+public:
+    TestExtraInfoStorage() : queuedUpdates(0) {}
+
+    int queuedUpdateCount() const { return queuedUpdates; }
+
+    QSet<QString> contactsWithStoredInfo(const QString &accountPath, const QStringList &contactIds)
+    {
+        Q_UNUSED(accountPath);
+        return contactIds.toSet() & storedInfo;
+    }
+
+    int queuedUpdates;
+    QSet<QString> storedInfo;
+};
+
+class TestExtraInfoScheduler : public CDTpExtraInfoScheduler
+{
+public:
+    TestExtraInfoScheduler(Storage *storage) : CDTpExtraInfoScheduler(storage) {}
+
+    void enqueueContact(const QString &contactId)
+    {
+        enqueueRequest(QLatin1String("account"), contactId, Tp::ContactPtr());
+    }
+
+    // Each tick refills one token before dispatching
+    QStringList tick()
+    {
+        dispatched.clear();
+        onTimeout();
+        return dispatched;
+    }
+
+protected:
+    bool dispatch(const Request &request)
+    {
+        dispatched.append(request.contactId);
+        return true;
+    }
+
+private:
+    QStringList dispatched;
+};
+
+static QStringList extraInfoContactIds(int first, int last)
+{
+    QStringList rv;
+    for (int i = first; i <= last; ++i) {
+        rv.append(QString(QLatin1String("contact%1")).arg(i));
+    }
+    return rv;
+}
+
+void TestTelepathyPlugin::testExtraInfoBackpressure()
+{
+    TestExtraInfoStorage storage;
+    TestExtraInfoScheduler scheduler(&storage);
+
+    /* The first five contacts already have their extra info stored */
+    Q_FOREACH (const QString &contactId, extraInfoContactIds(0, 29)) {
+        scheduler.enqueueContact(contactId);
+    }
+    storage.storedInfo = extraInfoContactIds(0, 4).toSet();
+
+    /* Nothing is requested while storage has a write backlog */
+    storage.queuedUpdates = 50;
+    QCOMPARE(scheduler.tick(), QStringList());
+    QCOMPARE(scheduler.pendingCount(), 30);
+
+    /* A full bucket allows a burst, then one request per tick */
+    storage.queuedUpdates = 49;
+    QCOMPARE(scheduler.tick(), extraInfoContactIds(5, 14));
+    QCOMPARE(scheduler.tick(), extraInfoContactIds(15, 15));
+
+    /* Tokens keep refilling while paused, and are spent once writes catch up */
+    storage.queuedUpdates = 50;
+    QCOMPARE(scheduler.tick(), QStringList());
+    storage.queuedUpdates = 0;
+    QCOMPARE(scheduler.tick(), extraInfoContactIds(16, 17));
+
+    /* Contacts with stored extra info are only requested after all the others */
+    QStringList dispatched;
+    for (int i = 0; i < 30 && scheduler.pendingCount() > 0; ++i) {
+        dispatched += scheduler.tick();
+    }
+    QCOMPARE(dispatched, extraInfoContactIds(18, 29) + extraInfoContactIds(0, 4));
+    QCOMPARE(scheduler.pendingCount(), 0);
+}
+
+struct TestWriteSlice
+{
+    TestWriteSlice(int index = 0, int contacts = 0) : index(index), contacts(contacts) {}
+
+    int index;
+    int contacts;
+
+    int cost() const { return contacts; }
+};
+
+typedef CDTpWriteScheduler<TestWriteSlice> TestWriteScheduler;
+
+// The storage quantum: half of a full slice of 10 contacts
+static const int writeQuantum = 5;
+
+static QStringList takeWriteRound(TestWriteScheduler &scheduler)
+{
+    QStringList rv;
+    Q_FOREACH (const TestWriteScheduler::ScheduledSlice &scheduled, scheduler.takeRound()) {
+        rv.append(scheduled.first + QString::number(scheduled.second.index));
+    }
+    return rv;
+}
+
+void TestTelepathyPlugin::testWriteSchedulerFairness()
+{
+    TestWriteScheduler scheduler(writeQuantum);
+
+    /* Two accounts importing at the same time */
+    for (int i = 0; i < 4; ++i) {
+        scheduler.enqueue(QLatin1String("a"), TestWriteSlice(i, 10));
+        scheduler.enqueue(QLatin1String("b"), TestWriteSlice(i, 10));
+    }
+    QCOMPARE(scheduler.depth(), 80);
+    QCOMPARE(scheduler.depth(QLatin1String("a")), 40);
+
+    /* Each writes a full slice every other round, in turn and in order */
+    QStringList order;
+    int rounds = 0;
+    while (!scheduler.isEmpty()) {
+        order += takeWriteRound(scheduler);
+        QVERIFY(++rounds <= 8);
+    }
+    QCOMPARE(rounds, 8);
+    QCOMPARE(order, QStringList() << QLatin1String("a0") << QLatin1String("b0")
+                                  << QLatin1String("a1") << QLatin1String("b1")
+                                  << QLatin1String("a2") << QLatin1String("b2")
+                                  << QLatin1String("a3") << QLatin1String("b3"));
+    QCOMPARE(scheduler.depth(), 0);
+}
+
+void TestTelepathyPlugin::testWriteSchedulerSmallAccount()
+{
+    TestWriteScheduler scheduler(writeQuantum);
+
+    for (int i = 0; i < 50; ++i) {
+        scheduler.enqueue(QLatin1String("import"), TestWriteSlice(i, 10));
+    }
+    QCOMPARE(takeWriteRound(scheduler), QStringList());
+    QCOMPARE(takeWriteRound(scheduler), QStringList() << QLatin1String("import0"));
+
+    /* Presence updates of another account arrive during the import, and are
+     * written in the next round */
+    scheduler.enqueue(QLatin1String("presence"), TestWriteSlice(0, 1));
+    scheduler.enqueue(QLatin1String("presence"), TestWriteSlice(1, 2));
+    QCOMPARE(takeWriteRound(scheduler), QStringList() << QLatin1String("presence0") << QLatin1String("presence1"));
+    QVERIFY(!scheduler.contains(QLatin1String("presence")));
+
+    /* The deficit is dropped once the queue drains, so a full slice waits its turn */
+    scheduler.enqueue(QLatin1String("presence"), TestWriteSlice(2, 10));
+    QCOMPARE(takeWriteRound(scheduler), QStringList() << QLatin1String("import1"));
+    QCOMPARE(takeWriteRound(scheduler), QStringList() << QLatin1String("presence2"));
+
+    /* A slice whose updates were all cancelled costs nothing */
+    scheduler.enqueue(QLatin1String("presence"), TestWriteSlice(3, 10));
+    QQueue<TestWriteSlice> *slices = scheduler.slices(QLatin1String("presence"));
+    QVERIFY(slices);
+    slices->head().contacts = 0;
+    QCOMPARE(scheduler.depth(QLatin1String("presence")), 0);
+    QCOMPARE(takeWriteRound(scheduler), QStringList() << QLatin1String("import2") << QLatin1String("presence3"));
+
+    /* Removing the importing account drops its queue */
+    QCOMPARE(scheduler.depth(), 47 * 10);
+    scheduler.remove(QLatin1String("import"));
+    QVERIFY(scheduler.isEmpty());
+    QCOMPARE(scheduler.depth(), 0);
+}
+
+static const QLatin1String journalAccountPath("/org/freedesktop/Telepathy/Account/fakecm/fakeproto/journal");
+
+// Change masks as journaled by the storage; their meaning doesn't matter here
+static const uint journalAdded = 0x3ff;
+static const uint journalPresence = 0x2;
+
+static QString journalContactId(int index)
+{
+    return QString::fromLatin1("contact%1@example.com").arg(index);
+}
+
+static QString journalAddress(int index)
+{
+    return journalAccountPath + QLatin1Char('!') + journalContactId(index);
+}
+
+void TestTelepathyPlugin::testJournalKilledImport()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString fileName(dir.path() + QLatin1String("/pending-changes"));
+    const QString killedFileName(dir.path() + QLatin1String("/pending-changes-killed"));
+
+    {
+        CDTpChangeJournal journal;
+        QVERIFY(journal.open(fileName));
+        QVERIFY(!journal.recovered());
+
+        /* Queue the import of 30 contacts, and write the first slice of 10 */
+        for (int i = 0; i < 30; ++i) {
+            journal.appendContact(journalAddress(i), journalAdded);
+        }
+        const quint64 sequence = journal.sequence();
+        for (int i = 0; i < 10; ++i) {
+            journal.recordStored(journalAddress(i), journalAdded);
+            journal.commitContact(journalAddress(i), journalAdded, sequence);
+        }
+        journal.recordRemoved(QLatin1String("removed-contact"));
+
+        /* The daemon is killed, leaving the file as it is now */
+        QVERIFY(QFile::copy(fileName, killedFileName));
+    }
+
+    /* Restart: only the unwritten slices are replayed */
+    CDTpChangeJournal journal;
+    QVERIFY(journal.open(killedFileName));
+    QVERIFY(journal.recovered());
+
+    const QHash<QString, uint> recovered(journal.takeRecoveredContacts(journalAccountPath));
+    QCOMPARE(recovered.count(), 20);
+    for (int i = 10; i < 30; ++i) {
+        QCOMPARE(recovered.value(journalContactId(i)), journalAdded);
+    }
+    QVERIFY(journal.takeRecoveredContacts(journalAccountPath).isEmpty());
+
+    /* The written slice is known as our own write, not an external change */
+    QHash<QString, uint> stored(journal.storedContacts(journalAccountPath));
+    QCOMPARE(stored.count(), 10);
+    for (int i = 0; i < 10; ++i) {
+        QCOMPARE(stored.value(journalContactId(i)), journalAdded);
+    }
+    QVERIFY(journal.removedContacts().contains(QLatin1String("removed-contact")));
+
+    /* A second kill before the replay is written keeps all of it */
+    const QString killedAgainFileName(dir.path() + QLatin1String("/pending-changes-killed-again"));
+    QVERIFY(QFile::copy(killedFileName, killedAgainFileName));
+    {
+        CDTpChangeJournal killedAgain;
+        QVERIFY(killedAgain.open(killedAgainFileName));
+        QCOMPARE(killedAgain.takeRecoveredContacts(journalAccountPath).count(), 20);
+        QCOMPARE(killedAgain.storedContacts(journalAccountPath).count(), 10);
+        QVERIFY(killedAgain.removedContacts().contains(QLatin1String("removed-contact")));
+    }
+
+    /* Write the replayed slices */
+    const quint64 sequence = journal.sequence();
+    for (int i = 10; i < 30; ++i) {
+        journal.recordStored(journalAddress(i), journalPresence);
+        journal.commitContact(journalAddress(i), recovered.value(journalContactId(i)), sequence);
+    }
+    stored = journal.storedContacts(journalAccountPath);
+    QCOMPARE(stored.count(), 30);
+    QCOMPARE(stored.value(journalContactId(0)), journalAdded);
+    QCOMPARE(stored.value(journalContactId(10)), journalPresence);
+
+    /* A clean shutdown drops the journal, as the stamps are rewritten then */
+    journal.close();
+    QVERIFY(!QFile::exists(killedFileName));
+
+    CDTpChangeJournal restarted;
+    QVERIFY(restarted.open(killedFileName));
+    QVERIFY(!restarted.recovered());
+    QVERIFY(restarted.storedContacts(journalAccountPath).isEmpty());
+    QVERIFY(restarted.removedContacts().isEmpty());
+}
+
+void TestTelepathyPlugin::testJournalTornRecord()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString fileName(dir.path() + QLatin1String("/pending-changes"));
+    const QString killedFileName(dir.path() + QLatin1String("/pending-changes-killed"));
+
+    {
+        CDTpChangeJournal journal;
+        QVERIFY(journal.open(fileName));
+
+        journal.appendContact(journalAddress(0), journalAdded);
+        journal.appendContact(journalAddress(1), journalPresence);
+        journal.appendAccount(journalAccountPath, 0x1);
+
+        /* Only part of the first contact's changes are stored */
+        journal.commitContact(journalAddress(0), journalAdded & ~journalPresence, journal.sequence());
+
+        /* A later change is not covered by a commit of an earlier batch */
+        const quint64 sequence = journal.sequence();
+        journal.appendContact(journalAddress(1), journalPresence);
+        journal.commitContact(journalAddress(1), journalPresence, sequence - 1);
+
+        QVERIFY(QFile::copy(fileName, killedFileName));
+    }
+
+    /* The kill tore the record being appended */
+    QFile file(killedFileName);
+    QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Append));
+    QDataStream stream(&file);
+    stream << quint8(1) << journalAddress(2);
+    file.close();
+
+    CDTpChangeJournal journal;
+    QVERIFY(journal.open(killedFileName));
+    QVERIFY(journal.recovered());
+
+    const QHash<QString, uint> recovered(journal.takeRecoveredContacts(journalAccountPath));
+    QCOMPARE(recovered.count(), 2);
+    QCOMPARE(recovered.value(journalContactId(0)), journalPresence);
+    QCOMPARE(recovered.value(journalContactId(1)), journalPresence);
+    QCOMPARE(journal.takeRecoveredAccount(journalAccountPath), 0x1u);
+}
+
 void TestTelepathyPlugin::contactsRemoved(const QList<ContactIdType>& contactIds)
 {
     debug() << "Got contactsRemoved";
@@ -101,6 +101,13 @@ private Q_SLOTS:
     void testBug220851();
     void testIRIEncode();
 
+    /* Storage scheduling and recovery */
+    void testExtraInfoBackpressure();
+    void testWriteSchedulerFairness();
+    void testWriteSchedulerSmallAccount();
+    void testJournalKilledImport();
+    void testJournalTornRecord();
+
     /* Benchmark */
     void testBenchmark();
 
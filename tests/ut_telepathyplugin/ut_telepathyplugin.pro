@@ -47,7 +47,9 @@ DEFINES *= USING_QTPIM
 system(cp $$PWD/../../plugins/telepathy/com.nokia.contacts.buddymanagement.xml .)
 system(qdbusxml2cpp -c BuddyManagementInterface -p buddymanagementinterface.h:buddymanagementinterface.cpp com.nokia.contacts.buddymanagement.xml)
 
-INCLUDEPATH += ..
+INCLUDEPATH += .. \
+    ../../plugins/telepathy \
+    ../../src
 QMAKE_LIBDIR += ../libtelepathy
 LIBS += -ltelepathy
 
@@ -56,17 +58,22 @@ QMAKE_CXXFLAGS += -c -g --coverage -ftest-coverage -fprofile-arcs
 LIBS += -lgcov
 }
 
-HEADERS += debug.h \
-    test-telepathy-plugin.h \
+HEADERS += test-telepathy-plugin.h \
     test-expectation.h \
     test.h \
-    buddymanagementinterface.h
+    buddymanagementinterface.h \
+    ../../plugins/telepathy/cdtpchangejournal.h \
+    ../../plugins/telepathy/cdtpextrainfoscheduler.h \
+    ../../plugins/telepathy/cdtpwritescheduler.h \
+    ../../src/debug.h
 
-SOURCES += debug.cpp \
-    test-telepathy-plugin.cpp \
+SOURCES += test-telepathy-plugin.cpp \
     test-expectation.cpp \
     test.cpp \
-    buddymanagementinterface.cpp
+    buddymanagementinterface.cpp \
+    ../../plugins/telepathy/cdtpchangejournal.cpp \
+    ../../plugins/telepathy/cdtpextrainfoscheduler.cpp \
+    ../../src/debug.cpp
 
 #for gcov stuff
 CONFIG(coverage): {